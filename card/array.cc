@@ -14,6 +14,7 @@
 
 
 #include <string>
+#include <sstream>
 #include <algorithm>		// for swap(), max and min
 
 #include <math.h>
@@ -38,7 +39,9 @@
 #include "utils.h"
 #include "array.h"
 #include "batcher-permute.h"
+#include "crypt-pipeline.h"
 #include "runtime-exceptions.h"
+#include "cvm-options.h"
 
 
 OPEN_NS
@@ -108,7 +111,8 @@ INSTANTIATE_STATIC_INIT(Array);
 /// size. boost::none if the array should already exist on the host.
 Array::Array (const string& name,
 	      const boost::optional <pair<size_t, size_t> >& size_params,
-              CryptoProviderFactory * prov_fact)
+              CryptoProviderFactory * prov_fact,
+	      bool zero_fill)
     : _name		(name),
       
       N			(size_params ? size_params->first  : 0),
@@ -117,13 +121,53 @@ Array::Array (const string& name,
       _prov_fact	(prov_fact),
       _rand_prov	(_prov_fact->getRandProvider()),
 
-      _num_retrievals	(0)
+      _num_retrievals	(0),
+      _T_len		(0),
+      _background	(false),
+      _carry_len	(0),
+      _next_dummy	(0),
+      _use_oram		(false)
 
 {
+    // Which scheme? An existing array's length is only known from its
+    // container, which is A's, or the Path ORAM's elements before the tree
+    // is built.
+    if (size_params) {
+	_use_oram = use_path_oram (name, N);
+    }
+    else if (!g_cvm_options.path_oram_arrays.empty() ||
+	     g_cvm_options.path_oram_min > 0)
+    {
+	FlatIO existing (name + DIRSEP + "array", none);
+	_use_oram = use_path_oram (name, existing.getLen());
+    }
+
+    if (_use_oram)
+    {
+	// no A, sessions, T or repermutation then. A new all-zero array starts
+	// as an empty tree, otherwise the elements are kept for the build.
+	if (!size_params || !zero_fill) {
+	    _load.reset (new FlatIO (name + DIRSEP + "array", size_params));
+#ifndef NO_ENCRYPT
+	    add_encrypt_filter (*_load, _prov_fact);
+#endif
+	    if (!size_params) {
+		N	   = _load->getLen();
+		_elem_size = _load->getElemSize();
+	    }
+	}
+	_max_retrievals = 0;
+
+	LOG (Log::INFO, _logger,
+	     "Array " << _name << " of " << N << " elements of " << _elem_size
+	     << " bytes uses a Path ORAM");
+	return;
+    }
 
     _A = auto_ptr<ArrayA> (new ArrayA (name,
 				       size_params, &N, &_elem_size,
-				       _prov_fact));
+				       _prov_fact,
+				       zero_fill));
 
     // if the array exists, get its sizes, and fill in the size-dependent
     // params.
@@ -132,20 +176,102 @@ Array::Array (const string& name,
 	_elem_size = _A->_io.getElemSize();
     }
 
-    _max_retrievals = lrint (sqrt(float(N))) *  lgN_floor(N);
-    // this happens for very small N (<= 16)
-    if (_max_retrievals >= N) {
-	_max_retrievals = N-1;
-    }
-
     // init to identity permutation, and then do repermute()
     _p 		    = shared_ptr<TwoWayPermutation> (new IdPerm (N));
 
+    _max_retrievals = session_length (N, _elem_size);
+
+    LOG (Log::INFO, _logger,
+	 "Array " << _name << " of " << N << " elements of " << _elem_size
+	 << " bytes has sessions of " << _max_retrievals << " accesses");
+
+#if !defined(NO_REFETCHES) && !defined(NO_REPERMUTE)
+    // T carries up to a session's worth of written items into the next
+    // session, and dummies have to avoid those too.
+    if (g_cvm_options.background_repermute) {
+	_background = N > 3 * (_max_retrievals + 1);
+	if (_background) {
+	    _carry_len = _max_retrievals + 1;
+	}
+	else {
+	    LOG (Log::INFO, _logger,
+		 "Array " << _name << " is too short to repermute in the"
+		 " background");
+	}
+    }
+#endif
+
     _T = auto_ptr<ArrayT> (
 	new ArrayT (_name,
-		    _max_retrievals, _elem_size,
-		    &_num_retrievals,
+		    _carry_len + _max_retrievals + 1, _elem_size,
+		    &_T_len,
 		    _prov_fact));
+
+#ifndef NO_REFETCHES
+    make_dummy_schedule ();
+#endif
+}
+
+
+
+bool Array::use_path_oram (const string & name, size_t N)
+{
+    std::istringstream names (g_cvm_options.path_oram_arrays);
+    string n;
+    while (getline (names, n, ',')) {
+	if (n == name) {
+	    return true;
+	}
+    }
+
+    return g_cvm_options.path_oram_min > 0 && N >= g_cvm_options.path_oram_min;
+}
+
+
+size_t Array::session_length (size_t N, size_t elem_size)
+{
+    size_t len = lrint (sqrt(float(N))) *  lgN_floor(N);
+
+    // times in ns
+    const double
+	io    = g_cvm_options.oram_io_nsec,
+	crypt = g_cvm_options.oram_crypt_psec / 1000.0;
+
+    if (N > 1 && (io > 0 || crypt > 0))
+    {
+	const double
+	    idx_obj    = io + crypt * sizeof(index_t),
+	    elem_obj   = io + crypt * elem_size,
+	    tagged_obj = io + crypt * (elem_size + sizeof(index_t)),
+	    lg	       = lgN_ceil (N);
+
+	// every access reads each index and item in T, and writes them back
+	const double per_entry = 2 * idx_obj + 2 * elem_obj;
+
+	// Batcher's network has about N lg N (lg N + 1) / 4 comparators, each
+	// reading and writing two tagged elements. Then there are the passes
+	// to tag, untag and copy the elements.
+	const double shuffle = N * lg * (lg + 1) * tagged_obj + 4 * N * elem_obj;
+
+	// the time per access over a session of L is per_entry*L/2 +
+	// shuffle/L, least at:
+	const size_t model = max (lrint (sqrt (2 * shuffle / per_entry)), 1L);
+
+	LOG (Log::INFO, _logger,
+	     "Cost model for " << N << " elements of " << elem_size
+	     << " bytes: " << per_entry << " ns per working item per access, "
+	     << shuffle / 1e6 << " ms per repermutation; session length "
+	     << model << " instead of " << len);
+
+	len = model;
+    }
+
+    // this happens for very small N (<= 16)
+    if (len >= N) {
+	len = N-1;
+    }
+
+    return len;
 }
 
 
@@ -154,16 +280,38 @@ Array::Array (const string& name,
 void Array::write_clear (index_t idx, size_t off, const ByteBuffer& val)
     throw (host_exception, comm_exception)
 {
+    if (_use_oram && !_load) {
+	(void) oram().access (idx, Just (std::make_pair (off, val)));
+	return;
+    }
+
+    FlatIO & io = _use_oram ? *_load : _A->_io;
     ByteBuffer current;
 
-    _A->_io.read (idx, current);
+    io.read (idx, current);
     
     assert (val.len() <= current.len() - off);
     
     // splice in the new value
     memcpy (current.data() + off, val.data(), val.len());
 
-    _A->_io.write (idx, current);
+    io.write (idx, current);
+}
+
+
+void Array::write_clear (const vector<index_t> & idxs, const obj_list_t & vals)
+    throw (host_exception, comm_exception)
+{
+    assert (idxs.size() == vals.size());
+
+    if (_use_oram && !_load) {
+	for (index_t k = 0; k < idxs.size(); k++) {
+	    (void) oram().access (idxs[k], Just (std::make_pair (size_t (0), vals[k])));
+	}
+	return;
+    }
+    
+    (_use_oram ? *_load : _A->_io).write (idxs, vals);
 }
 
 
@@ -174,31 +322,43 @@ ByteBuffer Array::read (index_t idx)
 {
     // need to:
     // 
-    // - add either idx or (rand_idx <- a random untouched index) to the touched
-    //   list
-    // - read all elements in the touched list, while keeping A[idx]
+    // - fetch either idx or (rand_idx <- a random untouched index) from A
+    // - read all elements in the touched list, while keeping A[idx], and
+    //   append the fetched item to it
     // - return A[idx] to caller
 
 
     LOG (Log::DEBUG, _logger,
 	 "Array::read idx=" << idx);
 
-    index_t p_idx = _p->p(idx);
+    if (_use_oram) {
+	return oram().access (idx, boost::none);
+    }
 
     ByteBuffer buf;
     
 #ifdef NO_REFETCHES
 
     // read straight out of the array
-    _A->_io.read (p_idx, buf);
+    _A->_io.read (_p->p(idx), buf);
     _num_retrievals++;
 
 #else
-    
-    append_new_working_item (p_idx);
 
-    buf = _T->do_dummy_accesses (p_idx,
-				 boost::none);
+    if (_background) {
+	background_step (1);
+    }
+
+    index_t fetch_key;
+    const index_t fetch_idx = next_fetch_idx (idx, fetch_key);
+    ByteBuffer fetched;
+    _A->_io.read (fetch_idx, fetched);
+
+    buf = _T->do_dummy_accesses (idx,
+				 boost::none,
+				 fetch_key, fetched);
+    _num_retrievals++;
+    _T_len++;
 
 #endif
     
@@ -210,6 +370,58 @@ ByteBuffer Array::read (index_t idx)
 }
 
 
+void Array::read_batch (const vector<index_t> & idxs,
+			vector<ByteBuffer> & o_vals)
+    throw (better_exception)
+{
+    LOG (Log::DEBUG, _logger,
+	 "Array::read_batch of " << idxs.size() << " indices");
+
+    o_vals.clear();
+
+    if (_use_oram) {
+	// one path per read anyway
+	FOREACH (i, idxs) {
+	    o_vals.push_back (oram().access (*i, boost::none));
+	}
+	return;
+    }
+    
+    for (index_t b = 0; b < idxs.size(); )
+    {
+	// as many as can be appended to T before the session is over, as
+	// for a sequence of read() calls.
+	const size_t n = min (idxs.size() - b,
+			      _max_retrievals + 1 - _num_retrievals);
+	
+	if (_background) {
+	    background_step (n);
+	}
+
+	vector<index_t> targets (idxs.begin() + b, idxs.begin() + b + n),
+	    fetch_idxs (n), fetch_keys (n);
+	for (index_t k = 0; k < n; k++) {
+	    fetch_idxs[k] = next_fetch_idx (targets[k], fetch_keys[k]);
+	}
+
+	obj_list_t fetched;
+	_A->_io.read (fetch_idxs, fetched);
+
+	vector<ByteBuffer> vals;
+	_T->do_batch_reads (targets, fetch_keys, fetched, vals);
+	_num_retrievals += n;
+	_T_len += n;
+	
+	o_vals.insert (o_vals.end(), vals.begin(), vals.end());
+	b += n;
+	
+	if (_num_retrievals > _max_retrievals) {
+	    repermute ();
+	}
+    }
+}
+
+
 void Array::write (bool enable,
 		   index_t idx, size_t off,
 		   const ByteBuffer& val)
@@ -218,25 +430,44 @@ void Array::write (bool enable,
     
     LOG (Log::DEBUG, _logger,
 	 "Array::write idx=" << idx);
-    
-    index_t p_idx = _p->p(idx);
 
+    if (_use_oram) {
+	(void) oram().access (idx,
+			      enable ?
+			      Just    (std::make_pair (off, val)) :
+			      Nothing (std::make_pair (off, val)));
+	return;
+    }
+    
 #ifdef NO_REFETCHES
 
     // write straight into the array
-    _A->_io.write (p_idx, val);
+    _A->_io.write (_p->p(idx), val);
     _num_retrievals++;
 
 #else
-    
-    append_new_working_item (p_idx);
+
+    if (_background) {
+	background_step (1);
+	if (enable) {
+	    _written.insert (idx);
+	}
+    }
+
+    index_t fetch_key;
+    const index_t fetch_idx = next_fetch_idx (idx, fetch_key);
+    ByteBuffer fetched;
+    _A->_io.read (fetch_idx, fetched);
     
     // if we pass a 'none' optional here, the item will not be updated (but
     // re-encrypted as always)
-    (void) _T->do_dummy_accesses (p_idx,
+    (void) _T->do_dummy_accesses (idx,
 				  enable ?
 				  Just    (std::make_pair (off, val)) :
-				  Nothing (std::make_pair (off, val)));
+				  Nothing (std::make_pair (off, val)),
+				  fetch_key, fetched);
+    _num_retrievals++;
+    _T_len++;
 
 #endif
 
@@ -249,6 +480,16 @@ void Array::write (bool enable,
 
 void Array::repermute ()
 {
+    if (_use_oram) {
+	// nothing to do for a Path ORAM
+	return;
+    }
+
+    if (_background && _A->repermuting()) {
+	background_swap ();
+	return;
+    }
+    
     LOG (Log::PROGRESS, _logger,
 	 "Array::repermute() on array " << _name
 	 << ", " << N  << " elems");
@@ -256,19 +497,12 @@ void Array::repermute ()
 
 #ifndef NO_REFETCHES
     // copy values out of the working areas and into their main array
-    merge (*_T, *_A);
+    merge (*_T, *_A, *_p);
 #endif // NO_REFETCHES
 
     
 #ifndef NO_REPERMUTE
-    // the new permutation - a range-adapted LR perm.
-    shared_ptr<TwoWayPermutation> p2_
-	(new UnbalancedLRPermutation (lgN_ceil(N),
-				      lgN_ceil(N),
-				      _prov_fact));
-    p2_->randomize();
-
-    shared_ptr<TwoWayPermutation> p2 (new RangeAdapterPermutation (p2_, N));
+    shared_ptr<TwoWayPermutation> p2 = new_permutation ();
 
     _A->repermute (_p, p2);
 
@@ -277,38 +511,187 @@ void Array::repermute ()
 
     
     _num_retrievals = 0;
+    _T_len = 0;
+    _T->clear();
+
+#ifndef NO_REFETCHES
+    make_dummy_schedule ();
+#endif
 }
 
 
 
 
-/// add a new distinct element to T:  either idx or a random
-/// index (not already in T).
+/// choose a new distinct element for T:  either the element at idx or a
+/// random one (not already in T).
 ///
-/// working with physical indices here
-void Array::append_new_working_item (index_t idx)
+/// T holds logical indices, A physical ones
+index_t Array::next_fetch_idx (index_t idx, index_t & o_key)
     throw (better_exception)
 {
-    index_t rand_idx;
-    optional<index_t> to_append;
-    
-    // find an index to append to the working set.
-    while (!to_append)
-    {
-	rand_idx = _rand_prov->randint (N);
+    index_t to_fetch;
+
+    if (!_T->contains (idx)) {
+	to_fetch = _p->p (idx);
+	o_key = idx;
+    }
+    else {
+	// the next scheduled index whose element is not in T. Skipped ones
+	// were fetched as targets, or carried over in T from the last session,
+	// so the one chosen is uniform over the untouched indices, as with
+	// rejection sampling.
+	while (_next_dummy < _dummies.size() &&
+	       _T->contains (_p->d (_dummies[_next_dummy])))
+	{
+	    _next_dummy++;
+	}
+
+	if (_next_dummy < _dummies.size()) {
+	    to_fetch = _dummies[_next_dummy++];
+	}
+	else {
+	    // the schedule is used up, which needs many skips. Fall back to
+	    // sampling.
+	    do {
+		to_fetch = _rand_prov->randint (N);
+	    } while (_T->contains (_p->d (to_fetch)));
+	}
+	o_key = _p->d (to_fetch);
+
 	LOG (Log::DEBUG, _logger,
-	     "While accessing physical idx " << idx
-	     << ", trying rand_idx " << rand_idx);
-	to_append = _T->find_fetch_idx (rand_idx, idx);
+	     "While accessing idx " << idx
+	     << ", fetching dummy physical idx " << to_fetch);
     }
 
+    // it is in T from now on, for the next choice in a batch
+    _T->add_index (o_key);
 
-    ByteBuffer obj;
-    // append the corresponding item to T.
-    _A->_io.read (*to_append, obj);
-    _T->appendItem (*to_append, obj);
-	
-    _num_retrievals++;
+    return to_fetch;
+}
+
+
+/// draw distinct random indices for the dummy fetches of a session. Enough
+/// for a session where every access needs a dummy.
+void Array::make_dummy_schedule ()
+{
+    const size_t len = min (_max_retrievals + 1, N);
+
+    std::set<index_t> drawn;
+    _dummies.clear();
+    _dummies.reserve (len);
+    while (_dummies.size() < len) {
+	const index_t i = _rand_prov->randint (N);
+	if (drawn.insert (i).second) {
+	    _dummies.push_back (i);
+	}
+    }
+
+    _next_dummy = 0;
+}
+
+
+PathOram & Array::oram ()
+    throw (better_exception)
+{
+    if (!_oram.get()) {
+	_oram.reset (new PathOram (_name, N, _elem_size, _prov_fact));
+	if (_load) {
+	    // shuffle the elements in place, and build the tree from them in
+	    // their new order
+	    shared_ptr<TwoWayPermutation> p = new_permutation ();
+	    Shuffler shuffler (_load, p, N);
+	    shuffler.shuffle ();
+
+	    _oram->build (*_load, *p);
+	    _load.reset();
+	}
+	else {
+	    _oram->build ();
+	}
+    }
+
+    return *_oram;
+}
+
+
+shared_ptr<TwoWayPermutation> Array::new_permutation ()
+{
+    // a range-adapted LR perm.
+    shared_ptr<TwoWayPermutation> p2_
+	(new UnbalancedLRPermutation (lgN_ceil(N),
+				      lgN_ceil(N),
+				      _prov_fact));
+    p2_->randomize();
+
+    return shared_ptr<TwoWayPermutation> (new RangeAdapterPermutation (p2_, N));
+}
+
+
+/// The background repermutation works on a snapshot of the array, taken at
+/// the start of a session: A, with T's items put in while copying it into the
+/// shadow container. This goes on during the session, while A is only read
+/// from, and the items written in the session are carried over in T into the
+/// next one.
+void Array::background_step (size_t accesses)
+{
+    if (!_A->repermuting()) {
+	// the first session, whose T is empty
+	_next_p = new_permutation ();
+	_A->start_repermute (_p, _next_p, std::map<index_t, ByteBuffer>());
+    }
+
+    // spread the work evenly over the rest of the session
+    const size_t left = _max_retrievals + 1 - _num_retrievals;
+    const size_t work = _A->repermute_work_left();
+    
+    _A->step_repermute (left > accesses ?
+			work / left * accesses +
+			(work % left * accesses + left - 1) / left :
+			work);
+}
+
+
+void Array::background_swap ()
+{
+    LOG (Log::PROGRESS, _logger,
+	 "Array " << _name << " switching to its background repermutation");
+
+    // normally done already by the last access
+    _A->step_repermute (_A->repermute_work_left());
+
+    // the items written in this session, which are newer than the snapshot
+    vector<index_t> keys (_written.begin(), _written.end());
+    obj_list_t items;
+    _T->read_items (keys, items);
+
+    _A->finish_repermute ();
+    _p = _next_p;
+
+    // start the next T with them, padded to always the same size
+    _num_retrievals = 0;
+    _T_len = 0;
+    _T->clear();
+    _written.clear();
+
+    std::map<index_t, ByteBuffer> subs;
+    for (index_t k = 0; k < keys.size(); k++) {
+	_T->add_index (keys[k]);
+	subs[_p->p (keys[k])] = items[k];
+    }
+
+    assert (keys.size() <= _carry_len);
+    ByteBuffer zero (_elem_size);
+    zero.set (0);
+    keys.resize (_carry_len, N);
+    items.resize (_carry_len, zero);
+    _T->appendItems (keys, items);
+    _T_len = _carry_len;
+
+    make_dummy_schedule ();
+
+    // and start on the next one, from a snapshot with the carried items
+    _next_p = new_permutation ();
+    _A->start_repermute (_p, _next_p, subs);
 }
 
 
@@ -316,15 +699,18 @@ void Array::append_new_working_item (index_t idx)
 /// No access pattern difficulties, the adversary has already seen the indices
 /// copied to the T.
 void
-Array::merge (const ArrayT& T, ArrayA& A)
+Array::merge (const ArrayT& T, ArrayA& A, const TwoWayPermutation & p)
 {
-    for (unsigned i=0; i < *T._num_retrievals; i++)
+    for (unsigned i=0; i < *T._len; i++)
     {
 	ByteBuffer item, idxbuf;
 	T._idxs .read (i, idxbuf);
 	T._items.read (i, item);
 
-	A._io.write (bb2basic<index_t>(idxbuf), item);
+	const index_t idx = bb2basic<index_t>(idxbuf);
+	if (idx < *A.N) {
+	    A._io.write (p.p (idx), item);
+	}
     }
 }
 
@@ -340,16 +726,16 @@ Array::merge (const ArrayT& T, ArrayA& A)
 //
 
 Array::ArrayT::ArrayT (const std::string& name, /// the array name
-		       size_t max_retrievals,
+		       size_t capacity,
 		       size_t elem_size,
-		       const size_t * p_num_retrievals,
+		       const size_t * p_len,
 		       CryptoProviderFactory * prov_fact)
     : _name		(name),
       _idxs		(_name + DIRSEP + "touched-idxs",
-			 Just (std::make_pair (max_retrievals, sizeof(index_t)))),
+			 Just (std::make_pair (capacity, sizeof(index_t)))),
       _items		(_name + DIRSEP + "touched-items",
-			 Just (make_pair (max_retrievals, elem_size))),
-      _num_retrievals	(p_num_retrievals),
+			 Just (make_pair (capacity, elem_size))),
+      _len		(p_len),
       _prov_fact	(prov_fact)
 {
 #ifndef NO_ENCRYPT
@@ -369,67 +755,6 @@ Array::ArrayT::ArrayT (const std::string& name, /// the array name
 
 
 
-// result:
-// have_target = do we have target_index in the container?
-// have_rand   = do we have rand_idx in the container?
-struct rand_idx_and_have_idx
-{
-    rand_idx_and_have_idx (index_t target_index,
-			   index_t rand_idx_initval)
-	: target_index	(target_index),
-	  rand_idx	(rand_idx_initval),
-	  have_target	(false),
-	  have_rand	(false)
-	{}
-    
-    void operator() (index_t, const ByteBuffer& in, ByteBuffer&)
-	{
-	    index_t T_i = bb2basic<index_t> (in);
-
-	    if (T_i == target_index)
-	    {
-		have_target = true;
-	    }
-	    if (T_i == rand_idx)
-	    {
-		have_rand = true;
-	    }
-	}
-
-    const index_t target_index;
-    const index_t rand_idx;
-    bool have_target;
-    bool have_rand;		// is the proposed rand_idx in the working set
-				// already?
-};
-
-
-
-boost::optional<index_t>
-Array::ArrayT::
-find_fetch_idx (index_t rand_idx, index_t target_idx)
-{
-    rand_idx_and_have_idx prog (target_idx, rand_idx);
-    stream_process (prog,
-		    zero_to_n (*_num_retrievals),
-		    &_idxs,
-		    NULL);
-
-    if (!prog.have_target) {
-	return Just(target_idx);
-    }
-    else if (!prog.have_rand) {
-	return Just(rand_idx);
-    }
-    else {
-	// target_idx and rand_idx both in there, try again.
-	return none;
-    }
-}
-
-
-
-
 class Array::ArrayT::dummy_fetches_stream_prog
 {
 
@@ -515,7 +840,9 @@ private:
 ByteBuffer
 Array::ArrayT::
 do_dummy_accesses (index_t target_index,
-		   const optional<pair<size_t, ByteBuffer> >& new_val)
+		   const optional<pair<size_t, ByteBuffer> >& new_val,
+		   index_t fetch_key,
+		   const ByteBuffer & fetched)
 {
     // NOTE: these two lines produce a warning with g++ version 4.1 and later:
     // "warning: missing braces around initializer"
@@ -529,22 +856,172 @@ do_dummy_accesses (index_t target_index,
 				    _items.getElemSize());
 
     stream_process (prog,
-		    zero_to_n<2> (*_num_retrievals),
+		    zero_to_n<2> (*_len),
 		    in_ios,
 		    out_ios,
 		    boost::mpl::size_t<1> (), // number of items/idxs in an
 					      // invocation of prog
 		    boost::mpl::size_t<2> ()); // the number of I/O streams
 
-    return prog.getTheItem ();
+    // the fetched item goes on the end of T, and is not read back. If it is
+    // the target, it was not in T before, so it gets the new value here.
+    ByteBuffer item, toappend = fetched;
+    if (fetch_key == target_index) {
+	item = fetched;
+	if (new_val) {
+	    toappend = ByteBuffer (fetched, ByteBuffer::deepcopy());
+	    bbcopy (toappend, new_val->second, new_val->first);
+	}
+    }
+    else {
+	item = prog.getTheItem ();
+    }
+
+    appendItems (vector<index_t> (1, fetch_key),
+		 obj_list_t (1, toappend));
+
+    return item;
 }
 
+class Array::ArrayT::batch_fetches_stream_prog
+{
+    enum {
+	IDX=0,
+	ITEM=1
+    };
+	    
+public:
+
+    batch_fetches_stream_prog (const vector<index_t> & targets)
+	{
+	    FOREACH (t, targets) {
+		_items[*t] = ByteBuffer();
+	    }
+	}
+    
+    void operator() (const boost::array<index_t,2>& idxs,
+		     const boost::array<ByteBuffer,2>& objs,
+		     boost::array<ByteBuffer,2>& o_objs)
+	{
+	    index_t T_i = bb2basic<index_t> (objs[IDX]);
+
+	    // the indices are written back re-encrypted, as for a read by
+	    // dummy_fetches_stream_prog
+	    o_objs[IDX] = objs[IDX];
+
+	    found (T_i, objs[ITEM]);
+	}
+
+    /// note an item, which is kept if it is a target
+    void found (index_t idx, const ByteBuffer & item)
+	{
+	    std::map<index_t, ByteBuffer>::iterator it = _items.find (idx);
+	    if (it != _items.end()) {
+		it->second = ByteBuffer (item, ByteBuffer::deepcopy());
+	    }
+	}
+
+    ByteBuffer getItem (index_t target) const
+	{
+	    const ByteBuffer & item = _items.find (target)->second;
+	    
+	    assert (((void)"batch_fetches_stream_prog should have "
+		     "found all the target items",
+		     item.len() > 0));
+	    return item;
+	}
+    
+private:
+
+    std::map<index_t, ByteBuffer> _items;
+};
+
+
 void
 Array::ArrayT::
-appendItem (index_t idx, const ByteBuffer& item)
+do_batch_reads (const vector<index_t> & targets,
+		const vector<index_t> & fetch_keys,
+		const obj_list_t & fetched,
+		vector<ByteBuffer> & o_items)
 {
-    _idxs.write (*_num_retrievals, basic2bb (idx));
-    _items.write (*_num_retrievals, item);
+    boost::array<FlatIO*,2> in_ios =  { &_idxs, &_items };
+    boost::array<FlatIO*,2> out_ios = { &_idxs, NULL };
+
+    batch_fetches_stream_prog prog (targets);
+
+    stream_process (prog,
+		    zero_to_n<2> (*_len),
+		    in_ios,
+		    out_ios,
+		    boost::mpl::size_t<1> (),
+		    boost::mpl::size_t<2> ());
+
+    // the targets which were not in T are among the fetched items
+    for (index_t k = 0; k < fetch_keys.size(); k++) {
+	prog.found (fetch_keys[k], fetched[k]);
+    }
+    appendItems (fetch_keys, fetched);
+
+    o_items.clear();
+    FOREACH (t, targets) {
+	o_items.push_back (prog.getItem (*t));
+    }
+}
+
+
+void
+Array::ArrayT::
+read_items (const vector<index_t> & targets,
+	    obj_list_t & o_items)
+{
+    boost::array<FlatIO*,2> in_ios =  { &_idxs, &_items };
+    boost::array<FlatIO*,2> out_ios = { NULL, NULL };
+
+    batch_fetches_stream_prog prog (targets);
+
+    stream_process (prog,
+		    zero_to_n<2> (*_len),
+		    in_ios,
+		    out_ios,
+		    boost::mpl::size_t<1> (),
+		    boost::mpl::size_t<2> ());
+
+    o_items.clear();
+    FOREACH (t, targets) {
+	o_items.push_back (prog.getItem (*t));
+    }
+}
+
+
+void
+Array::ArrayT::
+appendItems (const vector<index_t> & idxs, const obj_list_t & items)
+{
+    vector<index_t> pos;
+    obj_list_t idxbufs;
+    for (index_t k = 0; k < idxs.size(); k++) {
+	pos.push_back (*_len + k);
+	idxbufs.push_back (basic2bb (idxs[k]));
+    }
+    
+    _idxs.write (pos, idxbufs);
+    _items.write (pos, items);
+}
+
+
+void
+Array::ArrayT::
+add_index (index_t idx)
+{
+    _contents.insert (idx);
+}
+
+
+void
+Array::ArrayT::
+clear ()
+{
+    _contents.clear();
 }
 
 
@@ -556,29 +1033,50 @@ appendItem (index_t idx, const ByteBuffer& item)
 //
 
 
+OPEN_ANON_NS
+// copy items, putting in substitutes for some of them
+struct substituter
+{
+    substituter (const std::map<index_t, ByteBuffer> & subs)
+	: subs (subs)
+	{}
+
+    void operator() (index_t i, const ByteBuffer& in, ByteBuffer& out) const
+	{
+	    std::map<index_t, ByteBuffer>::const_iterator s = subs.find (i);
+	    out = s != subs.end() ? s->second : in;
+	}
+
+    const std::map<index_t, ByteBuffer> & subs;
+};
+CLOSE_NS
+
+
 
 Array::ArrayA::ArrayA (const std::string& name, /// the array name
 		       const optional<pair<size_t, size_t> >& size_params,
 		       const size_t * N,
 		       const size_t * elem_size,
-		       CryptoProviderFactory *  prov_fact)
+		       CryptoProviderFactory *  prov_fact,
+		       bool zero_fill)
     : _name	    (name + DIRSEP + "array"),
       _io	    (_name, size_params),
       N		    (N),
       _elem_size    (elem_size),
-      _prov_fact    (prov_fact)
+      _prov_fact    (prov_fact),
+      _keys	    (new SymWrapper (prov_fact)),
+      _copied	    (0)
 {
 #ifndef NO_ENCRYPT
     // add encrypt/decrypt filter.
     _io.appendFilter (
 	auto_ptr<HostIOFilter>
-	(new IOFilterEncrypt (&_io,
-			      shared_ptr<SymWrapper>
-			      (new SymWrapper (_prov_fact)))));
+	(new IOFilterEncrypt (&_io, _keys)));
 #endif
 
-    // if array is new, fill out with nulls.
-    if (size_params)
+    // if array is new, fill out with nulls, unless the caller is going to
+    // write all of it.
+    if (size_params && zero_fill)
     {
 	ByteBuffer zero (size_params->second); // the element size
 	zero.set (0);
@@ -602,19 +1100,29 @@ Array::ArrayA::repermute (const shared_ptr<TwoWayPermutation>& old_p,
 	new FlatIO (_io.getName() + "-p2",
 		    std::make_pair (_io.getLen(),
 				    _io.getElemSize())));
+    shared_ptr<SymWrapper> p2_keys (new SymWrapper (_prov_fact));
 #ifndef NO_ENCRYPT
     p2_cont_io->appendFilter (
 	auto_ptr<HostIOFilter> (
-	    new IOFilterEncrypt (
-		p2_cont_io.get(),
-		shared_ptr<SymWrapper> (new SymWrapper (_prov_fact)))));
+	    new IOFilterEncrypt (p2_cont_io.get(), p2_keys)));
+
+    // copy values across, re-encrypting under the new keys with a pipeline of
+    // worker threads if we can.
+    const unsigned workers = crypt_pipeline_workers ();
+    if (workers > 1) {
+	FlatIO from_raw (_io.getName(), boost::none),
+	    to_raw	(p2_cont_io->getName(), boost::none);
+	crypt_pipeline_copy (from_raw, _keys.get(), to_raw, *p2_keys,
+			     *N, _prov_fact, workers);
+    }
+    else
 #endif
-
-    // copy values across
-    stream_process ( identity_itemproc<>(),
-		     zero_to_n (*N),
-		     &_io,
-		     &(*p2_cont_io) );
+    {
+	stream_process ( identity_itemproc<>(),
+			 zero_to_n (*N),
+			 &_io,
+			 &(*p2_cont_io) );
+    }
     
     // run the re-permutation on the new container
     shared_ptr<ForwardPermutation> reperm (new RePermutation (*old_p, *new_p));
@@ -626,9 +1134,84 @@ Array::ArrayA::repermute (const shared_ptr<TwoWayPermutation>& old_p,
     // NOTE: this invokes FlatIO::operator= which also moves stuff around on the
     // host.
     _io = *p2_cont_io;
+    _keys = p2_keys;
 }    
 
 
+void
+Array::ArrayA::start_repermute (const shared_ptr<TwoWayPermutation>& old_p,
+				const shared_ptr<TwoWayPermutation>& new_p,
+				const std::map<index_t, ByteBuffer> & subs)
+{
+    assert (!repermuting());
+
+    _shadow.reset (new FlatIO (_io.getName() + "-p2",
+			       std::make_pair (_io.getLen(),
+					       _io.getElemSize())));
+    _shadow_keys.reset (new SymWrapper (_prov_fact));
+#ifndef NO_ENCRYPT
+    _shadow->appendFilter (
+	auto_ptr<HostIOFilter> (
+	    new IOFilterEncrypt (_shadow.get(), _shadow_keys)));
+#endif
+
+    shared_ptr<ForwardPermutation> reperm (new RePermutation (*old_p, *new_p));
+    _shuffler.reset (new Shuffler (_shadow, reperm, *N));
+    _shuffler->begin ();
+
+    _subs = subs;
+    _copied = 0;
+}
+
+
+void
+Array::ArrayA::step_repermute (size_t work)
+{
+    assert (repermuting());
+
+    // first the copy into the shadow container, then the shuffle of it
+    const size_t copy = std::min (work, *N - _copied);
+    if (copy > 0) {
+	stream_process (substituter (_subs),
+			make_pair_range (pir::make_counting_range (_copied,
+								   _copied + copy)),
+			&_io,
+			&(*_shadow));
+	_copied += copy;
+	if (_copied == *N) {
+	    _subs.clear();
+	}
+    }
+
+    if (work > copy) {
+	_shuffler->step (work - copy);
+    }
+}
+
+
+size_t
+Array::ArrayA::repermute_work_left () const
+{
+    return repermuting() ? (*N - _copied) + _shuffler->work_left() : 0;
+}
+
+
+void
+Array::ArrayA::finish_repermute ()
+{
+    assert (repermute_work_left() == 0);
+
+    _shuffler.reset();
+
+    // as in repermute(), this moves the shadow container into place
+    _io = *_shadow;
+    _keys = _shadow_keys;
+
+    _shadow.reset();
+    _shadow_keys.reset();
+}
+
+
 
 
 
@@ -776,6 +1359,45 @@ ArrayHandle::read (bool enable,
 
 
 
+ArrayHandle &
+ArrayHandle::read_batch (const vector<bool> & enables,
+			 const vector< optional<index_t> > & idxs,
+			 vector<ByteBuffer> & outs)
+    throw (better_exception)
+{
+    assert (enables.size() == idxs.size());
+    
+    LOG (Log::DEBUG, Array::_logger,
+	 "Batch of " << idxs.size() << " reads on array descriptor " << _desc);
+
+    // the disabled and invalid reads read index 0, as in read()
+    vector<index_t> to_read (idxs.size());
+    vector<bool> real (idxs.size());
+    for (index_t k = 0; k < idxs.size(); k++) {
+	real[k] = enables[k] && idxs[k] && *idxs[k] >= 0 &&
+	    *idxs[k] < length();
+	to_read[k] = real[k] ? *idxs[k] : 0;
+    }
+
+    vector<ByteBuffer> vals;
+    _arr->read_batch (to_read, vals);
+
+    outs.resize (idxs.size());
+    for (index_t k = 0; k < idxs.size(); k++) {
+	if (real[k]) {
+	    outs[k] = vals[k];
+	}
+	else {
+	    outs[k] = ByteBuffer (_arr->elem_size());
+	    makeOptBBNothing (outs[k]);
+	}
+    }
+
+    return *this;
+}
+
+
+
 #ifdef LOGVALS
 
 // print an ArrayHandle's contents, in order from index 0 to N-1
@@ -797,6 +1419,16 @@ std::ostream& operator<< (std::ostream& os, ArrayHandle& arr)
 std::ostream&
 Array::print (std::ostream& os, Array& arr)
 {
+    if (arr._use_oram) {
+	for (unsigned i=0; i < arr.length(); i++) {
+	    os << "{" << arr.oram().access (i, boost::none) << "}";
+	    if (i+1 < arr.length()) {
+		os << ",";
+	    }
+	}
+	return os;
+    }
+
     // build a vector to indicate which elements are in T, and where in T they
     // are.
     // elem_in_T[i] =	-1	if actual element i is not in T,
@@ -807,18 +1439,18 @@ Array::print (std::ostream& os, Array& arr)
     ArrayA& A = * arr._A;
     
     // go though T and build the lookup table elem_in_T.
-    // _num_retrievals shows the number of active elements in T.
-    for (unsigned i=0; i < *T._num_retrievals; i++)
+    // _T_len shows the number of active elements in T.
+    for (unsigned i=0; i < *T._len; i++)
     {
 	index_t idx;
 	ByteBuffer buf;
 	
 	T._idxs.read (i, buf);
 	idx = bb2basic<index_t> (buf);
-	assert (idx < elem_in_T.size());
-	// elem_in_T should be indexed by actual index, while the value in
-	// T._idxs is a permuted index, so apply the reverse permutation.
-	elem_in_T[ arr._p->d(idx) ] = i;
+	// T._idxs has actual indices, and padding items past the end
+	if (idx < elem_in_T.size()) {
+	    elem_in_T[idx] = i;
+	}
     }
 
     // read all the items and print each.
@@ -17,6 +17,8 @@
 #include <list>
 #include <memory>		// auto_ptr
 #include <map>
+#include <set>
+#include <vector>
 #include <utility>		// pair
 
 #include <boost/shared_ptr.hpp>
@@ -26,6 +28,9 @@
 #include <pir/card/permutation.h>
 #include <pir/card/io.h>
 #include <pir/card/io_flat.h>
+#include <pir/common/sym_crypto.h>
+
+#include "path-oram.h"
 
 #ifndef _CARD_ARRAY_H
 #define _CARD_ARRAY_H
@@ -35,6 +40,9 @@
 OPEN_NS
 
 
+class Shuffler;
+
+
 class Array : boost::noncopyable {
 
 public:
@@ -44,9 +52,12 @@ public:
     /// repermute() when needed.
     /// @param size_params the length and element size of the new array. none if
     /// the array should be on disk already.
+    /// @param zero_fill fill a new array with nulls. If false, the caller has
+    /// to write every element with write_clear() before using the array.
     Array (const std::string& name,
            const boost::optional <std::pair<size_t, size_t> >& size_params,
-           CryptoProviderFactory * crypt_fact);
+           CryptoProviderFactory * crypt_fact,
+	   bool zero_fill = true);
 
     Array ()
 	{};
@@ -68,11 +79,23 @@ public:
     ByteBuffer read (index_t i)
 	throw (better_exception);
 
+    /// Read several indices, with one scan of the working area for as many of
+    /// them as fit in the current retrieval session.
+    /// @param o_vals the values, in the order of 'idxs'
+    void read_batch (const std::vector<index_t> & idxs,
+		     std::vector<ByteBuffer> & o_vals)
+	throw (better_exception);
+
     
     /// Write a value non-hidden, probably during initialization
     void write_clear (index_t i, size_t off, const ByteBuffer& val)
  	throw (host_exception, comm_exception);
 
+    /// Write whole elements non-hidden, with one list write and no reads.
+    void write_clear (const std::vector<index_t> & idxs,
+		      const obj_list_t & vals)
+ 	throw (host_exception, comm_exception);
+
     /// Read a value without index protection and with minimal effort.
     ByteBuffer read_clear (index_t i)
 	throw (better_exception);
@@ -100,6 +123,13 @@ public:
     // almost like an operator<<
     static std::ostream& print (std::ostream& os,
 				Array & arr);
+
+    /// The number of accesses in a session, between repermutations, for an
+    /// array of N elements. Each access scans the session's working area,
+    /// and the repermutation is amortized over the session. With the host
+    /// costs in g_cvm_options set, this minimizes the modelled time per
+    /// access; otherwise it is sqrt(N)*lg N.
+    static size_t session_length (size_t N, size_t elem_size);
     
 
     
@@ -113,12 +143,38 @@ private:
 		const boost::optional<std::pair<size_t, size_t> >& size_params,
 		const index_t* N,
 		const index_t* elem_size,
-		CryptoProviderFactory *  prov_fact);
+		CryptoProviderFactory *  prov_fact,
+		bool zero_fill);
 
 	void
 	repermute (const boost::shared_ptr<TwoWayPermutation>& old_p,
 		   const boost::shared_ptr<TwoWayPermutation>& new_p);
 
+	/// Start re-permuting into a shadow container, in parts done by
+	/// step_repermute(), while this container stays in use.
+	/// @param subs items to copy into the shadow in place of the current
+	///	ones, by physical index under old_p
+	void
+	start_repermute (const boost::shared_ptr<TwoWayPermutation>& old_p,
+			 const boost::shared_ptr<TwoWayPermutation>& new_p,
+			 const std::map<index_t, ByteBuffer> & subs);
+
+	/// Do up to 'work' more units of the re-permutation, a unit being the
+	/// reading and writing of one element.
+	void step_repermute (size_t work);
+
+	/// the units of work left in the re-permutation
+	size_t repermute_work_left () const;
+
+	/// Install the shadow container in place of this one.
+	/// PRE: repermute_work_left() is 0
+	void finish_repermute ();
+
+	bool repermuting () const
+	    {
+		return _shadow.get() != NULL;
+	    }
+
 	friend class Array;
 	
     private:
@@ -135,6 +191,19 @@ private:
 
 	CryptoProviderFactory * _prov_fact;
 
+	// the SymWrapper of the encrypt filter on _io, which has the container
+	// keys.
+	boost::shared_ptr<SymWrapper> _keys;
+
+	// a re-permutation started by start_repermute(): the shadow container
+	// and its keys, the items to substitute while copying into it, how
+	// many elements were copied, and the shuffle after the copy.
+	boost::shared_ptr<FlatIO> _shadow;
+	boost::shared_ptr<SymWrapper> _shadow_keys;
+	std::map<index_t, ByteBuffer> _subs;
+	index_t _copied;
+	boost::shared_ptr<Shuffler> _shuffler;
+
     };
 
 
@@ -143,28 +212,57 @@ private:
     {
     public:
 	ArrayT (const std::string& name, /// the array name
-		size_t max_retrievals,
+		size_t capacity,
 		size_t elem_size,
-		const size_t * p_num_retrievals,
+		const size_t * p_len,
 		CryptoProviderFactory * prov_fact);
 
-	/// @return the index to fetch into T. none if rand_idx is already in
-	/// this T.
-	boost::optional<index_t>
-	find_fetch_idx (index_t rand_idx, index_t target_idx);
+	/// is this logical index in T?
+	bool contains (index_t idx) const
+	    { return _contents.find (idx) != _contents.end(); }
 
-	/// Read (and maybe write) all the elements in this T, returning the
-	/// current value of target_index
-	/// PRE: the target_index must be in this T
+	/// Read (and maybe write) all the elements in this T, and append the
+	/// item just fetched from A, all in one pass. Returns the current value
+	/// of target_index.
+	/// PRE: the target_index must be in this T, or be fetch_key, the
+	/// logical index of the fetched item
 	ByteBuffer do_dummy_accesses (
 	    index_t target_index,
-	    const boost::optional <std::pair<size_t, ByteBuffer> > & new_val);
+	    const boost::optional <std::pair<size_t, ByteBuffer> > & new_val,
+	    index_t fetch_key,
+	    const ByteBuffer & fetched);
+
+	/// Read all the elements in this T, and append the items just fetched
+	/// from A, returning the current values of several target indices.
+	/// PRE: the targets must all be in this T or among fetch_keys
+	void do_batch_reads (const std::vector<index_t> & targets,
+			     const std::vector<index_t> & fetch_keys,
+			     const obj_list_t & fetched,
+			     std::vector<ByteBuffer> & o_items);
+
+	/// Read all the elements in this T, and return the current values of
+	/// several target indices, without writing anything.
+	/// PRE: the targets must all be in this T
+	void read_items (const std::vector<index_t> & targets,
+			 obj_list_t & o_items);
+
+	/// write items (and their indices) after the current end of T
+	void appendItems (const std::vector<index_t> & idxs,
+			  const obj_list_t & items);
+
+	/// count an index as in T from now on. Its item is appended by the
+	/// next access.
+	void add_index (index_t idx);
 
-	void appendItem (index_t idx, const ByteBuffer& item);
+	/// forget the contents, at the start of a new session.
+	void clear ();
 
 
 	class dummy_fetches_stream_prog;
 	friend class dummy_fetches_stream_prog;
+
+	class batch_fetches_stream_prog;
+	friend class batch_fetches_stream_prog;
 	
 	friend class Array;
 	
@@ -174,14 +272,19 @@ private:
 	std::string _name;
 
 	mutable FlatIO
-	_idxs,			// this is the physical (ie. permuted) index
-				// of the item
+	_idxs,			// this is the logical (ie. unpermuted) index
+				// of the item, N for a padding item.
 	    _items;		// the actual item.
 
-	/// how many retrievals already done this session?
-	/// make this point into the owner Array's _num_retrievals, who will
-	/// then be responsible for updating it.
-	const size_t * _num_retrievals;
+	/// how many items in T?
+	/// make this point into the owner Array's _T_len, who will then be
+	/// responsible for updating it.
+	const size_t * _len;
+
+	/// the logical indices in _idxs, and any being fetched into it, kept
+	/// in card memory so that choosing a fetch index does not need to read
+	/// them back from the host.
+	std::set<index_t> _contents;
 
 	CryptoProviderFactory * _prov_fact;
 
@@ -189,15 +292,40 @@ private:
 
     
 
-    /// merge a T into an A
+    /// merge a T into an A, under permutation p
     static void
-    merge (const ArrayT& t, ArrayA& a);
+    merge (const ArrayT& t, ArrayA& a, const TwoWayPermutation & p);
 	
 
-    /// append a new distinct object (and its index) to T.
-    void append_new_working_item (index_t idx)
+    /// choose a new distinct physical index to fetch from A into T, while
+    /// accessing (logical) index idx.
+    /// @param o_key the logical index of the element fetched
+    index_t next_fetch_idx (index_t idx, index_t & o_key)
+	throw (better_exception);
+
+    /// draw the dummy indices for a new session
+    void make_dummy_schedule ();
+
+    /// the Path ORAM, built on the first hidden access, from the elements
+    /// written in the clear if any
+    PathOram & oram ()
 	throw (better_exception);
 
+    /// Should this array use a Path ORAM (see cvm_options_t::path_oram_arrays
+    /// and path_oram_min)?
+    static bool use_path_oram (const std::string & name, size_t N);
+
+    /// a new random permutation
+    boost::shared_ptr<TwoWayPermutation> new_permutation ();
+
+    /// do this many accesses' worth of the background repermutation,
+    /// starting it if needed.
+    void background_step (size_t accesses);
+
+    /// end a session with the background repermutation: install the
+    /// re-permuted array, and start the next one.
+    void background_swap ();
+
     
 
     //
@@ -228,6 +356,41 @@ private:
     
     size_t _max_retrievals, _num_retrievals;
 
+    /// the number of items in T. The same as _num_retrievals, except with
+    /// the background repermutation, where T also has the items carried over
+    /// from the previous session.
+    size_t _T_len;
+
+    /// Repermute in the background, spread over the accesses of a session,
+    /// instead of all at once at the end of the session.
+    bool _background;
+
+    /// the number of items carried over in T to the next session, with the
+    /// background repermutation
+    size_t _carry_len;
+
+    /// the permutation the background repermutation is going to
+    boost::shared_ptr<TwoWayPermutation> _next_p;
+
+    /// the logical indices written this session, with the background
+    /// repermutation
+    std::set<index_t> _written;
+
+    /// distinct random physical indices, drawn at the start of the session,
+    /// which are fetched in order when the target is already in T.
+    std::vector<index_t> _dummies;
+    size_t _next_dummy;
+
+    /// Use a Path ORAM instead of the square-root scheme. There is no A or T
+    /// then.
+    bool _use_oram;
+    std::auto_ptr<PathOram> _oram;
+
+    /// For a Path ORAM array which is not all zeroes, the elements as written
+    /// by write_clear(), in order, until the tree is built from them. It is
+    /// the container that A would be, so prep and cvm agree on it.
+    boost::shared_ptr<FlatIO> _load;
+
 
 public:
     static Log::logger_t _logger;
@@ -314,6 +477,15 @@ public:
     ArrayHandle &
     read (bool enable, boost::optional<index_t> i, ByteBuffer & out)
 	throw (better_exception);
+
+    /// Do several reads as one batch, with the same handling of disabled and
+    /// invalid reads as read().
+    /// @param outs the values read, in order
+    ArrayHandle &
+    read_batch (const std::vector<bool> & enables,
+		const std::vector< boost::optional<index_t> > & idxs,
+		std::vector<ByteBuffer> & outs)
+	throw (better_exception);
     
     /// Write a value non-hidden, probably during initialization.
     void write_clear (index_t i, const ByteBuffer& val)
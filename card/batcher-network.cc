@@ -21,3 +21,115 @@
 Log::logger_t BatcherNetwork::logger; // declared extern in batcher-network.h
 
 INSTANTIATE_STATIC_INIT (BatcherNetwork);
+
+
+
+BatcherCursor::BatcherCursor (size_t N)
+    : N	       (N),
+      _n       (lgN_ceil (N)),
+      _m       (0),
+      _M       (1),
+      _h       (0),
+      _g       (0),
+      _c       (0),
+      _c_end   (0),
+      _newpass (false),
+      _done    (false)
+{
+    _done = !next_pass ();
+    // no flush needed before the first pass
+    _newpass = false;
+}
+
+
+bool BatcherCursor::next (index_t & o_a, index_t & o_b, bool & o_newpass)
+{
+    if (_done) {
+	return false;
+    }
+
+    if (_h == 0) {
+	// inverted half-cleaner
+	o_a = _g + _c;
+	o_b = _g + (_M-1) - _c;
+    }
+    else {
+	o_a = _g + _c;
+	o_b = _g + _c + _h/2;
+    }
+    o_newpass = _newpass;
+    _newpass = false;
+
+    // advance, as in the loops of run_batcher()
+    if (++_c == _c_end) {
+	const unsigned span = _h == 0 ? _M : _h;
+	_g += span;
+	if (_g < N - span/2) {
+	    start_group ();
+	}
+	else {
+	    _done = !next_pass ();
+	}
+    }
+
+    return true;
+}
+
+
+size_t BatcherCursor::size (size_t N)
+{
+    BatcherCursor cur (N);
+    size_t total = 0;
+
+    // count a group at a time, by skipping to its last comparator
+    index_t a, b;
+    bool newpass;
+    while (!cur._done) {
+	total += cur._c_end - cur._c;
+	cur._c = cur._c_end - 1;
+	cur.next (a, b, newpass);
+    }
+
+    return total;
+}
+
+
+bool BatcherCursor::next_pass ()
+{
+    if (_h == 0 && _m > 0) {
+	// from the half-cleaners to the bitonic sorter passes
+	_h = _M/2;
+    }
+    else if (_h > 0) {
+	_h /= 2;
+    }
+
+    if (_h < 2) {
+	// on to the next merger
+	if (++_m > _n) {
+	    return false;
+	}
+	_M = 1U << _m;
+	_h = 0;
+    }
+
+    _g = 0;
+    _newpass = true;
+    start_group ();
+
+    return true;
+}
+
+
+void BatcherCursor::start_group ()
+{
+    if (_h == 0) {
+	// skip the comparators whose bottom wire is past N-1
+	_c = std::max (0, int(_g + (_M-1)) - (int(N)-1));
+	_c_end = _M/2;
+    }
+    else {
+	_c = 0;
+	_c_end = std::min (_h/2, unsigned (N - _h/2 - _g));
+    }
+}
@@ -173,4 +173,43 @@ void run_batcher
 }
 
 
+
+/// The comparators of the network run by run_batcher(), one at a time and in
+/// the same order, so that the network can be run in parts between other work.
+class BatcherCursor
+{
+public:
+
+    BatcherCursor (size_t N);
+
+    /// get the next comparator.
+    /// @param o_newpass set if a new pass starts at this comparator, where
+    ///	run_batcher() calls BatcherInfoListener::newpass()
+    /// @return false if the network is done
+    bool next (index_t & o_a, index_t & o_b, bool & o_newpass);
+
+    /// the number of comparators in the network for N elements
+    static size_t size (size_t N);
+
+private:
+
+    /// go to the first group of the next pass, false if there is none
+    bool next_pass ();
+
+    /// set the comparator range of the group starting at _g
+    void start_group ();
+
+    size_t N;
+    unsigned _n;
+
+    unsigned _m, _M;		// the merger number, and 2^_m
+    unsigned _h;		// the group size in a bitonic sorter pass, 0
+				// for the half-cleaners
+    unsigned _g;		// the first wire of the group
+    unsigned _c, _c_end;	// the comparator range in the group
+
+    bool _newpass, _done;
+};
+
+
 #endif // _BATCHER_PERMUTE_H
@@ -72,7 +72,10 @@ Shuffler::Shuffler (shared_ptr<FlatIO> container,
     : _io   (container),
       _p    (p),
       N	    (N),
-      _read_cache_size (CACHEMEM / _io->getElemSize())
+      _read_cache_size (CACHEMEM / _io->getElemSize()),
+      _phase	(DONE),
+      _pos	(0),
+      _work_left (0)
 {}
 
 
@@ -160,6 +163,91 @@ void Shuffler::remove_tags () throw (hostio_exception, crypto_exception)
 
 
 
+void Shuffler::begin ()
+    throw (better_exception)
+{
+    _phase = TAGGING;
+    _pos = 0;
+
+    _cursor.reset (new BatcherCursor (N));
+    _comparator.reset (new Comparator (*this,
+				       std::min (_read_cache_size/2, N-1)));
+
+    // a comparator reads and writes two records
+    _work_left = 2*N + 2 * BatcherCursor::size (N);
+
+    LOG (Log::PROGRESS, logger,
+	 "Start stepped DB shuffle of " << _work_left << " units @ "
+	 << epoch_secs());
+}
+
+
+bool Shuffler::step (size_t work)
+    throw (better_exception)
+{
+    while (work > 0 && _phase != DONE)
+    {
+	if (_phase == TAGGING || _phase == UNTAGGING)
+	{
+	    const index_t end = _pos + std::min (work, N - _pos);
+	    if (_phase == TAGGING) {
+		stream_process (tagger(*_p),
+				make_pair_range (
+				    pir::make_counting_range (_pos, end)),
+				_io.get(),
+				_io.get());
+	    }
+	    else {
+		stream_process (tag_remover(),
+				make_pair_range (
+				    pir::make_counting_range (_pos, end)),
+				_io.get(),
+				_io.get());
+	    }
+
+	    work       -= end - _pos;
+	    _work_left -= end - _pos;
+	    _pos	= end;
+
+	    if (_pos == N) {
+		_pos = 0;
+		_phase = _phase == TAGGING ? SORTING : DONE;
+	    }
+	}
+	else
+	{
+	    index_t a, b;
+	    bool newpass;
+	    if (!_cursor->next (a, b, newpass)) {
+		// flush the last batch
+		_comparator->newpass ();
+		_comparator.reset ();
+		_cursor.reset ();
+		_phase = UNTAGGING;
+		continue;
+	    }
+
+	    if (newpass) {
+		_comparator->newpass ();
+	    }
+	    (*_comparator) (a, b);
+
+	    work       -= std::min (work, size_t(2));
+	    _work_left -= std::min (_work_left, size_t(2));
+	}
+    }
+
+    if (_phase == DONE) {
+	LOG (Log::PROGRESS, logger,
+	     "Stepped shuffle done @ " << epoch_secs());
+	_work_left = 0;
+    }
+
+    return _phase == DONE;
+}
+
+
+
 void Shuffler::Comparator::operator () (index_t a, index_t b)
     throw (better_exception)
 {
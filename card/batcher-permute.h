@@ -23,6 +23,7 @@
 #include "batcher-network.h"
 
 #include <vector>
+#include <memory>
 
 #include <stdlib.h>
 
@@ -60,6 +61,24 @@ public:
 	throw (hostio_exception, crypto_exception, runtime_exception);
 
 
+    /// Start running the shuffle in parts, between other work, with step().
+    /// It gives the same result as shuffle().
+    void begin ()
+	throw (better_exception);
+
+    /// Do up to 'work' more units of the shuffle, a unit being the reading
+    /// and writing of one record.
+    /// @return true when the shuffle is done
+    bool step (size_t work)
+	throw (better_exception);
+
+    /// the units of work left in a shuffle started with begin()
+    size_t work_left () const
+	{
+	    return _work_left;
+	}
+
+
 private:
 
 //    SymWrapper _sym_wrapper;
@@ -136,6 +155,23 @@ private:
     friend class Comparator;
 
 
+    // the state of a shuffle run with step()
+    enum phase_t {
+	TAGGING,
+	SORTING,
+	UNTAGGING,
+	DONE
+    };
+
+    phase_t _phase;
+    index_t _pos;		// the next record to tag or untag
+
+    std::auto_ptr<BatcherCursor> _cursor;
+    std::auto_ptr<Comparator> _comparator;
+
+    size_t _work_left;
+
+
     struct tag_remover;
     friend struct tag_remover;	// to read TAGSIZE
 
@@ -0,0 +1,361 @@
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+*/
+
+
+#include <vector>
+#include <map>
+
+#include <boost/optional/optional.hpp>
+
+#include <faerieplay/common/utils.h>
+#include <faerieplay/common/logging.h>
+
+#include <common/gate.h>
+
+#include "bitslice.h"
+
+
+using std::vector;
+
+using boost::optional;
+
+
+namespace
+{
+    Log::logger_t logger = Log::makeLogger ("circuit-vm.card.bitslice");
+}
+
+
+
+size_t find_bool_gates (const vector<gate_t> & gates,
+			unsigned max_gate,
+			vector<int> & o_table,
+			const vector<value_range_t> * ranges)
+{
+    o_table.assign (max_gate+1, BOOL_NONE);
+
+    vector<bool> is_bool (max_gate+1, false);
+    size_t num_bool = 0, num_sliceable = 0;
+    
+    FOREACH (g, gates)
+    {
+	bool inputs_bool = !g->inputs.empty();
+	FOREACH (in, g->inputs) {
+	    if (*in < 0 || unsigned(*in) > max_gate || !is_bool[*in]) {
+		inputs_bool = false;
+	    }
+	}
+
+	// is the value in {0, 1, nil}? and can the operation be done
+	// bitwise on such inputs?
+	bool val_bool = false, sliceable = false;
+	
+	switch (g->op.kind)
+	{
+	case gate_t::Lit:
+	    val_bool = g->op.params[0] == 0 || g->op.params[0] == 1;
+	    break;
+
+	case gate_t::UnOp:
+	    // LNot always gives 0 or 1, the others can give anything.
+	    if (g->op.params[0] == gate_t::LNot) {
+		val_bool  = true;
+		sliceable = inputs_bool;
+	    }
+	    break;
+
+	case gate_t::BinOp:
+	    switch (g->op.params[0])
+	    {
+	    case gate_t::Eq:   case gate_t::NEq:
+	    case gate_t::LT:   case gate_t::GT:
+	    case gate_t::LTEq: case gate_t::GTEq:
+	    case gate_t::And:  case gate_t::Or:
+		val_bool  = true;
+		sliceable = inputs_bool;
+		break;
+		
+	    case gate_t::BAnd: case gate_t::BOr: case gate_t::BXor:
+		val_bool = sliceable = inputs_bool;
+		break;
+
+	    default:
+		break;
+	    }
+	    break;
+
+	case gate_t::Select:
+	    // the result is one of the two value inputs
+	    val_bool = g->inputs.size() == 3 &&
+		is_bool[g->inputs[1]] && is_bool[g->inputs[2]];
+	    sliceable = val_bool && inputs_bool;
+	    break;
+
+	case gate_t::Mux:
+	    // likewise, but done by CircuitEval::do_gate
+	    val_bool = true;
+	    for (unsigned i = g->op.params[0]; i < g->inputs.size(); i++) {
+		val_bool = val_bool && is_bool[g->inputs[i]];
+	    }
+	    break;
+
+	default:
+	    break;
+	}
+
+	// eg. a mask with 1, or a select between such values
+	if (ranges && value_width ((*ranges)[g->num]) == 1) {
+	    val_bool = true;
+	}
+
+	if (g->typ.kind != gate_t::Scalar || !val_bool) {
+	    continue;
+	}
+	
+	// outputs are printed by CircuitEval::do_gate
+	if (elem (gate_t::Output, g->flags)) {
+	    sliceable = false;
+	}
+
+	is_bool[g->num] = true;
+	o_table[g->num] = (num_bool++ << 1) | (sliceable ? 1 : 0);
+	if (sliceable) {
+	    num_sliceable++;
+	}
+    }
+
+    LOG (Log::INFO, logger,
+	 num_bool << " of " << gates.size() << " gates are boolean, "
+	 << num_sliceable << " of them sliceable");
+    
+    return num_bool;
+}
+
+
+
+
+OPEN_NS
+
+
+BitSlicer::BitSlicer (const vector<int> & table)
+    : _table (table)
+{
+    size_t num_bool = 0;
+    FOREACH (t, _table) {
+	if (*t != BOOL_NONE) {
+	    num_bool++;
+	}
+    }
+
+    _vals .assign ((num_bool + WORD - 1) / WORD, 0);
+    _justs.assign ((num_bool + WORD - 1) / WORD, 0);
+}
+
+
+optional<int> BitSlicer::get (index_t gate) const
+{
+    assert (is_bool (gate) && _pending.find (gate) == _pending.end());
+
+    const unsigned slot = _table[gate] >> 1;
+    const uint64_t bit = uint64_t(1) << (slot % WORD);
+
+    if (!(_justs[slot / WORD] & bit)) {
+	return optional<int> ();
+    }
+    
+    return (_vals[slot / WORD] & bit) ? 1 : 0;
+}
+
+
+void BitSlicer::put (index_t gate, optional<int> val)
+{
+    assert (is_bool (gate));
+    assert (((void)"BitSlicer::put() got a non-boolean value",
+	     !val || *val == 0 || *val == 1));
+
+    const unsigned slot = _table[gate] >> 1;
+    const uint64_t bit = uint64_t(1) << (slot % WORD);
+
+    _justs[slot / WORD] &= ~bit;
+    _vals [slot / WORD] &= ~bit;
+    
+    if (val) {
+	_justs[slot / WORD] |= bit;
+	if (*val) {
+	    _vals[slot / WORD] |= bit;
+	}
+    }
+}
+
+
+void BitSlicer::add (const gate_t & g, vector<gate_t> & o_done)
+{
+    assert (is_sliceable (g.num));
+    
+    // a batch only holds gates whose inputs are all available
+    FOREACH (in, g.inputs) {
+	ensure (*in, o_done);
+    }
+    
+    const batch_key_t key = key_of (g);
+    vector<gate_t> & batch = _batches[key];
+
+    batch.push_back (g);
+    _pending[g.num] = key;
+
+    if (batch.size() == WORD) {
+	do_batch (key, o_done);
+    }
+}
+
+
+void BitSlicer::ensure (index_t gate, vector<gate_t> & o_done)
+{
+    std::map<index_t, batch_key_t>::const_iterator p = _pending.find (gate);
+    if (p != _pending.end()) {
+	// copy the key, as do_batch() erases p
+	const batch_key_t key = p->second;
+	do_batch (key, o_done);
+    }
+}
+
+
+void BitSlicer::flush_all (vector<gate_t> & o_done)
+{
+    FOREACH (b, _batches) {
+	do_batch (b->first, o_done);
+    }
+}
+
+
+void BitSlicer::gather (const vector<gate_t> & batch, unsigned input,
+			uint64_t & o_val, uint64_t & o_just) const
+{
+    o_val = o_just = 0;
+    for (unsigned i = 0; i < batch.size(); i++)
+    {
+	optional<int> x = get (batch[i].inputs[input]);
+	if (x) {
+	    o_just |= uint64_t(1) << i;
+	    if (*x) {
+		o_val |= uint64_t(1) << i;
+	    }
+	}
+    }
+}
+
+
+void BitSlicer::do_batch (const batch_key_t & key, vector<gate_t> & o_done)
+{
+    vector<gate_t> batch;
+    batch.swap (_batches[key]);
+
+    if (batch.empty()) {
+	return;
+    }
+
+    LOG (Log::DEBUG, logger,
+	 "Doing a batch of " << batch.size() << " gates with op "
+	 << key.first << "," << key.second);
+    
+    const uint64_t mask = batch.size() == WORD ?
+	~uint64_t(0) : (uint64_t(1) << batch.size()) - 1;
+
+    // the input words. Value bits of nil inputs are 0.
+    uint64_t a, aj, b = 0, bj = 0, c = 0, cj = 0;
+    const size_t arity = batch[0].inputs.size();
+    
+    gather (batch, 0, a, aj);
+    if (arity > 1) gather (batch, 1, b, bj);
+    if (arity > 2) gather (batch, 2, c, cj);
+
+    // the results, with the same nil semantics as do_bin_op() and do_un_op().
+    uint64_t r = 0, rj = 0;
+    const uint64_t both = aj & bj;
+
+    switch (key.first)
+    {
+    case gate_t::UnOp:
+	// only LNot is sliceable, and LNot (nil) = 1
+	r  = ~(aj & a);
+	rj = mask;
+	break;
+
+    case gate_t::Select:
+    {
+	// a nil selector selects the second value
+	const uint64_t sel = aj & a;
+	r  = (sel & b)  | (~sel & c);
+	rj = (sel & bj) | (~sel & cj);
+    }
+    break;
+
+    case gate_t::BinOp:
+	switch (key.second)
+	{
+	case gate_t::And:
+	{
+	    // 0 if either is 0, 1 if both are 1, otherwise nil
+	    const uint64_t zero = (aj & ~a) | (bj & ~b);
+	    r  = aj & a & bj & b;
+	    rj = zero | r;
+	}
+	break;
+	case gate_t::Or:
+	{
+	    // 1 if either is 1, 0 if both are 0, otherwise nil
+	    const uint64_t one = (aj & a) | (bj & b);
+	    r  = one;
+	    rj = one | (aj & ~a & bj & ~b);
+	}
+	break;
+
+	// the rest are nil if either input is nil
+	case gate_t::Eq:   r = ~(a ^ b); rj = both; break;
+	case gate_t::NEq:  r = a ^ b;	 rj = both; break;
+	case gate_t::LT:   r = ~a & b;	 rj = both; break;
+	case gate_t::GT:   r = a & ~b;	 rj = both; break;
+	case gate_t::LTEq: r = ~a | b;	 rj = both; break;
+	case gate_t::GTEq: r = a | ~b;	 rj = both; break;
+	case gate_t::BAnd: r = a & b;	 rj = both; break;
+	case gate_t::BOr:  r = a | b;	 rj = both; break;
+	case gate_t::BXor: r = a ^ b;	 rj = both; break;
+
+	default:
+	    assert (((void)"Unexpected sliced BinOp", false));
+	}
+	break;
+
+    default:
+	assert (((void)"Unexpected sliced gate op", false));
+    }
+
+    // keep the value bits of nils at 0
+    rj &= mask;
+    r  &= rj;
+
+    for (unsigned i = 0; i < batch.size(); i++)
+    {
+	_pending.erase (batch[i].num);
+	
+	const uint64_t bit = uint64_t(1) << i;
+	put (batch[i].num,
+	     (rj & bit) ? optional<int> ((r & bit) ? 1 : 0) : optional<int> ());
+    }
+
+    o_done.insert (o_done.end(), batch.begin(), batch.end());
+}
+
+
+CLOSE_NS
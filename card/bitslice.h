@@ -0,0 +1,138 @@
+// -*- c++ -*-
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+ */
+
+// Bitsliced evaluation of the boolean parts of a circuit.
+//
+// Prep finds the boolean-valued gates (values in {0, 1, nil}), and gives each a
+// slot in a bit store kept in card memory instead of the host values
+// container: 64 values per machine word, with a second word of Just bits.
+//
+// Gates which are boolean-valued and have only boolean inputs ("sliceable")
+// are not evaluated one by one: they are queued in a batch per operation, and a
+// batch of up to 64 gates is done with a few bitwise operations when it is
+// full, or when a value from it is needed.
+
+#include <vector>
+#include <map>
+
+#include <stdint.h>
+
+#include <boost/optional/optional.hpp>
+
+#include <common/gate.h>
+
+#include "value-width.h"
+
+
+#ifndef _BITSLICE_H
+#define _BITSLICE_H
+
+
+/// the values of the bool slots table
+enum {
+    BOOL_NONE = -1		// not a boolean-valued gate
+    // otherwise (slot << 1) | sliceable
+};
+
+
+/// Find the boolean-valued and sliceable gates.
+/// @param gates the gates in circuit order
+/// @param o_table the table entry for each gate number, see BOOL_NONE. Prep
+/// stores it in BOOL_SLOTS_CONT.
+/// @param ranges if given, the gates whose values are inferred to be in [0,1]
+///	are boolean-valued too (see infer_value_ranges()).
+/// @return the number of boolean-valued gates
+size_t find_bool_gates (const std::vector<gate_t> & gates,
+			unsigned max_gate,
+			std::vector<int> & o_table,
+			const std::vector<value_range_t> * ranges = NULL);
+
+
+
+OPEN_NS
+
+
+class BitSlicer
+{
+public:
+
+    BitSlicer (const std::vector<int> & table);
+
+    bool is_bool (index_t gate) const
+	{
+	    return gate < _table.size() && _table[gate] != BOOL_NONE;
+	}
+
+    bool is_sliceable (index_t gate) const
+	{
+	    return is_bool (gate) && (_table[gate] & 1);
+	}
+
+    /// get the value of a boolean gate. It must not be pending.
+    boost::optional<int> get (index_t gate) const;
+
+    /// set the value of a boolean gate
+    void put (index_t gate, boost::optional<int> val);
+    
+    /// Queue a sliceable gate for evaluation. Any batches holding its inputs
+    /// are done first.
+    /// @param o_done the gates evaluated, if any batches were done.
+    void add (const gate_t & g, std::vector<gate_t> & o_done);
+
+    /// make sure the gate's value is available, doing its batch if it is
+    /// pending.
+    void ensure (index_t gate, std::vector<gate_t> & o_done);
+
+    /// do all the pending batches
+    void flush_all (std::vector<gate_t> & o_done);
+
+
+private:
+
+    // a batch is identified by the gate op kind and operator
+    typedef std::pair<int,int> batch_key_t;
+
+    static batch_key_t key_of (const gate_t & g)
+	{
+	    return std::make_pair (int(g.op.kind), g.op.params[0]);
+	}
+
+    /// bitsliced evaluation of a batch of same-op gates
+    void do_batch (const batch_key_t & key, std::vector<gate_t> & o_done);
+
+    /// gather one input of all the gates in a batch into a value and a Just
+    /// word
+    void gather (const std::vector<gate_t> & batch, unsigned input,
+		 uint64_t & o_val, uint64_t & o_just) const;
+
+    
+    std::vector<int> _table;
+
+    /// the bit store, 64 slots per word
+    std::vector<uint64_t> _vals, _justs;
+
+    std::map<batch_key_t, std::vector<gate_t> > _batches;
+
+    /// the batch each pending gate is in
+    std::map<index_t, batch_key_t> _pending;
+
+    static const unsigned WORD = 64;
+};
+
+
+CLOSE_NS
+
+
+#endif // _BITSLICE_H
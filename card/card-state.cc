@@ -0,0 +1,176 @@
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+*/
+
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <algorithm>		// min
+
+#include <stdio.h>		// rename
+#include <string.h>		// memcpy
+
+#include <faerieplay/common/logging.h>
+
+#include "cvm-options.h"
+#include "card-state.h"
+
+
+using namespace std;
+
+using boost::optional;
+
+
+namespace
+{
+    Log::logger_t logger = Log::makeLogger ("circuit-vm.card.card-state");
+
+    const string MAC_KEY_RECORD = "card-mac.key";
+
+    /// how many objects to read at once for card_mac_chain_container()
+    const size_t DIGEST_CHUNK = 256;
+
+    string record_path (const string & name)
+    {
+	return g_cvm_options.state_dir + DIRSEP + name;
+    }
+
+    /// the card MAC key, read or made on the first call
+    const ByteBuffer & mac_key (CryptoProviderFactory * fact)
+	throw (better_exception)
+    {
+	static optional<ByteBuffer> key;
+
+	if (!key) {
+	    key = read_card_state (MAC_KEY_RECORD);
+	}
+	if (!key) {
+	    LOG (Log::INFO, logger,
+		 "Making a new card MAC key in " << g_cvm_options.state_dir);
+	    // a fresh MAC key of the size SymWrapper uses
+	    SymWrapper fresh (fact);
+	    key = ByteBuffer (fresh.getMacKey(), ByteBuffer::deepcopy());
+	    write_card_state (MAC_KEY_RECORD, *key);
+	}
+
+	return *key;
+    }
+}
+
+
+optional<ByteBuffer> read_card_state (const string & name)
+    throw (io_exception)
+{
+    ifstream in (record_path (name).c_str(), ios::binary);
+    if (!in) {
+	return optional<ByteBuffer>();
+    }
+
+    string val ((istreambuf_iterator<char> (in)),
+		istreambuf_iterator<char> ());
+
+    return ByteBuffer (val.data(), val.size(), ByteBuffer::deepcopy());
+}
+
+
+void write_card_state (const string & name, const ByteBuffer & val)
+    throw (io_exception)
+{
+    // replace the record in one step, so a crash leaves the old one or the
+    // new one
+    const string path = record_path (name), tmp = path + ".new";
+
+    {
+	ofstream out (tmp.c_str(), ios::binary | ios::trunc);
+	out.write (val.cdata(), val.len());
+	if (!out) {
+	    throw io_exception ("Could not write card state file " + tmp);
+	}
+    }
+
+    if (rename (tmp.c_str(), path.c_str()) != 0) {
+	throw io_exception ("Could not replace card state file " + path);
+    }
+}
+
+
+ByteBuffer card_mac (const ByteBuffer & data, CryptoProviderFactory * fact)
+    throw (better_exception)
+{
+    auto_ptr<MacProvider> mac (fact->getMacProvider());
+    return mac->mac (data, mac_key (fact));
+}
+
+
+void card_mac_chain (ByteBuffer & io_digest, const ByteBuffer & data,
+		     CryptoProviderFactory * fact)
+    throw (better_exception)
+{
+    ByteBuffer both (io_digest.len() + data.len());
+    bbcopy (both, io_digest, 0);
+    bbcopy (both, data, io_digest.len());
+
+    io_digest = card_mac (both, fact);
+}
+
+
+void card_mac_chain_container (ByteBuffer & io_digest, FlatIO & io,
+			       CryptoProviderFactory * fact)
+    throw (better_exception)
+{
+    for (index_t s = 0; s < io.getLen(); s += DIGEST_CHUNK)
+    {
+	const size_t n = min (DIGEST_CHUNK, io.getLen() - s);
+
+	vector<index_t> idxs (n);
+	for (index_t k = 0; k < n; k++) {
+	    idxs[k] = s + k;
+	}
+	obj_list_t objs;
+	io.read (idxs, objs);
+
+	// each chunk starts with its position, and each object with its length
+	size_t len = sizeof(index_t);
+	FOREACH (o, objs) {
+	    len += sizeof(size_t) + o->len();
+	}
+
+	ByteBuffer chunk (len);
+	memcpy (chunk.data(), &s, sizeof(s));
+	size_t off = sizeof(s);
+	FOREACH (o, objs) {
+	    const size_t olen = o->len();
+	    memcpy (chunk.data() + off, &olen, sizeof(olen));
+	    off += sizeof(olen);
+	    bbcopy (chunk, *o, off);
+	    off += olen;
+	}
+
+	card_mac_chain (io_digest, chunk, fact);
+    }
+}
+
+
+string card_state_name (const string & prefix, const string & cont_name)
+{
+    string name = prefix + "-" + cont_name;
+    FOREACH (c, name) {
+	if (*c == '/') {
+	    *c = '_';
+	}
+    }
+    return name;
+}
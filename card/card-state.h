@@ -0,0 +1,69 @@
+// -*- c++ -*-
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+ */
+
+// State which the card keeps between runs, as small files in its own state
+// directory (cvm_options_t::state_dir), out of reach of the host. This is
+// where the card remembers digests of what it left on the host, so that it can
+// tell if the host rolls containers back or swaps in others.
+
+#include <string>
+
+#include <boost/optional/optional.hpp>
+
+#include <faerieplay/common/utils.h>
+#include <faerieplay/common/exceptions.h>
+#include <pir/common/sym_crypto.h>
+#include <pir/card/io_flat.h>
+
+
+#ifndef _CARD_STATE_H
+#define _CARD_STATE_H
+
+
+/// Read a state record.
+/// @return none if it was never written
+boost::optional<ByteBuffer> read_card_state (const std::string & name)
+    throw (io_exception);
+
+void write_card_state (const std::string & name, const ByteBuffer & val)
+    throw (io_exception);
+
+
+/// A MAC of some data under the card's own MAC key, which is made on first
+/// use and kept in the state directory. Deterministic, so it can be stored and
+/// compared later.
+ByteBuffer card_mac (const ByteBuffer & data, CryptoProviderFactory * fact)
+    throw (better_exception);
+
+/// Extend a running digest with more data: card_mac() of the digest so far
+/// and the data.
+void card_mac_chain (ByteBuffer & io_digest, const ByteBuffer & data,
+		     CryptoProviderFactory * fact)
+    throw (better_exception);
+
+
+/// Extend a running digest with all the objects of a container, as stored
+/// (so without decrypting them), in order. Reads the whole container.
+void card_mac_chain_container (ByteBuffer & io_digest, FlatIO & io,
+			       CryptoProviderFactory * fact)
+    throw (better_exception);
+
+
+/// a state record name for something stored under a container name
+std::string card_state_name (const std::string & prefix,
+			     const std::string & cont_name);
+
+
+#endif // _CARD_STATE_H
@@ -0,0 +1,357 @@
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+*/
+
+
+#include <string>
+#include <vector>
+#include <istream>
+
+#include <time.h>
+#include <string.h>		// memcpy, memcmp
+
+#include <faerieplay/common/utils.h>
+#include <faerieplay/common/logging.h>
+
+#include <common/consts-sfdl.h>
+
+#include "card-state.h"
+#include "circuit-cache.h"
+#include "cvm-options.h"
+#include "utils.h"
+
+
+using std::string;
+using std::vector;
+using std::istream;
+
+
+namespace
+{
+    Log::logger_t logger = Log::makeLogger ("circuit-vm.card.circuit-cache");
+
+    const string
+	INDEX_CONT  = CCT_CACHE_DIR + DIRSEP + "index",
+	INFO_CONT   = "info",
+	INPUTS_CONT = "input-gates";
+
+    // index entry of a slot: the circuit hash (two ints), and the time it was
+    // last used. An empty slot has hash 0.
+    enum {
+	IDX_HASH_HI,
+	IDX_HASH_LO,
+	IDX_USED,
+	INDEX_ENTRY
+    };
+
+    // the info table. After these come the bytes of the cache key, and of
+    // the slot MAC, INFO_KEY_LEN and INFO_SLOT_MAC_LEN of them, packed into
+    // ints.
+    enum {
+	INFO_VERSION,
+	INFO_LEN_HI,
+	INFO_LEN_LO,
+	INFO_NUM_GATES,
+	INFO_MAX_GATE,
+	INFO_NUM_INPUTS,
+	INFO_KEY_LEN,
+	INFO_SLOT_MAC_LEN,
+	INFO_ELEM_SIZES,
+	INFO_SIZE = INFO_ELEM_SIZES + 3
+    };
+
+    // change when the cached containers change format
+    const int CACHE_VERSION = 2;
+
+    // the containers in a slot, all covered by the slot MAC
+    const string SLOT_CONTS[] = {
+	CCT_CONT, GATES_CONT, VALUE_SLOTS_CONT, INPUTS_CONT
+    };
+
+
+    int hi (uint64_t x) { return int (x >> 32); }
+    int lo (uint64_t x) { return int (x & 0xFFFFFFFF); }
+
+    uint64_t join (int hi, int lo)
+    {
+	return (uint64_t (unsigned (hi)) << 32) | unsigned (lo);
+    }
+
+
+    /// append the bytes of 'b' to an int table, padded to whole ints
+    void append_bytes (vector<int> & table, const ByteBuffer & b)
+    {
+	const size_t at = table.size();
+	table.resize (at + (b.len() + sizeof(int) - 1) / sizeof(int), 0);
+	memcpy (&table[at], b.data(), b.len());
+    }
+
+    /// are the 'len' bytes in an int table from int 'at' equal to 'b'?
+    bool bytes_equal (const vector<int> & table, size_t at, size_t len,
+		      const ByteBuffer & b)
+    {
+	return len == b.len() &&
+	    (at + (len + sizeof(int) - 1) / sizeof(int)) <= table.size() &&
+	    memcmp (&table[at], b.data(), len) == 0;
+    }
+
+
+    /// read an int table, returning an empty one if the container does not
+    /// exist yet.
+    vector<int> read_table_or_empty (const string & cont,
+				     CryptoProviderFactory * fact)
+    {
+	vector<int> table;
+	try {
+	    read_int_table (cont, fact, table);
+	}
+	catch (const std::exception & ex) {
+	    LOG (Log::DEBUG, logger,
+		 "No table " << cont << ": " << ex.what());
+	    table.clear();
+	}
+	return table;
+    }
+}
+
+
+OPEN_NS
+
+
+ByteBuffer circuit_mac (istream & in, const string & variant,
+			uint64_t & o_len,
+			CryptoProviderFactory * fact)
+    throw (better_exception)
+{
+    const istream::pos_type start = in.tellg();
+
+    // the variant is MAC'ed on its own first, so it cannot look like file
+    ByteBuffer mac = card_mac (ByteBuffer (variant), fact);
+    o_len = 0;
+
+    char buf[8192];
+    while (in.read (buf, sizeof(buf)) || in.gcount() > 0) {
+	card_mac_chain (mac, ByteBuffer (buf, in.gcount(), ByteBuffer::SHALLOW),
+			fact);
+	o_len += in.gcount();
+    }
+
+    in.clear();
+    in.seekg (start);
+
+    return mac;
+}
+
+
+CircuitCache::CircuitCache (istream & gates_in,
+			    const string & variant,
+			    CryptoProviderFactory * fact)
+    throw (better_exception)
+    : _fact (fact),
+      _hit  (false)
+{
+    _key = circuit_mac (gates_in, variant, _file_len, fact);
+
+    // 0 marks an empty slot
+    memcpy (&_hash, _key.data(), std::min (sizeof(_hash), _key.len()));
+    if (_hash == 0) {
+	_hash = 1;
+    }
+
+    const unsigned num_slots = std::max (g_cvm_options.cct_cache_slots, 1U);
+    const int now = time (NULL);
+    const unsigned max_age = g_cvm_options.cct_cache_max_age;
+
+    // the index may be padded, or be from a different number of slots. Slots
+    // beyond num_slots are dropped from it.
+    _index = read_table_or_empty (INDEX_CONT, fact);
+    _index.resize (num_slots * INDEX_ENTRY, 0);
+
+    // look for the circuit, expiring old entries along the way
+    bool found = false;
+    for (unsigned k = 0; k < num_slots; k++)
+    {
+	int * e = &_index[k * INDEX_ENTRY];
+	const uint64_t h = join (e[IDX_HASH_HI], e[IDX_HASH_LO]);
+
+	if (h != 0 && max_age > 0 && unsigned (now - e[IDX_USED]) > max_age) {
+	    LOG (Log::INFO, logger,
+		 "Expiring cache slot " << k);
+	    e[IDX_HASH_HI] = e[IDX_HASH_LO] = e[IDX_USED] = 0;
+	}
+	else if (h == _hash && !found) {
+	    _slot = k;
+	    found = true;
+	}
+    }
+
+    // otherwise pick an empty or the least recently used slot. Empty slots
+    // have a last use time of 0.
+    if (!found) {
+	_slot = 0;
+	for (unsigned k = 1; k < num_slots; k++) {
+	    if (_index[k * INDEX_ENTRY + IDX_USED] <
+		_index[_slot * INDEX_ENTRY + IDX_USED])
+	    {
+		_slot = k;
+	    }
+	}
+    }
+
+    _dir = CCT_CACHE_DIR + DIRSEP + "slot-" + itoa (_slot);
+
+    if (found) {
+	load_info ();
+    }
+
+    LOG (Log::INFO, logger,
+	 "Circuit key " << std::hex << _hash << std::dec
+	 << (_hit ? " found in " : " not cached, will prepare into ") << _dir);
+
+    // on a hit, update the last use time, otherwise the slot stays empty
+    // until the new containers are all written.
+    write_index (_hit ? _hash : 0);
+}
+
+
+void CircuitCache::load_info ()
+{
+    vector<int> info = read_table_or_empty (_dir + DIRSEP + INFO_CONT, _fact);
+
+    const size_t key_ints = info.size() < INFO_SIZE ? 0 :
+	(size_t (info[INFO_KEY_LEN]) + sizeof(int) - 1) / sizeof(int);
+    
+    if (info.size() < INFO_SIZE				||
+	info[INFO_VERSION] != CACHE_VERSION		||
+	!bytes_equal (info, INFO_SIZE, info[INFO_KEY_LEN], _key) ||
+	join (info[INFO_LEN_HI], info[INFO_LEN_LO]) != _file_len)
+    {
+	LOG (Log::WARN, logger,
+	     "Cache slot " << _dir << " does not match its index entry,"
+	     " will prepare the circuit again");
+	return;
+    }
+
+    _info.num_gates = info[INFO_NUM_GATES];
+    _info.max_gate  = info[INFO_MAX_GATE];
+    _info.value_elem_sizes.assign (info.begin() + INFO_ELEM_SIZES,
+				   info.begin() + INFO_SIZE);
+
+    // the stored tables are padded
+    _info.value_table = read_table_or_empty (_dir + DIRSEP + VALUE_SLOTS_CONT,
+					     _fact);
+    _info.input_gates = read_table_or_empty (_dir + DIRSEP + INPUTS_CONT,
+					     _fact);
+
+    if (_info.value_table.size() < _info.max_gate + 1 ||
+	_info.input_gates.size() < size_t (info[INFO_NUM_INPUTS]))
+    {
+	LOG (Log::WARN, logger,
+	     "Cache slot " << _dir << " has short tables,"
+	     " will prepare the circuit again");
+	return;
+    }
+
+    // the containers must be the ones stored with this info
+    ByteBuffer mac;
+    try {
+	mac = slot_mac ();
+    }
+    catch (const std::exception & ex) {
+	LOG (Log::WARN, logger,
+	     "Could not read the containers in cache slot " << _dir << ": "
+	     << ex.what() << ", will prepare the circuit again");
+	return;
+    }
+    if (!bytes_equal (info, INFO_SIZE + key_ints, info[INFO_SLOT_MAC_LEN], mac))
+    {
+	LOG (Log::WARN, logger,
+	     "Containers in cache slot " << _dir << " do not match its info,"
+	     " will prepare the circuit again");
+	return;
+    }
+
+    _info.value_table.resize (_info.max_gate + 1);
+    _info.input_gates.resize (info[INFO_NUM_INPUTS]);
+
+    _hit = true;
+}
+
+
+ByteBuffer CircuitCache::slot_mac ()
+    throw (better_exception)
+{
+    ByteBuffer mac = card_mac (ByteBuffer (_dir), _fact);
+
+    for (unsigned c = 0; c < ARRLEN (SLOT_CONTS); c++) {
+	// as stored, without any decryption filter
+	FlatIO io (_dir + DIRSEP + SLOT_CONTS[c], boost::none);
+	card_mac_chain (mac, ByteBuffer (SLOT_CONTS[c]), _fact);
+	card_mac_chain_container (mac, io, _fact);
+    }
+
+    return mac;
+}
+
+
+void CircuitCache::store (const cct_cache_info_t & info)
+    throw (better_exception)
+{
+    vector<int> table (INFO_SIZE);
+    table[INFO_VERSION]	    = CACHE_VERSION;
+    table[INFO_LEN_HI]	    = hi (_file_len);
+    table[INFO_LEN_LO]	    = lo (_file_len);
+    table[INFO_NUM_GATES]   = info.num_gates;
+    table[INFO_MAX_GATE]    = info.max_gate;
+    table[INFO_NUM_INPUTS]  = info.input_gates.size();
+
+    assert (info.value_elem_sizes.size() == INFO_SIZE - INFO_ELEM_SIZES);
+    std::copy (info.value_elem_sizes.begin(), info.value_elem_sizes.end(),
+	       table.begin() + INFO_ELEM_SIZES);
+
+    write_int_table (_dir + DIRSEP + VALUE_SLOTS_CONT, info.value_table, _fact);
+    // empty containers are not supported
+    write_int_table (_dir + DIRSEP + INPUTS_CONT,
+		     info.input_gates.empty() ?
+		     vector<int> (1, 0) : info.input_gates,
+		     _fact);
+
+    // the slot's containers are all written now
+    const ByteBuffer mac = slot_mac ();
+    table[INFO_KEY_LEN]	     = _key.len();
+    table[INFO_SLOT_MAC_LEN] = mac.len();
+    append_bytes (table, _key);
+    append_bytes (table, mac);
+    
+    write_int_table (_dir + DIRSEP + INFO_CONT, table, _fact);
+
+    write_index (_hash);
+
+    LOG (Log::INFO, logger,
+	 "Stored the prepared circuit in " << _dir);
+}
+
+
+void CircuitCache::write_index (uint64_t hash)
+    throw (better_exception)
+{
+    int * e = &_index[_slot * INDEX_ENTRY];
+    e[IDX_HASH_HI] = hi (hash);
+    e[IDX_HASH_LO] = lo (hash);
+    e[IDX_USED]	   = hash != 0 ? int (time (NULL)) : 0;
+
+    write_int_table (INDEX_CONT, _index, _fact);
+}
+
+
+CLOSE_NS
@@ -0,0 +1,141 @@
+// -*- c++ -*-
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+ */
+
+// A cache of prepared circuits on the host, keyed by a MAC of the circuit
+// file under the card's own key (see card-state.h), so the host cannot make
+// two circuits collide. Each entry is a slot directory CCT_CACHE_DIR/slot-<k>
+// with the encrypted circuit container, the gates container, and what prep
+// needs to set up the per-run containers without reading the circuit file
+// again: the value layout and the numbers of the Input gates. The slot's
+// MAC'ed info table holds the full key, and a MAC of all the slot's containers
+// as stored, which is checked on every hit, so the host cannot swap in
+// containers from another slot or an older circuit.
+//
+// The number of slots is bounded (cvm_options_t::cct_cache_slots), so a new
+// circuit takes over the least recently used slot, and its containers are
+// written over the old ones. An index container records which circuit is in
+// each slot and when it was last used.
+
+#include <istream>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+#include <pir/common/sym_crypto.h>
+
+#include <faerieplay/common/exceptions.h>
+
+
+#ifndef _CIRCUIT_CACHE_H
+#define _CIRCUIT_CACHE_H
+
+
+OPEN_NS
+
+
+/// Card MAC of a variant string (the prep options which change the prepared
+/// circuit), and then the rest of a circuit file, which is then rewound. This
+/// is the cache key, and what the values kept for an incremental run are tied
+/// to.
+/// @param in must be seekable.
+/// @param o_len the number of bytes MAC'ed from the stream
+ByteBuffer circuit_mac (std::istream & in, const std::string & variant,
+			uint64_t & o_len,
+			CryptoProviderFactory * fact)
+    throw (better_exception);
+
+
+/// What prep saves about a circuit in its cache slot.
+struct cct_cache_info_t
+{
+    size_t num_gates;
+    unsigned max_gate;
+
+    /// the value layout, see ValueLayout
+    std::vector<int> value_table;
+    std::vector<size_t> value_elem_sizes;
+
+    /// the numbers of the Input gates, in circuit order
+    std::vector<int> input_gates;
+};
+
+
+
+class CircuitCache
+{
+public:
+
+    /// MAC the circuit file, which is then rewound, and find its slot: the
+    /// one it is already in, or else a free or the least recently used one,
+    /// which is marked empty until store() is called.
+    /// @param gates_in must be seekable.
+    /// @param variant the prep options which change the prepared circuit, to
+    ///	be MAC'ed with the file.
+    CircuitCache (std::istream & gates_in,
+		  const std::string & variant,
+		  CryptoProviderFactory * fact)
+	throw (better_exception);
+
+    /// is the circuit already prepared?
+    bool hit () const { return _hit; }
+
+    /// the directory for the circuit and gates containers
+    const std::string & dir () const { return _dir; }
+
+    /// the saved info, if hit()
+    const cct_cache_info_t & info () const { return _info; }
+
+    /// Record a circuit whose containers were just written into dir().
+    void store (const cct_cache_info_t & info)
+	throw (better_exception);
+
+
+private:
+
+    /// read and check the info in our slot, and set _hit
+    void load_info ();
+
+    /// a card MAC over all the containers in our slot
+    ByteBuffer slot_mac ()
+	throw (better_exception);
+
+    /// write the index, with our slot marked as holding 'hash', or as empty if
+    /// 'hash' is 0.
+    void write_index (uint64_t hash)
+	throw (better_exception);
+
+    CryptoProviderFactory * _fact;
+
+    /// the cache key, and its first 64 bits for the index, which are enough
+    /// to find the slot, as the info table has the whole key.
+    ByteBuffer _key;
+    uint64_t _hash, _file_len;
+
+    unsigned _slot;
+    std::string _dir;
+
+    bool _hit;
+    cct_cache_info_t _info;
+
+    /// the index entries, INDEX_ENTRY ints per slot
+    std::vector<int> _index;
+};
+
+
+CLOSE_NS
+
+
+#endif // _CIRCUIT_CACHE_H
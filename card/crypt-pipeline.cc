@@ -0,0 +1,301 @@
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+*/
+
+
+#include <deque>
+#include <memory>
+#include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <boost/utility.hpp>	// boost::noncopyable
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
+
+#include <faerieplay/common/utils.h>
+#include <faerieplay/common/exceptions.h>
+#include <faerieplay/common/logging.h>
+
+#include "cvm-options.h"
+#include "crypt-pipeline.h"
+
+
+using std::string;
+using std::vector;
+using std::min;
+
+
+namespace
+{
+    Log::logger_t logger = Log::makeLogger ("circuit-vm.card.crypt-pipeline");
+
+    // objects per list read and write
+    const size_t PIPELINE_BATCH = 64;
+
+    // how many batches per worker may be read but not yet written, which
+    // bounds the memory used
+    const size_t IN_FLIGHT_PER_WORKER = 2;
+
+    
+    struct batch_t
+    {
+	vector<index_t> idxs;
+	obj_list_t objs;
+    };
+
+
+    class crypt_pipeline : boost::noncopyable
+    {
+    public:
+	
+	crypt_pipeline (FlatIO & from, const SymWrapper * from_keys,
+			FlatIO & to, const SymWrapper & to_keys,
+			size_t n,
+			CryptoProviderFactory * fact,
+			unsigned num_workers)
+	    : _from	    (from),
+	      _to	    (to),
+	      _from_keys    (from_keys),
+	      _to_keys	    (to_keys),
+	      _fact	    (fact),
+	      _n	    (n),
+	      _num_batches  ((n + PIPELINE_BATCH - 1) / PIPELINE_BATCH),
+	      _num_workers  (num_workers),
+	      _in_flight    (0),
+	      _reader_done  (false)
+	    {}
+
+	void run ()
+	    throw (better_exception)
+	    {
+		boost::thread_group threads;
+		
+		threads.create_thread (
+		    boost::bind (&crypt_pipeline::reader, this));
+		threads.create_thread (
+		    boost::bind (&crypt_pipeline::writer, this));
+		for (unsigned i = 0; i < _num_workers; i++) {
+		    threads.create_thread (
+			boost::bind (&crypt_pipeline::worker, this));
+		}
+
+		threads.join_all ();
+
+		if (!_error.empty()) {
+		    throw io_exception ("Container copy to " + _to.getName()
+					+ " failed: " + _error);
+		}
+	    }
+
+    private:
+
+	void reader ()
+	    {
+		try {
+		    for (size_t b = 0; b < _num_batches; b++)
+		    {
+			{
+			    boost::mutex::scoped_lock lk (_lock);
+			    while (_in_flight >= IN_FLIGHT_PER_WORKER * _num_workers
+				   && _error.empty())
+			    {
+				_changed.wait (lk);
+			    }
+			    if (!_error.empty()) {
+				return;
+			    }
+			}
+
+			batch_t batch;
+			const index_t start = b * PIPELINE_BATCH;
+			for (index_t i = start;
+			     i < min (start + PIPELINE_BATCH, _n);
+			     i++)
+			{
+			    batch.idxs.push_back (i);
+			}
+			_from.read (batch.idxs, batch.objs);
+
+			boost::mutex::scoped_lock lk (_lock);
+			_todo.push_back (std::make_pair (b, batch));
+			_in_flight++;
+			_changed.notify_all ();
+		    }
+		}
+		catch (const std::exception & ex) {
+		    fail (ex.what());
+		}
+
+		boost::mutex::scoped_lock lk (_lock);
+		_reader_done = true;
+		_changed.notify_all ();
+	    }
+
+
+	void worker ()
+	    {
+		try {
+		    // SymWrapper is not thread safe, so each worker has its own.
+		    std::auto_ptr<SymWrapper> unwrapper;
+		    if (_from_keys) {
+			unwrapper.reset (new SymWrapper (_fact,
+							 _from_keys->getEncKey(),
+							 _from_keys->getMacKey()));
+		    }
+		    SymWrapper wrapper (_fact,
+					_to_keys.getEncKey(), _to_keys.getMacKey());
+		    
+		    while (true)
+		    {
+			std::pair<size_t, batch_t> job;
+			{
+			    boost::mutex::scoped_lock lk (_lock);
+			    while (_todo.empty() && !_reader_done &&
+				   _error.empty())
+			    {
+				_changed.wait (lk);
+			    }
+			    if (!_error.empty() || _todo.empty()) {
+				return;
+			    }
+			    job = _todo.front();
+			    _todo.pop_front();
+			}
+
+			FOREACH (obj, job.second.objs) {
+			    if (unwrapper.get()) {
+				*obj = unwrapper->unwrap (*obj);
+			    }
+			    *obj = wrapper.wrap (*obj);
+			}
+
+			boost::mutex::scoped_lock lk (_lock);
+			_done.insert (job);
+			_changed.notify_all ();
+		    }
+		}
+		catch (const std::exception & ex) {
+		    fail (ex.what());
+		}
+	    }
+
+
+	void writer ()
+	    {
+		try {
+		    for (size_t b = 0; b < _num_batches; b++)
+		    {
+			batch_t batch;
+			{
+			    // the batches are written in order
+			    boost::mutex::scoped_lock lk (_lock);
+			    std::map<size_t, batch_t>::iterator found;
+			    while ((found = _done.find (b)) == _done.end() &&
+				   _error.empty())
+			    {
+				_changed.wait (lk);
+			    }
+			    if (!_error.empty()) {
+				return;
+			    }
+			    batch = found->second;
+			    _done.erase (found);
+			}
+
+			_to.write (batch.idxs, batch.objs);
+
+			boost::mutex::scoped_lock lk (_lock);
+			_in_flight--;
+			_changed.notify_all ();
+		    }
+		}
+		catch (const std::exception & ex) {
+		    fail (ex.what());
+		}
+	    }
+
+
+	/// record the first error, and wake everyone up to give up
+	void fail (const string & msg)
+	    {
+		LOG (Log::ERROR, logger,
+		     "Error copying to " << _to.getName() << ": " << msg);
+		
+		boost::mutex::scoped_lock lk (_lock);
+		if (_error.empty()) {
+		    _error = msg;
+		}
+		_changed.notify_all ();
+	    }
+
+	
+	FlatIO & _from, & _to;
+	const SymWrapper * _from_keys;
+	const SymWrapper & _to_keys;
+	CryptoProviderFactory * _fact;
+	
+	const size_t _n, _num_batches;
+	const unsigned _num_workers;
+
+	// protects the rest
+	boost::mutex _lock;
+	boost::condition _changed;
+
+	std::deque<std::pair<size_t, batch_t> > _todo; // read, not yet processed
+	std::map<size_t, batch_t> _done;		// processed, not yet written
+	size_t _in_flight;				// read, not yet written
+	bool _reader_done;
+	string _error;
+    };
+}
+
+
+
+OPEN_NS
+
+
+void crypt_pipeline_copy (FlatIO & from,
+			  const SymWrapper * from_keys,
+			  FlatIO & to,
+			  const SymWrapper & to_keys,
+			  size_t n,
+			  CryptoProviderFactory * fact,
+			  unsigned num_workers)
+    throw (better_exception)
+{
+    LOG (Log::INFO, logger,
+	 "Copying " << n << " objects from " << from.getName()
+	 << " to " << to.getName() << " with " << num_workers << " workers");
+
+    crypt_pipeline pipe (from, from_keys, to, to_keys, n, fact,
+			 std::max (num_workers, 1U));
+    pipe.run ();
+}
+
+
+unsigned crypt_pipeline_workers ()
+{
+    if (g_cvm_options.crypt_threads > 0) {
+	return g_cvm_options.crypt_threads;
+    }
+
+    // default: one per processor, if known
+    return std::max (boost::thread::hardware_concurrency(), 1U);
+}
+
+
+CLOSE_NS
@@ -0,0 +1,63 @@
+// -*- c++ -*-
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+ */
+
+// Pipelined, multi-threaded copy of a container into a new encrypted one.
+//
+// A reader thread does list reads of batches of objects, a pool of workers
+// decrypts and encrypts the batches, each worker with its own SymWrapper (they
+// are not thread safe), and a writer thread writes the batches out in order.
+// Only the reader and the writer do host I/O.
+//
+// The containers are accessed without filters, and the objects are wrapped
+// with SymWrapper::wrap() here, as IOFilterEncrypt does.
+
+#include <boost/shared_ptr.hpp>
+
+#include <pir/card/io_flat.h>
+#include <pir/common/sym_crypto.h>
+
+
+#ifndef _CRYPT_PIPELINE_H
+#define _CRYPT_PIPELINE_H
+
+
+OPEN_NS
+
+
+/// Copy objects [0,n) from 'from' to 'to', both opened without filters.
+/// @param from_keys the keys of the objects in 'from', or NULL if they are in
+///	the clear.
+/// @param to_keys the keys to wrap the objects for 'to' with; those of the
+///	IOFilterEncrypt of the new container.
+/// @param num_workers how many worker threads to run.
+void crypt_pipeline_copy (FlatIO & from,
+			  const SymWrapper * from_keys,
+			  FlatIO & to,
+			  const SymWrapper & to_keys,
+			  size_t n,
+			  CryptoProviderFactory * fact,
+			  unsigned num_workers)
+    throw (better_exception);
+
+
+/// The number of worker threads to use, from cvm_options_t::crypt_threads.
+/// 1 means the serial stream_process copy should be used instead.
+unsigned crypt_pipeline_workers ();
+
+
+CLOSE_NS
+
+
+#endif // _CRYPT_PIPELINE_H
@@ -0,0 +1,159 @@
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+*/
+
+
+// Measure the host I/O and encryption costs which the Array cost model uses to
+// choose its session lengths (see Array::session_length()), and print them as
+// the environment settings for cvm, along with the session lengths they give
+// for a few array sizes.
+
+#include "array.h"
+
+#include "cvm-options.h"
+#include "utils.h"
+
+#include <pir/common/sym_crypto.h>
+#include <pir/card/configs.h>
+#include <pir/card/io_flat.h>
+
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include <math.h>
+#include <sys/time.h>
+
+
+using namespace std;
+
+using pir::Array;
+
+
+namespace
+{
+    Log::logger_t logger = Log::makeLogger ("circuit-vm.card.cvm-calibrate");
+
+
+    /// host objects read and written for the I/O timing
+    const size_t IO_OBJS = 256;
+
+    /// size and number of the buffers for the crypto timing
+    const size_t CRYPT_BYTES = 4096, CRYPT_REPS = 256;
+
+
+    double now_nsec ()
+    {
+	struct timeval tv;
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec * 1e9 + tv.tv_usec * 1e3;
+    }
+
+
+    /// ns per host object read or write, without encryption
+    double time_io ()
+    {
+	FlatIO io ("cvm-calibrate-scratch",
+		   Just (make_pair (IO_OBJS, sizeof(index_t))));
+
+	const double start = now_nsec();
+
+	for (index_t i = 0; i < IO_OBJS; i++) {
+	    hostio_write_int (io, i, i);
+	}
+	for (index_t i = 0; i < IO_OBJS; i++) {
+	    if (hostio_read_int (io, i) != int (i)) {
+		throw io_exception ("Scratch container returned wrong value");
+	    }
+	}
+
+	return (now_nsec() - start) / (2 * IO_OBJS);
+    }
+
+
+    /// ps per byte encrypted or decrypted
+    double time_crypt (CryptoProviderFactory * fact)
+    {
+	SymWrapper wrapper (fact);
+
+	ByteBuffer buf (CRYPT_BYTES);
+	buf.set (0);
+
+	const double start = now_nsec();
+
+	for (size_t r = 0; r < CRYPT_REPS; r++) {
+	    ByteBuffer clear = wrapper.unwrap (wrapper.wrap (buf));
+	    if (clear.len() != CRYPT_BYTES) {
+		throw crypto_exception ("Crypto round trip changed the size");
+	    }
+	}
+
+	return (now_nsec() - start) * 1e3 / (2.0 * CRYPT_REPS * CRYPT_BYTES);
+    }
+}
+
+
+void usage (char *argv[])
+{
+    cerr << "Usage: " << argv[0] << endl
+	 << "Measures the host I/O and encryption costs, and prints the "
+	"CVM_ORAM_IO_NSEC\nand CVM_ORAM_CRYPT_PSEC settings for cvm." << endl;
+}
+
+
+int main (int argc, char * argv[])
+{
+    opterr = 0;			// shut up error messages from getopt
+    init_default_configs ();
+    init_cvm_options ();
+    if ( do_configs (argc, argv) != 0 || g_configs.just_help ) {
+	usage (argv);
+	exit (EXIT_SUCCESS);
+    }
+
+    try
+    {
+	auto_ptr<CryptoProviderFactory> provfact = init_crypt (g_configs);
+
+	LOG (Log::PROGRESS, logger,
+	     "Timing " << IO_OBJS << " host object reads and writes");
+	const double io = time_io ();
+
+	LOG (Log::PROGRESS, logger,
+	     "Timing " << CRYPT_REPS << " encryptions of "
+	     << CRYPT_BYTES << " bytes");
+	const double crypt = time_crypt (provfact.get());
+
+	g_cvm_options.oram_io_nsec    = unsigned (lrint (io));
+	g_cvm_options.oram_crypt_psec = unsigned (lrint (crypt));
+
+	cout << "CVM_ORAM_IO_NSEC="	<< g_cvm_options.oram_io_nsec << endl
+	     << "CVM_ORAM_CRYPT_PSEC="	<< g_cvm_options.oram_crypt_psec << endl;
+
+	cout << endl << "# session lengths (elements, element size: length)"
+	     << endl;
+	const size_t lens[]  = { 1<<10, 1<<16, 1<<20 },
+	             sizes[] = { 4, 64, 1024 };
+	for (unsigned i = 0; i < ARRLEN(lens); i++) {
+	    for (unsigned j = 0; j < ARRLEN(sizes); j++) {
+		cout << "# " << lens[i] << ", " << sizes[j] << ": "
+		     << Array::session_length (lens[i], sizes[j]) << endl;
+	    }
+	}
+    }
+    catch (const std::exception & ex) {
+	LOG (Log::CRIT, logger,
+	     "Calibration failed: " << ex.what());
+	exit (EXIT_FAILURE);
+    }
+}
@@ -0,0 +1,209 @@
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+*/
+
+
+// Coordinator for running one circuit on several cvm worker processes:
+// prepares and partitions the circuit, then starts the workers which are on
+// this machine (and prints the command line for the others), and waits for
+// them.
+
+#include "prep-circuit.h"
+#include "worker.h"
+
+#include "cvm-options.h"
+#include "utils.h"
+
+#include <pir/common/sym_crypto.h>
+#include <pir/card/configs.h>
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <memory>
+#include <vector>
+#include <string>
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+
+using namespace std;
+
+using pir::WorkerLinks;
+
+
+namespace
+{
+    Log::logger_t logger = Log::makeLogger ("circuit-vm.card.cvm-coord");
+
+    
+    bool is_local (const string & host)
+    {
+	return host == "localhost" || host == "127.0.0.1";
+    }
+
+    /// cvm-worker is expected next to this program
+    string worker_program (const char * argv0)
+    {
+	string me (argv0);
+	string::size_type slash = me.rfind ('/');
+	return slash == string::npos ?
+	    "cvm-worker" : me.substr (0, slash+1) + "cvm-worker";
+    }
+}
+
+
+void usage (char *argv[])
+{
+    cerr << "Usage: " << argv[0]
+	 << " <circuit file> <host:port of worker 0> <host:port of worker 1> ..."
+	 << " < input" << endl
+	 << "Workers on localhost are started automatically, the others have to "
+	"be started\nwith the printed command line." << endl
+	 << "The workers share the link keys in $CVM_LINK_KEYS (default .)"
+	 << endl
+	 << "and get a fresh run nonce from here, in $CVM_RUN_NONCE" << endl;
+}
+
+
+
+int main (int argc, char * argv[])
+{
+    set_new_handler (out_of_memory_coredump);
+
+    opterr = 0;			// shut up error messages from getopt
+    init_default_configs ();
+    init_cvm_options ();
+    if ( do_configs (argc, argv) != 0 ) {
+	LOG (Log::ERROR, logger, "Command line parsing failed");
+	usage (argv);
+	exit (EXIT_SUCCESS);
+    }
+
+    if (g_configs.just_help || optind + 2 >= argc) {
+	usage (argv);
+	exit (EXIT_SUCCESS);
+    }
+
+    const string cct_filename = argv[optind];
+    vector<WorkerLinks::endpoint_t> workers;
+    
+    try {
+	workers = parse_worker_list (argc, argv, optind+1);
+    }
+    catch (const bad_arg_exception & ex) {
+	LOG (Log::CRIT, logger, ex.what());
+	usage (argv);
+	exit (EXIT_FAILURE);
+    }
+
+    g_cvm_options.partitions = workers.size();
+
+    // a fresh nonce for this run, which the workers mix into their link keys
+    string run_nonce;
+    
+
+    //
+    // prepare and partition the circuit, just like cvm.
+    //
+    try
+    {
+	auto_ptr<CryptoProviderFactory> provfact = init_crypt (g_configs);
+
+	run_nonce = WorkerLinks::make_run_nonce (provfact.get());
+
+	ifstream gates_in (cct_filename.c_str());
+	if (!gates_in) {
+	    LOG (Log::CRIT, logger,
+		 "Failed to open circuit file " << cct_filename << ": " << errmsg);
+	    exit (EXIT_FAILURE);
+	}
+	
+	prepare_gates_container (gates_in, g_configs.cct_name, provfact.get());
+    }
+    catch (const std::exception & ex) {
+	LOG (Log::CRIT, logger,
+	     "Error while preparing the circuit for the workers: " << ex.what());
+	exit (EXIT_FAILURE);
+    }
+
+
+    //
+    // start the workers. They get our options, so they find the same circuit,
+    // host and crypto, and the run nonce in the environment.
+    //
+    setenv ("CVM_RUN_NONCE", run_nonce.c_str(), 1);
+    
+    vector<string> args (argv, argv + optind);
+    args[0] = worker_program (argv[0]);
+    args.push_back ("");	// the worker number
+    args.insert (args.end(), argv + optind + 1, argv + argc);
+    const unsigned part_arg = optind;
+    
+    vector<pid_t> children;
+    
+    for (unsigned w = 0; w < workers.size(); w++)
+    {
+	args[part_arg] = itoa (w);
+	
+	if (!is_local (workers[w].host)) {
+	    ostringstream cmd;
+	    cmd << "CVM_RUN_NONCE=" << run_nonce << " ";
+	    FOREACH (a, args) {
+		cmd << *a << " ";
+	    }
+	    LOG (Log::PROGRESS, logger,
+		 "Start worker " << w << " on " << workers[w].host
+		 << " with: " << cmd.str());
+	    continue;
+	}
+
+	pid_t pid = fork ();
+	if (pid < 0) {
+	    LOG (Log::CRIT, logger, "fork failed: " << errmsg);
+	    exit (EXIT_FAILURE);
+	}
+	if (pid == 0) {
+	    vector<char*> c_args;
+	    FOREACH (a, args) {
+		c_args.push_back (const_cast<char*> (a->c_str()));
+	    }
+	    c_args.push_back (NULL);
+	    
+	    execvp (c_args[0], &c_args[0]);
+	    
+	    LOG (Log::CRIT, logger,
+		 "Failed to run worker " << args[0] << ": " << errmsg);
+	    _exit (EXIT_FAILURE);
+	}
+
+	children.push_back (pid);
+    }
+
+
+    bool failed = false;
+    FOREACH (pid, children) {
+	int status;
+	if (waitpid (*pid, &status, 0) < 0 ||
+	    !WIFEXITED (status) || WEXITSTATUS (status) != EXIT_SUCCESS)
+	{
+	    LOG (Log::ERROR, logger, "Worker process " << *pid << " failed");
+	    failed = true;
+	}
+    }
+
+    exit (failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,106 @@
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+*/
+
+
+#include <string>
+
+#include <stdlib.h>		// getenv
+
+#include <faerieplay/common/logging.h>
+
+#include "cvm-options.h"
+
+
+using namespace std;
+
+
+cvm_options_t g_cvm_options;
+
+
+namespace
+{
+    Log::logger_t logger = Log::makeLogger ("circuit-vm.card.cvm-options");
+
+    /// a boolean option is on if the variable is set to anything but "" or "0"
+    bool env_flag (const char * name, bool dflt)
+    {
+	const char * val = getenv (name);
+	if (val == NULL) {
+	    return dflt;
+	}
+
+	bool answer = string(val) != "" && string(val) != "0";
+
+	LOG (Log::INFO, logger,
+	     "option " << name << " = " << answer);
+
+	return answer;
+    }
+
+    unsigned env_unsigned (const char * name, unsigned dflt)
+    {
+	const char * val = getenv (name);
+	if (val == NULL) {
+	    return dflt;
+	}
+
+	unsigned answer = strtoul (val, NULL, 10);
+
+	LOG (Log::INFO, logger,
+	     "option " << name << " = " << answer);
+
+	return answer;
+    }
+
+    string env_string (const char * name, const string & dflt)
+    {
+	const char * val = getenv (name);
+	if (val == NULL) {
+	    return dflt;
+	}
+
+	LOG (Log::INFO, logger,
+	     "option " << name << " = " << val);
+
+	return val;
+    }
+}
+
+
+void init_cvm_options ()
+{
+    g_cvm_options.incremental	= env_flag ("CVM_INCREMENTAL", false);
+    g_cvm_options.public_inputs	= env_string ("CVM_PUBLIC_INPUTS", "");
+    g_cvm_options.state_dir	= env_string ("CVM_STATE_DIR", ".");
+    g_cvm_options.partitions	= env_unsigned ("CVM_PARTITIONS", 0);
+    g_cvm_options.link_key_dir	= env_string ("CVM_LINK_KEYS", ".");
+    g_cvm_options.run_nonce	= env_string ("CVM_RUN_NONCE", "");
+    g_cvm_options.bitslice	= env_flag ("CVM_BITSLICE", false);
+    g_cvm_options.narrow	= env_flag ("CVM_NARROW", false);
+    g_cvm_options.crypt_threads	= env_unsigned ("CVM_CRYPT_THREADS", 0);
+    g_cvm_options.optimize	= env_flag ("CVM_OPTIMIZE", false);
+    g_cvm_options.reorder	= env_flag ("CVM_REORDER", false);
+    g_cvm_options.renumber	= env_flag ("CVM_RENUMBER", false);
+    g_cvm_options.batch_reads	= env_flag ("CVM_BATCH_READS", false);
+    g_cvm_options.fuse_reads	= env_flag ("CVM_FUSE_READS", false);
+    g_cvm_options.oram_io_nsec	    = env_unsigned ("CVM_ORAM_IO_NSEC", 0);
+    g_cvm_options.oram_crypt_psec   = env_unsigned ("CVM_ORAM_CRYPT_PSEC", 0);
+    g_cvm_options.background_repermute =
+	env_flag ("CVM_BACKGROUND_REPERMUTE", false);
+    g_cvm_options.path_oram_min	= env_unsigned ("CVM_PATH_ORAM_MIN", 0);
+    g_cvm_options.path_oram_arrays  = env_string ("CVM_PATH_ORAM_ARRAYS", "");
+    g_cvm_options.cct_cache	= env_flag ("CVM_CCT_CACHE", false);
+    g_cvm_options.cct_cache_slots   = env_unsigned ("CVM_CCT_CACHE_SLOTS", 4);
+    g_cvm_options.cct_cache_max_age = env_unsigned ("CVM_CCT_CACHE_MAX_AGE", 0);
+}
@@ -0,0 +1,174 @@
+// -*- c++ -*-
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+ */
+
+// Runtime options of the CVM which are not part of the common card configs
+// (g_configs). They are read from environment variables, so they can be set
+// without changing the command line parsing shared with the other card
+// programs.
+
+#include <string>
+
+
+#ifndef _CVM_OPTIONS_H
+#define _CVM_OPTIONS_H
+
+
+struct cvm_options_t
+{
+    /// Re-evaluate only the gates downstream of changed scalar inputs, reusing
+    /// the values from the previous run of the same circuit.
+    /// env: CVM_INCREMENTAL
+    bool incremental;
+
+    /// The scalar inputs which are public, and may show in an incremental
+    /// run: a comma-separated list of input names, each also covering the
+    /// names under it ("a" covers "a.b"). Only changes in these are looked
+    /// for. The other inputs are written again on every incremental run, and
+    /// all the gates depending on them re-run, so the host cannot tell which of
+    /// them changed.
+    /// env: CVM_PUBLIC_INPUTS
+    std::string public_inputs;
+
+    /// directory on the card for the state it keeps between runs (see
+    /// card-state.h), such as the digest of the values left for the next
+    /// incremental run. Not to be shared with the host.
+    /// env: CVM_STATE_DIR
+    std::string state_dir;
+
+    /// Split the circuit into this many partitions for separate worker
+    /// processes (see partition-circuit.h). 0 or 1 for no partitioning. Set by
+    /// cvm-coord from its worker list.
+    /// env: CVM_PARTITIONS
+    unsigned partitions;
+
+    /// directory with the link keys (ENC_KEY_FILE and MAC_KEY_FILE) shared
+    /// by the workers of a partitioned circuit.
+    /// env: CVM_LINK_KEYS
+    std::string link_key_dir;
+
+    /// the nonce of this run of a partitioned circuit, in hex, which
+    /// cvm-coord makes and gives to all the workers (see worker-links.h).
+    /// env: CVM_RUN_NONCE
+    std::string run_nonce;
+
+    /// Evaluate the boolean gates of the circuit 64 at a time in a bit store
+    /// in card memory (see bitslice.h). Not used with partitioned runs, or
+    /// with incremental set, whose runs leave all their values in the value
+    /// store for the next run.
+    /// env: CVM_BITSLICE
+    bool bitslice;
+
+    /// Keep the gates whose values provably fit in 8 or 16 bits in narrow
+    /// lanes in card memory (see value-width.h). Not used with partitioned
+    /// runs, or with incremental set.
+    /// env: CVM_NARROW
+    bool narrow;
+
+    /// How many worker threads encrypt containers in do_encrypt() and the
+    /// array re-permutation copy (see crypt-pipeline.h). 0 for one per
+    /// processor, 1 for the serial copy.
+    /// env: CVM_CRYPT_THREADS
+    unsigned crypt_threads;
+
+    /// Simplify the circuit at prep time: fold constants, apply algebraic
+    /// identities, merge duplicate gates, and remove dead gates (see
+    /// optimize-circuit.h).
+    /// env: CVM_OPTIMIZE
+    bool optimize;
+
+    /// Reorder the circuit at prep time to keep the producers and consumers of
+    /// values close together (see optimize-circuit.h).
+    /// env: CVM_REORDER
+    bool reorder;
+
+    /// Renumber the gates densely in circuit order at prep time, so the gates
+    /// and values containers have no unused slots (see optimize-circuit.h).
+    /// LOGVALS traces still show the original gate numbers.
+    /// env: CVM_RENUMBER
+    bool renumber;
+
+    /// Group independent reads of the same array together at prep time, and
+    /// serve each group with one scan of the array's working area (see
+    /// cluster_array_reads() in optimize-circuit.h).
+    /// env: CVM_BATCH_READS
+    bool batch_reads;
+
+    /// Have the CVM keep the value of an array read which only feeds Slicers
+    /// in card memory until the Slicers are done, instead of writing the whole
+    /// element to the value store and reading it back for each Slicer (see
+    /// fuse_read_slicers() in optimize-circuit.h).
+    /// env: CVM_FUSE_READS
+    bool fuse_reads;
+
+    /// The time in nanoseconds to read or write one host object, apart from
+    /// encryption, for the Array cost model (see Array::session_length()).
+    /// cvm-calibrate measures it. 0 with oram_crypt_psec 0 for the fixed
+    /// session length of sqrt(N)*lg N.
+    /// env: CVM_ORAM_IO_NSEC
+    unsigned oram_io_nsec;
+
+    /// The time in picoseconds to encrypt or decrypt one byte, for the Array
+    /// cost model.
+    /// env: CVM_ORAM_CRYPT_PSEC
+    unsigned oram_crypt_psec;
+
+    /// Spread each array's reshuffle over the accesses of the session before
+    /// it, instead of doing it all at the session's end, so that no access
+    /// stalls for a whole reshuffle. The working area gets up to twice as
+    /// long, since it carries the items written in one session into the next.
+    /// env: CVM_BACKGROUND_REPERMUTE
+    bool background_repermute;
+
+    /// Arrays of at least this many elements use a Path ORAM instead of the
+    /// square-root scheme (see path-oram.h), which costs O(lg N) host objects
+    /// per access instead of O(sqrt(N) lg N), but keeps a position map of N
+    /// indices in card memory. 0 for none.
+    /// env: CVM_PATH_ORAM_MIN
+    unsigned path_oram_min;
+
+    /// Arrays which use a Path ORAM whatever their length: a comma-separated
+    /// list of array names (the name of an input array, or of the array
+    /// variable in the source program).
+    /// env: CVM_PATH_ORAM_ARRAYS
+    std::string path_oram_arrays;
+
+    /// Keep prepared circuits in a cache on the host, keyed by a hash of the
+    /// circuit file, and reuse them instead of preparing the circuit again
+    /// (see circuit-cache.h). Not used with incremental, partitioned,
+    /// bitsliced or narrow runs, which need the whole parsed circuit.
+    /// env: CVM_CCT_CACHE
+    bool cct_cache;
+
+    /// How many circuits the cache holds; the least recently used one is
+    /// replaced by a new one.
+    /// env: CVM_CCT_CACHE_SLOTS
+    unsigned cct_cache_slots;
+
+    /// Cached circuits not used for this many seconds are dropped. 0 for no
+    /// limit.
+    /// env: CVM_CCT_CACHE_MAX_AGE
+    unsigned cct_cache_max_age;
+};
+
+
+extern cvm_options_t g_cvm_options;
+
+
+/// Fill in #g_cvm_options from the environment. Unset variables get the
+/// default value.
+void init_cvm_options ();
+
+
+#endif // _CVM_OPTIONS_H
@@ -0,0 +1,83 @@
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+*/
+
+
+// Driver for one worker process of a partitioned circuit. Normally started by
+// cvm-coord, but can be started by hand on another machine.
+
+#include "worker.h"
+#include "cvm-options.h"
+#include "utils.h"
+
+#include <pir/common/sym_crypto.h>
+#include <pir/card/configs.h>
+
+#include <iostream>
+#include <memory>
+
+#include <stdlib.h>
+
+
+using namespace std;
+
+
+namespace
+{
+    Log::logger_t logger = Log::makeLogger ("circuit-vm.card.cvm-worker");
+}
+
+
+void usage (char *argv[])
+{
+    cerr << "Usage: " << argv[0]
+	 << " <worker number> <host:port of worker 0> <host:port of worker 1> ..."
+	 << endl
+	 << "Runs one partition of a circuit prepared by cvm-coord, with the"
+	" run nonce\nit gives in $CVM_RUN_NONCE" << endl;
+}
+
+
+int main (int argc, char * argv[])
+{
+    set_new_handler (out_of_memory_coredump);
+
+    opterr = 0;			// shut up error messages from getopt
+    init_default_configs ();
+    init_cvm_options ();
+    if ( do_configs (argc, argv) != 0 ) {
+	LOG (Log::ERROR, logger, "Command line parsing failed");
+	usage (argv);
+	exit (EXIT_SUCCESS);
+    }
+
+    if (g_configs.just_help || optind + 1 >= argc) {
+	usage (argv);
+	exit (EXIT_SUCCESS);
+    }
+
+    try {
+	unsigned part = atoi (argv[optind]);
+	vector<pir::WorkerLinks::endpoint_t> workers =
+	    parse_worker_list (argc, argv, optind+1);
+
+	auto_ptr<CryptoProviderFactory> provfact = init_crypt (g_configs);
+
+	run_worker (part, workers, g_configs.cct_name, provfact.get());
+    }
+    catch (const std::exception & ex) {
+	LOG (Log::ERROR, logger,
+	     "Fatal error while running circuit partition: " << ex.what());
+	exit (EXIT_FAILURE);
+    }
+}
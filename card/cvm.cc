@@ -16,9 +16,10 @@
 // Driver file for the Faerieplay circuit virtual machine
 
 #include "prep-circuit.h"
-#include "enc-circuit.h"
 #include "run-circuit.h"
+#include "value-store.h"
 
+#include "cvm-options.h"
 #include "utils.h"
 
 #include <pir/common/sym_crypto.h>
@@ -44,7 +45,34 @@ namespace
 
 void usage (char *argv[])
 {
-    cerr << "Usage: " << argv[0] << " <circuit file> < input" << endl;
+    cerr << "Usage: " << argv[0] << " <circuit file> < input" << endl
+	 << "Environment options:" << endl
+	 << "\tCVM_INCREMENTAL=1: only re-run the gates affected by changed"
+	" scalar inputs" << endl
+	 << "\tCVM_PUBLIC_INPUTS=a,b.c: the public inputs, whose changes"
+	" an incremental run\n\t\tmay show" << endl
+	 << "\tCVM_STATE_DIR=dir: the card's own state directory" << endl
+	 << "\tCVM_BITSLICE=1: evaluate the boolean gates 64 at a time" << endl
+	 << "\tCVM_NARROW=1: keep 8- and 16-bit gate values in card memory"
+	 << endl
+	 << "\tCVM_OPTIMIZE=1: simplify the circuit before running it" << endl
+	 << "\tCVM_REORDER=1: reorder the circuit for locality" << endl
+	 << "\tCVM_RENUMBER=1: renumber the gates densely" << endl
+	 << "\tCVM_BATCH_READS=1: batch independent reads of an array" << endl
+	 << "\tCVM_FUSE_READS=1: keep array elements read for their fields in"
+	" card memory" << endl
+	 << "\tCVM_ORAM_IO_NSEC=ns, CVM_ORAM_CRYPT_PSEC=ps: host costs for"
+	" choosing array\n\t\tsession lengths, from cvm-calibrate" << endl
+	 << "\tCVM_BACKGROUND_REPERMUTE=1: reshuffle arrays a little on every"
+	" access" << endl
+	 << "\tCVM_PATH_ORAM_MIN=n: use a Path ORAM for arrays of at least n"
+	" elements" << endl
+	 << "\tCVM_PATH_ORAM_ARRAYS=a,b: use a Path ORAM for these arrays"
+	 << endl
+	 << "\tCVM_CCT_CACHE=1: reuse prepared circuits from the host cache"
+	 << endl
+	 << "\tCVM_CCT_CACHE_SLOTS=n, CVM_CCT_CACHE_MAX_AGE=secs: cache size"
+	" and expiry" << endl;
 }
 
 
@@ -59,6 +87,7 @@ int main (int argc, char * argv[])
 
     opterr = 0;			// shut up error messages from getopt
     init_default_configs ();
+    init_cvm_options ();
     if ( do_configs (argc, argv) != 0 ) {
 	LOG (Log::ERROR, logger, "Command line parsing failed");
 	usage (argv);
@@ -112,9 +141,12 @@ int main (int argc, char * argv[])
     //
     // prepare the circuit and any input array containers.
     //
+    incremental_prep_t incremental;
+    string cct_dir;
     try {
 	size_t num_gates = prepare_gates_container (gates_in, g_configs.cct_name,
-						    g_provfact.get());
+						    g_provfact.get(),
+						    &incremental, &cct_dir);
 
 	LOG (Log::INFO, logger,
 	     "Circuit has " << num_gates << " gates");
@@ -127,24 +159,22 @@ int main (int argc, char * argv[])
     }
 
 
-    //
-    // encrypt the circuit containers
-    //
-    try {
-	do_encrypt (g_provfact.get());
-    }
-    catch (const std::exception & ex) {
-	LOG (Log::CRIT, logger,
-	     "Exception while encrypting containers: " << ex.what());
-	exit (EXIT_FAILURE);
-    }
-
-
     //
     // and run the circuit
     //
     try {
-	pir::CircuitEval evaluator (g_configs.cct_name, g_provfact.get());
+	pir::CircuitEval evaluator (g_configs.cct_name, g_provfact.get(),
+				    incremental.incremental ?
+				    &incremental.steps : NULL,
+				    cct_dir);
+
+	// only if prep wrote their slot tables for this circuit
+	if (prep_bitslices ()) {
+	    evaluator.enable_bitslice ();
+	}
+	if (prep_narrows ()) {
+	    evaluator.enable_narrow ();
+	}
 
 	LOG (Log::INFO, logger,
 	     "cvm starting circuit evaluation at " << epoch_time);
@@ -153,6 +183,13 @@ int main (int argc, char * argv[])
     
 	LOG (Log::INFO, logger,
 	     "cvm done with circuit evaluation at " << epoch_time);
+
+	// remember the values left for the next incremental run
+	if (incremental.cct_key.len() > 0) {
+	    pir::ValueStore values (g_configs.cct_name, g_provfact.get());
+	    values.save_digest (g_configs.cct_name, incremental.cct_key,
+				g_provfact.get());
+	}
     
     }
     catch (const std::exception & ex) {
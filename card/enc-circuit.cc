@@ -14,8 +14,10 @@
 
 
 // program to encrypt a circuit object on the host. the circuit was produced in
-// cleartext by "prep-circuit.cc", and we want to MAC it before running it.
-// Since the SymWrapper class does enc and MAC together, we'll just do both.
+// cleartext by an older "prep-circuit.cc", and we want to MAC it before running
+// it. Since the SymWrapper class does enc and MAC together, we'll just do both.
+// The current prep-circuit.cc encrypts as it writes, so this is only needed
+// for legacy cleartext circuits.
 //
 // reads from the container CCT_CONT, and writes the encrypted values back in
 // there.
@@ -47,6 +49,8 @@
 #include <common/misc.h>
 #include <common/consts-sfdl.h>
 
+#include "crypt-pipeline.h"
+
 #include "stream/processor.h"
 #include "stream/helpers.h"
 
@@ -66,7 +70,8 @@ namespace
 
 
 
-void do_encrypt (CryptoProviderFactory* crypt_fact)
+void do_encrypt (CryptoProviderFactory* crypt_fact,
+		 bool with_values)
     throw (std::exception)
 {
     //
@@ -78,10 +83,13 @@ void do_encrypt (CryptoProviderFactory* crypt_fact)
 
     ByteBuffer obj_bytes;
 
-    FlatIO *conts[] = { &vals_io, &cct_io };
+    FlatIO *conts[] = { &cct_io, &vals_io };
+
+    // the values container is last, so it can be skipped
+    const unsigned num_conts = with_values ? ARRLEN(conts) : ARRLEN(conts)-1;
 	
     // go through all the containers
-    for (unsigned c = 0; c < ARRLEN(conts); c++) {
+    for (unsigned c = 0; c < num_conts; c++) {
 	    
 //	    clog << "*** Working on container " << io->getName() << endl;
 	    
@@ -94,17 +102,25 @@ void do_encrypt (CryptoProviderFactory* crypt_fact)
 	FlatIO temp (io->getName() + "-enc",
 		     make_pair (io->getLen(), io->getElemSize()));
 
+	shared_ptr<SymWrapper> temp_keys (new SymWrapper (crypt_fact));
 	temp.appendFilter (auto_ptr<HostIOFilter>
-			   (new IOFilterEncrypt (&temp,
-						 shared_ptr<SymWrapper>
-						 (new SymWrapper
-						  (crypt_fact)))));
+			   (new IOFilterEncrypt (&temp, temp_keys)));
 
 	// and transfer each object in the container
-	stream_process ( identity_itemproc<>(),
-			 zero_to_n (num_objs),
-			 io,
-			 &temp );
+	const unsigned workers = crypt_pipeline_workers ();
+	if (workers > 1) {
+	    // the pipeline writes the encrypted objects itself, through an
+	    // unfiltered handle.
+	    FlatIO temp_raw (temp.getName(), boost::none);
+	    crypt_pipeline_copy (*io, NULL, temp_raw, *temp_keys,
+				 num_objs, crypt_fact, workers);
+	}
+	else {
+	    stream_process ( identity_itemproc<>(),
+			     zero_to_n (num_objs),
+			     io,
+			     &temp );
+	}
 
 	// and move encrypted container back to original name.
 	*io = temp;
@@ -17,6 +17,12 @@
 
 #include <exception>
 
-void do_encrypt (CryptoProviderFactory* crypt_fact)
+/// Encrypt the circuit containers of a circuit prepared in the clear, by an
+/// older prepare_gates_container(). The current one writes them encrypted
+/// already, and keeps the values in per-size-class containers (see
+/// value-store.h) instead of the one VALUES_CONT.
+/// @param with_values also encrypt the values container.
+void do_encrypt (CryptoProviderFactory* crypt_fact,
+		 bool with_values = true)
     throw (std::exception);
 
@@ -0,0 +1,276 @@
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+*/
+
+
+#include <string>
+#include <vector>
+#include <map>
+#include <sstream>
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+
+#include <faerieplay/common/utils.h>
+#include <faerieplay/common/logging.h>
+
+#include "input-reader.h"
+
+
+using std::string;
+using std::vector;
+using std::map;
+
+using boost::optional;
+
+
+namespace
+{
+    Log::logger_t logger = Log::makeLogger ("circuit-vm.card.input-reader");
+
+    string join_path (const string & path, const string & name)
+    {
+	return path.empty() ? name : path + "." + name;
+    }
+}
+
+
+OPEN_NS
+
+
+InputReader::InputReader (FILE * in)
+    : _in   (in),
+      _line (1)
+{}
+
+
+void InputReader::add_array (const string & name, InputArraySink * sink)
+{
+    _sinks[name] = sink;
+}
+
+
+void InputReader::read ()
+    throw (bad_arg_exception, std::exception)
+{
+    // the concatenated records are merged
+    while (peek() != EOF) {
+	read_record ("");
+    }
+
+    LOG (Log::INFO, logger,
+	 "Read " << _scalars.size() << " scalar values and "
+	 << _lengths.size() << " arrays, to line " << _line);
+}
+
+
+optional<int> InputReader::find (const string & name) const
+{
+    map<string, int>::const_iterator v = _scalars.find (name);
+    return v != _scalars.end() ? optional<int> (v->second) : optional<int>();
+}
+
+
+optional<size_t> InputReader::array_length (const string & name) const
+{
+    map<string, size_t>::const_iterator l = _lengths.find (name);
+    return l != _lengths.end() ? optional<size_t> (l->second) : optional<size_t>();
+}
+
+
+void InputReader::read_value (const string & path)
+    throw (bad_arg_exception, std::exception)
+{
+    switch (peek()) {
+    case '{':
+	read_record (path);
+	break;
+    case '[':
+    {
+	map<string, InputArraySink*>::const_iterator s = _sinks.find (path);
+	if (s != _sinks.end()) {
+	    read_array (path, s->second);
+	}
+	else {
+	    read_list (path);
+	}
+	break;
+    }
+    default:
+	_scalars[path] = read_int ();
+    }
+}
+
+
+void InputReader::read_flat (vector<int> & o_ints)
+    throw (bad_arg_exception)
+{
+    const int c = peek();
+    if (c == '{' || c == '[') {
+	const char close = c == '{' ? '}' : ']';
+	expect (c);
+
+	for (bool first = true; peek() != close; first = false) {
+	    if (!first) {
+		expect (',');
+	    }
+	    if (c == '{') {
+		read_name ();
+		expect ('=');
+	    }
+	    read_flat (o_ints);
+	}
+	expect (close);
+    }
+    else {
+	o_ints.push_back (read_int ());
+    }
+}
+
+
+void InputReader::read_record (const string & path)
+    throw (bad_arg_exception, std::exception)
+{
+    expect ('{');
+    for (bool first = true; peek() != '}'; first = false) {
+	if (!first) {
+	    expect (',');
+	}
+	const string name = read_name ();
+	expect ('=');
+	read_value (join_path (path, name));
+    }
+    expect ('}');
+}
+
+
+void InputReader::read_list (const string & path)
+    throw (bad_arg_exception, std::exception)
+{
+    expect ('[');
+    for (unsigned i = 0; peek() != ']'; i++) {
+	if (i > 0) {
+	    expect (',');
+	}
+	read_value (join_path (path, itoa (i)));
+    }
+    expect (']');
+}
+
+
+void InputReader::read_array (const string & path, InputArraySink * sink)
+    throw (bad_arg_exception, std::exception)
+{
+    LOG (Log::INFO, logger,
+	 "Streaming input array " << path);
+
+    vector<int> comps;
+    size_t i = 0;
+
+    expect ('[');
+    for (; peek() != ']'; i++) {
+	if (i > 0) {
+	    expect (',');
+	}
+	comps.clear();
+	read_flat (comps);
+	sink->element (i, comps);
+    }
+    expect (']');
+
+    _lengths[path] = i;
+}
+
+
+int InputReader::read_int ()
+    throw (bad_arg_exception)
+{
+    string tok;
+    int c;
+    for (peek();
+	 (c = getc (_in)) != EOF && (isalnum (c) || c == '-' || c == '+'); )
+    {
+	tok += char (c);
+    }
+    ungetc (c, _in);
+
+    if (tok == "true") {
+	return 1;
+    }
+    if (tok == "false") {
+	return 0;
+    }
+
+    char * end;
+    errno = 0;
+    const long val = strtol (tok.c_str(), &end, 10);
+    if (tok.empty() || *end != '\0' || errno == ERANGE ||
+	val != long (int (val)))
+    {
+	syntax_error ("bad integer '" + tok + "'");
+    }
+    return int (val);
+}
+
+
+string InputReader::read_name ()
+    throw (bad_arg_exception)
+{
+    string name;
+    int c;
+    for (peek(); (c = getc (_in)) != EOF && (isalnum (c) || c == '_'); ) {
+	name += char (c);
+    }
+    ungetc (c, _in);
+
+    if (name.empty()) {
+	syntax_error ("expected a name");
+    }
+    return name;
+}
+
+
+int InputReader::peek ()
+{
+    int c;
+    while ((c = getc (_in)) != EOF && isspace (c)) {
+	if (c == '\n') {
+	    _line++;
+	}
+    }
+    return ungetc (c, _in);
+}
+
+
+void InputReader::expect (char c)
+    throw (bad_arg_exception)
+{
+    if (peek() != c) {
+	syntax_error (string ("expected '") + c + "'");
+    }
+    getc (_in);
+}
+
+
+void InputReader::syntax_error (const string & msg)
+    throw (bad_arg_exception)
+{
+    std::ostringstream os;
+    os << "Input syntax error at line " << _line << ": " << msg;
+    LOG (Log::CRIT, logger, os.str());
+    throw bad_arg_exception (os.str());
+}
+
+
+CLOSE_NS
@@ -0,0 +1,138 @@
+// -*- c++ -*-
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+ */
+
+// A streaming reader for the C-Json inputs of a circuit. Unlike PathFinder,
+// which parses the whole document into a tree, it hands the elements of the
+// input arrays to a sink one at a time as they are parsed, so only one element
+// is in memory at a time. The other values in the input, which are the scalar
+// inputs, are kept in a map by their dotted path.
+//
+// The syntax accepted is a sequence of records, which are merged:
+//	value	::= int | true | false | record | list
+//	record	::= '{' [ name '=' value { ',' name '=' value } ] '}'
+//	list	::= '[' [ value { ',' value } ] ']'
+// A list element is addressed by its index in a path, eg. "a.2.x". An array
+// element which is a record or list is flattened into its ints, in order.
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include <boost/optional/optional.hpp>
+
+#include <faerieplay/common/utils.h>
+#include <faerieplay/common/exceptions.h>
+
+
+#ifndef _INPUT_READER_H
+#define _INPUT_READER_H
+
+
+OPEN_NS
+
+
+/// Receives the elements of one input array, in order.
+class InputArraySink
+{
+public:
+
+    /// @param idx the element index
+    /// @param comps the ints of the element
+    virtual void element (size_t idx, const std::vector<int> & comps)
+	throw (bad_arg_exception, std::exception) = 0;
+
+    virtual ~InputArraySink () {}
+};
+
+
+
+class InputReader
+{
+public:
+
+    InputReader (FILE * in);
+
+    /// Stream the list at this dotted path into 'sink' when read() gets to
+    /// it, instead of keeping it.
+    void add_array (const std::string & name, InputArraySink * sink);
+
+    /// Parse the whole input.
+    /// @throw bad_arg_exception on a syntax error, or from a sink
+    void read ()
+	throw (bad_arg_exception, std::exception);
+
+    /// the scalar input at a dotted path, if it was in the input.
+    boost::optional<int> find (const std::string & name) const;
+
+    /// the number of elements read for an array added with add_array(), or
+    /// none if it was not in the input.
+    boost::optional<size_t> array_length (const std::string & name) const;
+
+
+private:
+
+    /// parse a value, which is at 'path'
+    void read_value (const std::string & path)
+	throw (bad_arg_exception, std::exception);
+
+    /// parse a value into its ints, in order
+    void read_flat (std::vector<int> & o_ints)
+	throw (bad_arg_exception);
+
+    void read_record (const std::string & path)
+	throw (bad_arg_exception, std::exception);
+
+    void read_list (const std::string & path)
+	throw (bad_arg_exception, std::exception);
+
+    /// stream the list elements at 'path' into its sink
+    void read_array (const std::string & path, InputArraySink * sink)
+	throw (bad_arg_exception, std::exception);
+
+    int read_int ()
+	throw (bad_arg_exception);
+
+    std::string read_name ()
+	throw (bad_arg_exception);
+
+    /// skip white space, and return the next char without consuming it, EOF
+    /// at the end.
+    int peek ();
+
+    /// consume the next char, which has to be 'c'
+    void expect (char c)
+	throw (bad_arg_exception);
+
+    /// throw a bad_arg_exception with the current line
+    void syntax_error (const std::string & msg)
+	throw (bad_arg_exception);
+
+
+    FILE * _in;
+    unsigned _line;
+
+    std::map<std::string, int> _scalars;
+
+    std::map<std::string, InputArraySink*> _sinks;
+    std::map<std::string, size_t> _lengths;
+};
+
+
+CLOSE_NS
+
+
+#endif // _INPUT_READER_H
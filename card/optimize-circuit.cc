@@ -0,0 +1,1050 @@
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+*/
+
+
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#include <boost/optional/optional.hpp>
+
+#include <faerieplay/common/utils.h>
+#include <faerieplay/common/logging.h>
+
+#include "optimize-circuit.h"
+
+
+using std::vector;
+using std::map;
+using std::max;
+
+using boost::optional;
+
+
+namespace
+{
+    Log::logger_t logger = Log::makeLogger ("circuit-vm.card.optimize-circuit");
+}
+
+
+void renumber_gates (vector<gate_t> & gates,
+		     vector<int> & o_orig_nums)
+    throw (bad_arg_exception)
+{
+    index_t max_gate = 0;
+    FOREACH (g, gates) {
+	max_gate = max (max_gate, g->num);
+    }
+
+    // the new number of each old one
+    vector<int> new_num (max_gate+1, -1);
+    o_orig_nums.resize (gates.size());
+    
+    for (index_t i = 0; i < gates.size(); i++) {
+	new_num[gates[i].num] = i;
+	o_orig_nums[i] = gates[i].num;
+    }
+
+    FOREACH (g, gates) {
+	FOREACH (in, g->inputs) {
+	    if (*in < 0) {
+		continue;	// no input
+	    }
+	    
+	    if (unsigned (*in) > max_gate || new_num[*in] < 0) {
+		throw bad_arg_exception ("Gate " + itoa (g->num) +
+					 " has input gate " + itoa (*in) +
+					 ", which is not in the circuit");
+	    }
+	    *in = new_num[*in];
+	}
+	g->num = new_num[g->num];
+    }
+
+    LOG (Log::INFO, logger,
+	 "Renumbered " << gates.size() << " gates, highest gate number was "
+	 << max_gate);
+}
+
+
+
+namespace
+{
+    bool is_output (const gate_t & g)
+    {
+	return elem (gate_t::Output, g.flags);
+    }
+
+    
+    /// log2 of x if it is a power of 2 greater than 1, otherwise -1
+    int log2_exact (int x)
+    {
+	if (x < 2 || (x & (x-1)) != 0) {
+	    return -1;
+	}
+	int k = 0;
+	while (x > 1) {
+	    x >>= 1;
+	    k++;
+	}
+	return k;
+    }
+
+
+    /// Does this gate only produce 0, 1 or nil?
+    bool is_bool_valued (const gate_t & g)
+    {
+	switch (g.op.kind) {
+	case gate_t::BinOp:
+	    switch (g.op.params[0]) {
+	    case gate_t::Eq: case gate_t::LT: case gate_t::GT:
+	    case gate_t::LTEq: case gate_t::GTEq: case gate_t::NEq:
+	    case gate_t::And: case gate_t::Or:
+		return true;
+	    default:
+		return false;
+	    }
+	case gate_t::UnOp:
+	    return g.op.params[0] == gate_t::LNot;
+	case gate_t::Lit:
+	    return g.op.params[0] == 0 || g.op.params[0] == 1;
+	default:
+	    return false;
+	}
+    }
+    
+
+    /// The state of a simplify_circuit() pass: the gates written out so far,
+    /// and what is known about each gate number.
+    class Simplifier
+    {
+    public:
+
+	Simplifier (size_t num_gates)
+	    : removed_alias (0), folded (0), reduced (0)
+	    {
+		_out.reserve (num_gates);
+	    }
+
+	/// simplify a gate and add it to the output, unless it is replaced by
+	/// another one.
+	void add (gate_t g);
+
+	vector<gate_t> & out () { return _out; }
+
+	size_t removed_alias, folded, reduced;
+	
+    private:
+
+	optional<int> lit_val (int gate) const
+	    {
+		return gate >= 0 && unsigned (gate) < _lit.size() ?
+		    _lit[gate] : optional<int>();
+	    }
+
+	const gate_t * out_gate (int gate) const
+	    {
+		return gate >= 0 && unsigned (gate) < _pos.size() &&
+		    _pos[gate] >= 0 ?
+		    &_out[_pos[gate]] : NULL;
+	    }
+
+	/// the gate a BinOp, UnOp or Select can be replaced by, or -1
+	int alias_of (const gate_t & g) const;
+
+	/// the constant value of a BinOp or UnOp, if it has one
+	optional<int> fold (const gate_t & g) const;
+
+	template <class T>
+	static void set (vector<T> & v, index_t i, const T & x, const T & fill)
+	    {
+		if (v.size() <= i) {
+		    v.resize (i+1, fill);
+		}
+		v[i] = x;
+	    }
+	
+	vector<gate_t> _out;
+
+	/// the replacement of each removed gate, otherwise -1
+	vector<int> _alias;
+	/// the value of each Lit gate
+	vector< optional<int> > _lit;
+	/// index of each gate in _out, otherwise -1
+	vector<int> _pos;
+	/// a Lit gate for each value
+	map<int,int> _lit_gates;
+    };
+
+
+    optional<int> Simplifier::fold (const gate_t & g) const
+    {
+	if (g.op.kind == gate_t::BinOp) {
+	    optional<int> x = lit_val (g.inputs[0]), y = lit_val (g.inputs[1]);
+	    const gate_t::binop_t op = gate_t::binop_t (g.op.params[0]);
+	    
+	    if (x && y) {
+		// shifts out of range are undefined in C, so leave them for the
+		// runtime
+		if ((op == gate_t::SL || op == gate_t::SR) &&
+		    (*y < 0 || *y > 31))
+		{
+		    return optional<int>();
+		}
+		return do_bin_op (op, x, y);
+	    }
+	    
+	    // these have a result even with a nil input
+	    if (op == gate_t::And && ((x && *x == 0) || (y && *y == 0))) {
+		return 0;
+	    }
+	    if (op == gate_t::Or && ((x && *x == 1) || (y && *y == 1))) {
+		return 1;
+	    }
+	}
+	else if (g.op.kind == gate_t::UnOp) {
+	    optional<int> x = lit_val (g.inputs[0]);
+	    if (x) {
+		return do_un_op (gate_t::unop_t (g.op.params[0]), x);
+	    }
+	}
+
+	return optional<int>();
+    }
+
+
+    int Simplifier::alias_of (const gate_t & g) const
+    {
+	switch (g.op.kind) {
+	    
+	case gate_t::BinOp:
+	{
+	    const int a = g.inputs[0], b = g.inputs[1];
+	    optional<int> x = lit_val (a), y = lit_val (b);
+	    const gate_t * ga = out_gate (a), * gb = out_gate (b);
+
+	    // the identity element of each operator, on either side if it
+	    // commutes. A nil x gives nil in every case, as x would.
+	    switch (g.op.params[0]) {
+	    case gate_t::Plus: case gate_t::BOr: case gate_t::BXor:
+		if (y && *y == 0) return a;
+		if (x && *x == 0) return b;
+		break;
+	    case gate_t::Times:
+		if (y && *y == 1) return a;
+		if (x && *x == 1) return b;
+		break;
+	    case gate_t::BAnd:
+		if (y && *y == -1) return a;
+		if (x && *x == -1) return b;
+		break;
+	    case gate_t::Minus: case gate_t::SL: case gate_t::SR:
+		if (y && *y == 0) return a;
+		break;
+	    case gate_t::Div:
+		if (y && *y == 1) return a;
+		break;
+	    // the logical operators only for a boolean other input, eg. 5 && 1
+	    // is nil.
+	    case gate_t::And:
+		if (y && *y == 1 && ga && is_bool_valued (*ga)) return a;
+		if (x && *x == 1 && gb && is_bool_valued (*gb)) return b;
+		break;
+	    case gate_t::Or:
+		if (y && *y == 0 && ga && is_bool_valued (*ga)) return a;
+		if (x && *x == 0 && gb && is_bool_valued (*gb)) return b;
+		break;
+	    }
+	    break;
+	}
+
+	case gate_t::UnOp:
+	{
+	    // --x and ~~x, but not !!x, as !nil is 1
+	    const gate_t * in = out_gate (g.inputs[0]);
+	    if (in && in->op.kind == gate_t::UnOp &&
+		in->op.params[0] == g.op.params[0] &&
+		g.op.params[0] != gate_t::LNot)
+	    {
+		return in->inputs[0];
+	    }
+	    break;
+	}
+
+	case gate_t::Select:
+	{
+	    // a nil selector selects the second choice
+	    if (lit_val (g.inputs[0]) || g.inputs[1] == g.inputs[2]) {
+		optional<int> sel = lit_val (g.inputs[0]);
+		return sel && *sel ? g.inputs[1] : g.inputs[2];
+	    }
+	    break;
+	}
+
+	default:
+	    break;
+	}
+
+	return -1;
+    }
+
+
+    void Simplifier::add (gate_t g)
+    {
+	FOREACH (in, g.inputs) {
+	    if (*in >= 0 && unsigned (*in) < _alias.size() && _alias[*in] >= 0) {
+		*in = _alias[*in];
+	    }
+	}
+
+	if (!is_output (g)) {
+	    const int to = alias_of (g);
+	    if (to >= 0) {
+		set (_alias, g.num, to, -1);
+		removed_alias++;
+		return;
+	    }
+	}
+
+	optional<int> val = fold (g);
+	if (val) {
+	    g.op.kind = gate_t::Lit;
+	    g.op.params[0] = *val;
+	    g.inputs.clear();
+	    folded++;
+	}
+	else if (g.op.kind == gate_t::BinOp && g.op.params[0] == gate_t::Times) {
+	    // x * 2^k -> x << k, using an existing Lit for k, as a new gate would
+	    // cost more than the multiply saves.
+	    for (unsigned side = 0; side < 2; side++) {
+		optional<int> c = lit_val (g.inputs[side]);
+		const int k = c ? log2_exact (*c) : -1;
+		map<int,int>::const_iterator k_gate = _lit_gates.find (k);
+		
+		if (k > 0 && k_gate != _lit_gates.end()) {
+		    g.op.params[0] = gate_t::SL;
+		    g.inputs[0] = g.inputs[1-side];
+		    g.inputs[1] = k_gate->second;
+		    reduced++;
+		    break;
+		}
+	    }
+	}
+
+	if (g.op.kind == gate_t::Lit) {
+	    set (_lit, g.num, optional<int> (g.op.params[0]), optional<int>());
+	    _lit_gates.insert (std::make_pair (g.op.params[0], int (g.num)));
+	}
+
+	set (_pos, g.num, int (_out.size()), -1);
+	_out.push_back (g);
+    }
+}
+
+
+
+size_t simplify_circuit (vector<gate_t> & gates)
+{
+    Simplifier simp (gates.size());
+    
+    FOREACH (g, gates) {
+	simp.add (*g);
+    }
+
+    // drop the Lits nobody uses any more
+    vector<gate_t> & out = simp.out();
+    vector<unsigned> uses;
+    FOREACH (g, out) {
+	FOREACH (in, g->inputs) {
+	    if (*in >= 0) {
+		if (uses.size() <= unsigned (*in)) {
+		    uses.resize (*in + 1, 0);
+		}
+		uses[*in]++;
+	    }
+	}
+    }
+
+    vector<gate_t> kept;
+    kept.reserve (out.size());
+    FOREACH (g, out) {
+	if (g->op.kind == gate_t::Lit && !is_output (*g) &&
+	    (g->num >= uses.size() || uses[g->num] == 0))
+	{
+	    continue;
+	}
+	kept.push_back (*g);
+    }
+
+    const size_t removed = gates.size() - kept.size();
+    
+    LOG (Log::INFO, logger,
+	 "Simplified the circuit: " << simp.folded << " gates folded, "
+	 << simp.removed_alias << " replaced by an input, "
+	 << simp.reduced << " multiplies made shifts; "
+	 << removed << " of " << gates.size() << " gates removed");
+
+    gates.swap (kept);
+    return removed;
+}
+
+
+
+namespace
+{
+    bool is_commutative (gate_t::binop_t op)
+    {
+	switch (op) {
+	case gate_t::Plus: case gate_t::Times:
+	case gate_t::Eq: case gate_t::NEq:
+	case gate_t::And: case gate_t::Or:
+	case gate_t::BAnd: case gate_t::BOr: case gate_t::BXor:
+	    return true;
+	default:
+	    return false;
+	}
+    }
+
+    
+    /// The hash-consing key of a pure gate, which has to have its inputs
+    /// already renamed. Empty for the other gates.
+    vector<int> cse_key (const gate_t & g)
+    {
+	vector<int> key;
+	
+	// the number of op params used; the others may be unset
+	unsigned nparams;
+	switch (g.op.kind) {
+	case gate_t::BinOp:
+	case gate_t::UnOp:
+	case gate_t::Lit:
+	    nparams = 1;
+	    break;
+	case gate_t::Slicer:
+	    nparams = 2;
+	    break;
+	case gate_t::Select:
+	    nparams = 0;
+	    break;
+	case gate_t::Mux:
+	    nparams = 1;
+	    break;
+	default:
+	    return key;
+	}
+
+	key.push_back (g.op.kind);
+	key.insert (key.end(), g.op.params, g.op.params + nparams);
+	
+	key.push_back (g.typ.kind);
+	if (g.typ.kind == gate_t::Array) {
+	    key.insert (key.end(), g.typ.params, g.typ.params + 2);
+	}
+
+	const size_t first_in = key.size();
+	key.insert (key.end(), g.inputs.begin(), g.inputs.end());
+	
+	if (g.op.kind == gate_t::BinOp &&
+	    is_commutative (gate_t::binop_t (g.op.params[0])) &&
+	    key[first_in] > key[first_in+1])
+	{
+	    std::swap (key[first_in], key[first_in+1]);
+	}
+
+	return key;
+    }
+}
+
+
+size_t merge_common_gates (vector<gate_t> & gates)
+{
+    index_t max_gate = 0;
+    FOREACH (g, gates) {
+	max_gate = max (max_gate, g->num);
+    }
+
+    // the gate each merged gate was replaced by, otherwise -1
+    vector<int> alias (max_gate+1, -1);
+    map<vector<int>, int> first;
+
+    vector<gate_t> kept;
+    kept.reserve (gates.size());
+    
+    FOREACH (g, gates) {
+	FOREACH (in, g->inputs) {
+	    if (*in >= 0 && unsigned (*in) <= max_gate && alias[*in] >= 0) {
+		*in = alias[*in];
+	    }
+	}
+
+	const vector<int> key = cse_key (*g);
+	if (!key.empty()) {
+	    std::pair<map<vector<int>, int>::iterator, bool> ins =
+		first.insert (std::make_pair (key, int (g->num)));
+
+	    if (!ins.second && !is_output (*g)) {
+		alias[g->num] = ins.first->second;
+		continue;
+	    }
+	}
+	
+	kept.push_back (*g);
+    }
+
+    const size_t removed = gates.size() - kept.size();
+
+    LOG (Log::INFO, logger,
+	 "Merged " << removed << " duplicate gates of " << gates.size());
+
+    gates.swap (kept);
+    return removed;
+}
+
+
+size_t remove_dead_gates (vector<gate_t> & gates)
+{
+    index_t max_gate = 0;
+    FOREACH (g, gates) {
+	max_gate = max (max_gate, g->num);
+    }
+
+    // consumers come after their inputs, so one backward pass finds all the
+    // live gates.
+    vector<bool> live (max_gate+1, false);
+    for (vector<gate_t>::reverse_iterator g = gates.rbegin();
+	 g != gates.rend(); ++g)
+    {
+	const bool root = is_output (*g)		||
+	    g->op.kind == gate_t::ReadDynArray		||
+	    g->op.kind == gate_t::WriteDynArray		||
+	    g->op.kind == gate_t::InitDynArray		||
+	    g->op.kind == gate_t::Print			||
+	    (g->op.kind == gate_t::Input && g->typ.kind == gate_t::Array);
+
+	if (!root && !live[g->num]) {
+	    continue;
+	}
+	
+	live[g->num] = true;
+	FOREACH (in, g->inputs) {
+	    if (*in >= 0 && unsigned (*in) <= max_gate) {
+		live[*in] = true;
+	    }
+	}
+    }
+
+    vector<gate_t> kept;
+    kept.reserve (gates.size());
+    FOREACH (g, gates) {
+	if (live[g->num]) {
+	    kept.push_back (*g);
+	}
+    }
+
+    const size_t removed = gates.size() - kept.size();
+
+    LOG (Log::INFO, logger,
+	 "Removed " << removed << " dead gates of " << gates.size());
+
+    gates.swap (kept);
+    return removed;
+}
+
+
+
+size_t merge_select_chains (vector<gate_t> & gates)
+{
+    const size_t n = gates.size();
+    
+    index_t max_gate = 0;
+    FOREACH (g, gates) {
+	max_gate = max (max_gate, g->num);
+    }
+
+    vector<int> pos (max_gate+1, -1), uses (max_gate+1, 0);
+    for (index_t i = 0; i < n; i++) {
+	pos[gates[i].num] = i;
+	FOREACH (in, gates[i].inputs) {
+	    if (*in >= 0) {
+		uses[*in]++;
+	    }
+	}
+    }
+
+    // the Selects folded into a Mux. Only scalar ones, as array Selects are
+    // not supported by CircuitEval anyway.
+    vector<bool> merged (n, false);
+    size_t num_muxes = 0;
+    
+    // a chain ends at its last Select, which comes after the others, so a
+    // backward pass meets each chain at its end first.
+    for (int i = n - 1; i >= 0; i--)
+    {
+	if (merged[i] || gates[i].op.kind != gate_t::Select ||
+	    gates[i].typ.kind != gate_t::Scalar)
+	{
+	    continue;
+	}
+
+	vector<int> chain (1, i);
+	while (chain.size() < MAX_MUX_WAYS) {
+	    const int e = gates[chain.back()].inputs[2];
+	    if (e < 0) {
+		break;
+	    }
+	    const gate_t & eg = gates[pos[e]];
+	    if (eg.op.kind != gate_t::Select || eg.typ.kind != gate_t::Scalar ||
+		uses[e] != 1 || is_output (eg))
+	    {
+		break;
+	    }
+	    chain.push_back (pos[e]);
+	}
+
+	if (chain.size() < 2) {
+	    continue;
+	}
+
+	// the selectors, then the values, then the default
+	gate_t & g = gates[i];
+	vector<int> ins;
+	FOREACH (c, chain) {
+	    ins.push_back (gates[*c].inputs[0]);
+	}
+	FOREACH (c, chain) {
+	    ins.push_back (gates[*c].inputs[1]);
+	}
+	ins.push_back (gates[chain.back()].inputs[2]);
+
+	for (unsigned k = 1; k < chain.size(); k++) {
+	    merged[chain[k]] = true;
+	}
+
+	g.op.kind = gate_t::Mux;
+	g.op.params[0] = chain.size();
+	g.inputs.swap (ins);
+	num_muxes++;
+    }
+
+    vector<gate_t> kept;
+    kept.reserve (n);
+    for (index_t i = 0; i < n; i++) {
+	if (!merged[i]) {
+	    kept.push_back (gates[i]);
+	}
+    }
+
+    const size_t removed = n - kept.size();
+
+    LOG (Log::INFO, logger,
+	 "Merged " << removed + num_muxes << " Selects into " << num_muxes
+	 << " Mux gates");
+
+    gates.swap (kept);
+    return removed;
+}
+
+
+
+namespace
+{
+    /// For each step, the step which created the array it operates on or
+    /// returns, or -1: an InitDynArray or array Input gate. The array
+    /// descriptor input of an array operation is the array gate itself or a
+    /// Slicer of a ReadDynArray.
+    vector<int> find_array_roots (const vector<gate_t> & gates,
+				  const vector<int> & pos)
+    {
+	vector<int> array_of (gates.size(), -1);
+	
+	for (index_t i = 0; i < gates.size(); i++) {
+	    const gate_t & g = gates[i];
+	    switch (g.op.kind) {
+	    case gate_t::InitDynArray:
+		array_of[i] = i;
+		break;
+	    case gate_t::Input:
+		if (g.typ.kind == gate_t::Array) {
+		    array_of[i] = i;
+		}
+		break;
+	    case gate_t::ReadDynArray:
+	    case gate_t::WriteDynArray:
+		array_of[i] = array_of[pos[g.inputs[1]]];
+		break;
+	    case gate_t::Slicer:
+		array_of[i] = array_of[pos[g.inputs[0]]];
+		break;
+	    default:
+		break;
+	    }
+	}
+	return array_of;
+    }
+
+    
+    /// the average distance between a gate and its inputs, in circuit steps
+    double mean_input_distance (const vector<gate_t> & gates,
+				const vector<int> & pos)
+    {
+	double sum = 0;
+	size_t n = 0;
+	for (index_t i = 0; i < gates.size(); i++) {
+	    FOREACH (in, gates[i].inputs) {
+		if (*in >= 0) {
+		    sum += i - pos[*in];
+		    n++;
+		}
+	    }
+	}
+	return n > 0 ? sum / n : 0;
+    }
+
+
+    /// Orders the inputs of a gate by decreasing Sethi-Ullman number
+    struct by_need
+    {
+	by_need (const vector<int> & need) : need (need) {}
+	
+	bool operator() (int a, int b) const
+	    {
+		return need[a] > need[b];
+	    }
+	
+	const vector<int> & need;
+    };
+}
+
+
+void reorder_gates (vector<gate_t> & gates)
+{
+    const size_t n = gates.size();
+    
+    index_t max_gate = 0;
+    FOREACH (g, gates) {
+	max_gate = max (max_gate, g->num);
+    }
+
+    // the step of each gate number
+    vector<int> pos (max_gate+1, -1);
+    for (index_t i = 0; i < n; i++) {
+	pos[gates[i].num] = i;
+    }
+
+    // the dependencies of each step, as steps: the chain predecessor first, if
+    // any, then the inputs in decreasing order of need. The chains are the
+    // gates on one array, and the Output and Print gates.
+    vector< vector<int> > deps (n);
+    vector<int> need (n, 1);
+    vector<bool> consumed (n, false);
+    
+    const vector<int> array_of = find_array_roots (gates, pos);
+    map<int,int> last_on_array;
+    int last_effect = -1;
+
+    for (index_t i = 0; i < n; i++)
+    {
+	const gate_t & g = gates[i];
+
+	vector<int> ins;
+	FOREACH (in, g.inputs) {
+	    if (*in >= 0) {
+		ins.push_back (pos[*in]);
+		consumed[pos[*in]] = true;
+	    }
+	}
+	std::stable_sort (ins.begin(), ins.end(), by_need (need));
+
+	// the Sethi-Ullman number, treating the DAG as a tree
+	for (index_t k = 0; k < ins.size(); k++) {
+	    need[i] = max (need[i], need[ins[k]] + int (k));
+	}
+
+	// chain the operations on one array
+	int chain = -1;
+	if (g.op.kind == gate_t::ReadDynArray ||
+	    g.op.kind == gate_t::WriteDynArray)
+	{
+	    const int arr = array_of[i];
+	    if (arr >= 0) {
+		map<int,int>::iterator last = last_on_array.find (arr);
+		if (last != last_on_array.end()) {
+		    chain = last->second;
+		}
+		last_on_array[arr] = i;
+	    }
+	}
+
+	if (elem (gate_t::Output, g.flags) || g.op.kind == gate_t::Print) {
+	    if (chain < 0) {
+		chain = last_effect;
+	    }
+	    else if (last_effect >= 0) {
+		// on a chain already, so take the effect order as a plain input
+		ins.push_back (last_effect);
+		consumed[last_effect] = true;
+	    }
+	    last_effect = i;
+	}
+
+	if (chain >= 0) {
+	    deps[i].push_back (chain);
+	    consumed[chain] = true;
+	}
+	deps[i].insert (deps[i].end(), ins.begin(), ins.end());
+    }
+
+    const double dist_before = mean_input_distance (gates, pos);
+
+    // depth-first post-order from each gate nobody depends on, in circuit
+    // order. An explicit stack, as the circuits can be very deep.
+    vector<int> order;
+    order.reserve (n);
+    vector<bool> done (n, false);
+    vector< std::pair<int,unsigned> > stack;
+    
+    for (index_t root = 0; root < n; root++)
+    {
+	if (consumed[root]) {
+	    continue;
+	}
+
+	stack.push_back (std::make_pair (int (root), 0U));
+	while (!stack.empty())
+	{
+	    std::pair<int,unsigned> & top = stack.back();
+	    const int g = top.first;
+	    
+	    if (top.second < deps[g].size()) {
+		const int d = deps[g][top.second++];
+		if (!done[d]) {
+		    stack.push_back (std::make_pair (d, 0U));
+		}
+	    }
+	    else {
+		if (!done[g]) {
+		    done[g] = true;
+		    order.push_back (g);
+		}
+		stack.pop_back();
+	    }
+	}
+    }
+
+    assert (order.size() == n);
+
+    vector<gate_t> reordered;
+    reordered.reserve (n);
+    FOREACH (i, order) {
+	pos[gates[*i].num] = reordered.size();
+	reordered.push_back (gates[*i]);
+    }
+
+    LOG (Log::INFO, logger,
+	 "Reordered " << n << " gates, mean distance to the inputs went from "
+	 << dist_before << " to " << mean_input_distance (reordered, pos)
+	 << " steps");
+
+    gates.swap (reordered);
+}
+
+
+
+size_t cluster_array_reads (vector<gate_t> & gates)
+{
+    const size_t n = gates.size();
+    
+    index_t max_gate = 0;
+    FOREACH (g, gates) {
+	max_gate = max (max_gate, g->num);
+    }
+
+    vector<int> pos (max_gate+1, -1);
+    for (index_t i = 0; i < n; i++) {
+	pos[gates[i].num] = i;
+    }
+
+    const vector<int> array_of = find_array_roots (gates, pos);
+
+    // the open cluster of each array, by its first read
+    map<int,int> head_of;
+    // the reads moved up to each first read
+    map<int, vector<int> > members;
+    vector<bool> moved (n, false);
+    size_t num_moved = 0;
+    
+    for (index_t i = 0; i < n; i++)
+    {
+	gate_t & g = gates[i];
+	const int arr = array_of[i];
+
+	if (g.op.kind == gate_t::WriteDynArray) {
+	    head_of.erase (arr);
+	    continue;
+	}
+	if (g.op.kind != gate_t::ReadDynArray) {
+	    continue;
+	}
+
+	g.op.params[0] = 0;
+	
+	if (arr < 0 || elem (gate_t::Output, g.flags)) {
+	    continue;
+	}
+
+	// the last step the enable and index inputs come from. The array
+	// descriptor input is left out: all the descriptors of an array refer to
+	// the same ArrayHandle, so a read in a cluster takes the one of the first
+	// read.
+	const int last_in = max (g.inputs[0] >= 0 ? pos[g.inputs[0]] : -1,
+				 g.inputs[2] >= 0 ? pos[g.inputs[2]] : -1);
+
+	map<int,int>::iterator head = head_of.find (arr);
+	if (head != head_of.end() && last_in < head->second &&
+	    members[head->second].size() + 1 < MAX_READ_CLUSTER)
+	{
+	    g.inputs[1] = gates[head->second].inputs[1];
+	    members[head->second].push_back (i);
+	    moved[i] = true;
+	    num_moved++;
+	}
+	else {
+	    head_of[arr] = i;
+	}
+    }
+
+    vector<gate_t> clustered;
+    clustered.reserve (n);
+    size_t num_clusters = 0;
+    
+    for (index_t i = 0; i < n; i++) {
+	if (moved[i]) {
+	    continue;
+	}
+	clustered.push_back (gates[i]);
+
+	map<int, vector<int> >::const_iterator m = members.find (i);
+	if (m != members.end() && !m->second.empty()) {
+	    clustered.back().op.params[0] = m->second.size() + 1;
+	    FOREACH (j, m->second) {
+		clustered.push_back (gates[*j]);
+	    }
+	    num_clusters++;
+	}
+    }
+
+    LOG (Log::INFO, logger,
+	 "Clustered array reads: " << num_moved << " reads moved into "
+	 << num_clusters << " clusters");
+
+    gates.swap (clustered);
+    return num_moved;
+}
+
+
+
+size_t fuse_read_slicers (vector<gate_t> & gates)
+{
+    const size_t n = gates.size();
+    
+    index_t max_gate = 0;
+    FOREACH (g, gates) {
+	max_gate = max (max_gate, g->num);
+    }
+
+    vector<int> pos (max_gate+1, -1);
+    for (index_t i = 0; i < n; i++) {
+	pos[gates[i].num] = i;
+    }
+
+    // the consumers of every read, and whether they are all non-Output
+    // Slicers
+    vector<vector<int> > users (n);
+    vector<bool> fusable (n, true);
+    for (index_t i = 0; i < n; i++) {
+	const gate_t & g = gates[i];
+	const bool movable = g.op.kind == gate_t::Slicer &&
+	    !elem (gate_t::Output, g.flags);
+	
+	FOREACH (in, g.inputs) {
+	    if (*in < 0) {
+		continue;
+	    }
+	    const int p = pos[*in];
+	    if (gates[p].op.kind == gate_t::ReadDynArray) {
+		users[p].push_back (i);
+		fusable[p] = fusable[p] && movable;
+	    }
+	}
+    }
+
+    // the Slicers go after the last read of a cluster
+    vector<int> anchor (n);
+    for (index_t i = 0; i < n; i++) {
+	anchor[i] = i;
+	const gate_t & g = gates[i];
+	if (g.op.kind == gate_t::ReadDynArray && g.op.params[0] > 1) {
+	    const index_t end = std::min (n, i + g.op.params[0]);
+	    for (index_t j = i; j < end; j++) {
+		anchor[j] = end - 1;
+	    }
+	    i = end - 1;
+	}
+    }
+    
+    map<int, vector<int> > after;
+    vector<bool> moved (n, false);
+    size_t num_fused = 0;
+    
+    for (index_t i = 0; i < n; i++) {
+	gate_t & g = gates[i];
+	if (g.op.kind != gate_t::ReadDynArray) {
+	    continue;
+	}
+	
+	g.op.params[1] = 0;
+	if (!fusable[i] || users[i].empty() || elem (gate_t::Output, g.flags)) {
+	    continue;
+	}
+	
+	g.op.params[1] = users[i].size();
+	FOREACH (u, users[i]) {
+	    after[anchor[i]].push_back (*u);
+	    moved[*u] = true;
+	}
+	num_fused++;
+    }
+
+    vector<gate_t> fused;
+    fused.reserve (n);
+    
+    for (index_t i = 0; i < n; i++) {
+	if (!moved[i]) {
+	    fused.push_back (gates[i]);
+	}
+
+	map<int, vector<int> >::const_iterator a = after.find (i);
+	if (a != after.end()) {
+	    FOREACH (s, a->second) {
+		fused.push_back (gates[*s]);
+	    }
+	}
+    }
+
+    LOG (Log::INFO, logger,
+	 "Fused " << num_fused << " array reads with their Slicers");
+
+    gates.swap (fused);
+    return num_fused;
+}
@@ -0,0 +1,112 @@
+// -*- c++ -*-
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+ */
+
+// Rewriting passes over a parsed circuit, which prep runs before writing the
+// containers. The gates stay in circuit (topological) order, and the passes
+// keep the circuit's outputs and array access pattern unchanged.
+
+#include <vector>
+
+#include <faerieplay/common/exceptions.h>
+
+#include <common/gate.h>
+
+
+#ifndef _OPTIMIZE_CIRCUIT_H
+#define _OPTIMIZE_CIRCUIT_H
+
+
+/// Renumber the gates densely, from 0 in circuit order, and rewrite the input
+/// references to match, so that the gates and values containers have no empty
+/// slots.
+/// @param o_orig_nums the original number of every new gate number, so that
+///	LOGVALS traces can report it.
+void renumber_gates (std::vector<gate_t> & gates,
+		     std::vector<int> & o_orig_nums)
+    throw (bad_arg_exception);
+
+
+/// Fold the constant parts of the circuit and apply algebraic identities, with
+/// the nil semantics of do_bin_op() and do_un_op():
+/// - gates with all-Lit inputs and a non-nil result become Lits,
+/// - identities like x+0, x*1, x<<0, x&&0, --x and Selects with a constant
+///   selector or equal choices are replaced by their result gate,
+/// - x*2^k becomes x<<k if there is a Lit k already.
+/// Output gates are kept. Lits left with no consumers are dropped.
+/// @return how many gates were removed
+size_t simplify_circuit (std::vector<gate_t> & gates);
+
+
+/// Merge identical pure gates (BinOp, UnOp, Lit, Slicer and Select) by
+/// hash-consing on the operation, its parameters and the input gates, with the
+/// inputs of commutative operators in a canonical order. The consumers of a
+/// duplicate are given the first such gate instead. Output gates are kept.
+/// @return how many gates were removed
+size_t merge_common_gates (std::vector<gate_t> & gates);
+
+
+/// Remove the gates whose values cannot reach an Output gate or an array
+/// operation, by a backward sweep from those. Array gates and Print gates are
+/// always kept, as they have side effects.
+/// @return how many gates were removed
+size_t remove_dead_gates (std::vector<gate_t> & gates);
+
+
+/// the most selectors in one Mux gate
+const unsigned MAX_MUX_WAYS = 32;
+
+/// Replace chains of scalar Select gates, where each Select is the second
+/// choice of the next one and has no other use, as from an if/else-if ladder,
+/// by one Mux gate. The Mux takes the value of the first selector which is
+/// true, and the default value if none is. A nil selector counts as false, as
+/// in a Select.
+/// @return how many gates were removed
+size_t merge_select_chains (std::vector<gate_t> & gates);
+
+
+/// Reorder the circuit to bring the producers of values close to their
+/// consumers, and keep fewer values live at a time: each gate with no
+/// consumers pulls in the gates it depends on depth first, Sethi-Ullman
+/// style, with the input needing the most live values first. The operations
+/// on one array, and the Output and Print gates, keep their relative order.
+void reorder_gates (std::vector<gate_t> & gates);
+
+
+/// the most ReadDynArray gates in one cluster
+const unsigned MAX_READ_CLUSTER = 32;
+
+/// Move independent ReadDynArray gates on the same array next to each other,
+/// so the runtime can serve each cluster with one scan of the array's working
+/// area. A read joins the cluster of an earlier read on its array if its
+/// enable and index inputs come before that read, and there is no write to
+/// the array between them. It then takes the array descriptor input of the
+/// first read, which refers to the same array. The first read of a cluster
+/// gets the cluster size in op.params[0], and the others follow it directly;
+/// the other reads get 0.
+/// @return how many reads were moved into clusters
+size_t cluster_array_reads (std::vector<gate_t> & gates);
+
+
+/// Mark the ReadDynArray gates whose value is only used by Slicers, such as
+/// the fields of a struct element, so the runtime keeps the value in card
+/// memory for the Slicers instead of writing it to the value store. The number
+/// of Slicers goes into op.params[1] of the read, 0 for the other reads, and
+/// the Slicers are moved right after the read, or after the end of its read
+/// cluster. Reads with an Output Slicer, which cannot move, are left alone.
+/// @return how many reads were marked
+size_t fuse_read_slicers (std::vector<gate_t> & gates);
+
+
+#endif // _OPTIMIZE_CIRCUIT_H
@@ -0,0 +1,317 @@
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+*/
+
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <utility>
+#include <algorithm>
+
+#include <faerieplay/common/utils.h>
+#include <faerieplay/common/logging.h>
+#include <faerieplay/common/exceptions.h>
+
+#include <pir/card/io_flat.h>
+
+#include <common/gate.h>
+
+#include "utils.h"
+#include "partition-circuit.h"
+
+
+using namespace std;
+
+
+namespace
+{
+    Log::logger_t logger = Log::makeLogger ("circuit-vm.card.partition-circuit");
+
+    /// how many gate owners (one byte each) in an object of the owners
+    /// container
+    const size_t OWNERS_BLOCK = 128;
+
+    /// owner byte for gate numbers not in the circuit
+    const byte NO_OWNER = 0xFF;
+
+    
+    /// union-find over gate numbers, to group the gates which must be in the
+    /// same partition
+    class gate_groups
+    {
+    public:
+	gate_groups (size_t n)
+	    : _parent (n)
+	    {
+		for (index_t i=0; i < n; i++) {
+		    _parent[i] = i;
+		}
+	    }
+
+	index_t find (index_t x)
+	    {
+		while (_parent[x] != x) {
+		    // path halving
+		    _parent[x] = _parent[_parent[x]];
+		    x = _parent[x];
+		}
+		return x;
+	    }
+
+	void join (index_t a, index_t b)
+	    {
+		a = find (a);
+		b = find (b);
+		if (a != b) {
+		    _parent[b] = a;
+		}
+	    }
+
+    private:
+	vector<index_t> _parent;
+    };
+}
+
+
+
+void partition_circuit (const vector<gate_t> & gates,
+			unsigned max_gate,
+			unsigned nparts,
+			circuit_partition_t & o_part)
+    throw (bad_arg_exception)
+{
+    if (nparts < 1 || nparts > MAX_PARTITIONS) {
+	ostringstream os;
+	os << "Number of partitions must be between 1 and " << MAX_PARTITIONS;
+	throw bad_arg_exception (os.str());
+    }
+
+    const size_t N = max_gate + 1;
+    
+    vector<const gate_t*> by_num (N, static_cast<const gate_t*>(NULL));
+    FOREACH (g, gates) {
+	by_num[g->num] = &*g;
+    }
+
+    //
+    // group together all the gates on an array: the array pointer input of
+    // array reads and writes, anything else consuming an array value, and the
+    // Slicers of a read, one of which may take out the array descriptor for
+    // the next operation (as in find_array_roots() in optimize-circuit.cc).
+    //
+    gate_groups groups (N);
+    FOREACH (g, gates) {
+	for (unsigned i=0; i < g->inputs.size(); i++) {
+	    const int in = g->inputs[i];
+	    if (in < 0 || unsigned(in) >= N || by_num[in] == NULL) {
+		continue;
+	    }
+
+	    const bool array_ptr_input =
+		i == 1 && (g->op.kind == gate_t::ReadDynArray ||
+			   g->op.kind == gate_t::WriteDynArray);
+	    const bool read_slicer =
+		g->op.kind == gate_t::Slicer &&
+		by_num[in]->op.kind == gate_t::ReadDynArray;
+	    
+	    if (array_ptr_input || read_slicer ||
+		by_num[in]->typ.kind == gate_t::Array)
+	    {
+		groups.join (in, g->num);
+	    }
+	}
+    }
+
+    vector<size_t> group_weight (N, 0);
+    FOREACH (g, gates) {
+	group_weight[groups.find (g->num)]++;
+    }
+
+    //
+    // assign groups in circuit order, with the linear deterministic greedy
+    // rule: go to the partition with most of the gate's inputs, weighted by
+    // how much room the partition has left.
+    //
+    const double capacity = 1.05 * gates.size() / nparts + 1;
+    
+    vector<size_t> loads (nparts, 0);
+    vector<int> group_owner (N, -1);
+    
+    o_part.owner.assign (N, -1);
+    o_part.steps.assign (nparts, vector<part_step_t>());
+    o_part.cut_edges = 0;
+
+    for (index_t s = 0; s < gates.size(); s++)
+    {
+	const gate_t & g = gates[s];
+	const index_t grp = groups.find (g.num);
+
+	if (group_owner[grp] < 0)
+	{
+	    vector<unsigned> nbrs (nparts, 0);
+	    FOREACH (in, g.inputs) {
+		if (*in >= 0 && unsigned(*in) < N && o_part.owner[*in] >= 0) {
+		    nbrs[o_part.owner[*in]]++;
+		}
+	    }
+
+	    int best = -1;
+	    double best_score = 0;
+	    for (unsigned p = 0; p < nparts; p++)
+	    {
+		if (loads[p] + group_weight[grp] > capacity) {
+		    continue;
+		}
+		// the +1 sends gates without placed inputs to the emptiest
+		// partition
+		double score = (nbrs[p] + 1) * (1 - loads[p] / capacity);
+		if (best < 0 || score > best_score) {
+		    best = p;
+		    best_score = score;
+		}
+	    }
+
+	    // a group too big to fit anywhere goes to the emptiest partition
+	    if (best < 0) {
+		best = min_element (loads.begin(), loads.end()) - loads.begin();
+	    }
+
+	    group_owner[grp] = best;
+	    loads[best] += group_weight[grp];
+	}
+
+	o_part.owner[g.num] = group_owner[grp];
+    }
+
+    //
+    // now the steps, and which partitions need each value
+    //
+    vector<uint32_t> send_mask (N, 0);
+    FOREACH (g, gates) {
+	const int mine = o_part.owner[g->num];
+	FOREACH (in, g->inputs) {
+	    if (*in < 0 || unsigned(*in) >= N || o_part.owner[*in] < 0) {
+		continue;
+	    }
+
+	    const uint32_t bit = 1U << mine;
+	    if (o_part.owner[*in] != mine && !(send_mask[*in] & bit)) {
+		send_mask[*in] |= bit;
+		o_part.cut_edges++;
+	    }
+	}
+    }
+
+    for (index_t s = 0; s < gates.size(); s++) {
+	const gate_t & g = gates[s];
+	part_step_t step = { s, send_mask[g.num] };
+	o_part.steps[o_part.owner[g.num]].push_back (step);
+    }
+
+    for (unsigned p = 0; p < nparts; p++) {
+	LOG (Log::INFO, logger,
+	     "Partition " << p << ": " << o_part.steps[p].size() << " gates");
+	
+	if (o_part.steps[p].empty()) {
+	    ostringstream os;
+	    os << "Circuit too small to split into " << nparts << " partitions";
+	    throw bad_arg_exception (os.str());
+	}
+    }
+
+    LOG (Log::INFO, logger,
+	 "Partitioned " << gates.size() << " gates into " << nparts
+	 << " partitions, with " << o_part.cut_edges << " cut edges");
+}
+
+
+
+string partition_steps_cont (const string & cct_name, unsigned part)
+{
+    return cct_name + DIRSEP + "part-" + itoa(part) + "-steps";
+}
+
+string partition_owners_cont (const string & cct_name)
+{
+    return cct_name + DIRSEP + "part-owners";
+}
+
+
+
+void write_partition (const circuit_partition_t & part,
+		      const string & cct_name,
+		      CryptoProviderFactory * crypto_fact)
+    throw (better_exception)
+{
+    for (unsigned p = 0; p < part.steps.size(); p++)
+    {
+	const vector<part_step_t> & steps = part.steps[p];
+	
+	FlatIO io (partition_steps_cont (cct_name, p),
+		   Just (make_pair (steps.size(), sizeof(part_step_t))));
+	add_encrypt_filter (io, crypto_fact);
+
+	vector<index_t> idxs (steps.size());
+	obj_list_t objs (steps.size());
+	for (index_t i = 0; i < steps.size(); i++) {
+	    idxs[i] = i;
+	    objs[i] = ByteBuffer (&steps[i], sizeof(steps[i]),
+				  ByteBuffer::deepcopy());
+	}
+	io.write (idxs, objs);
+    }
+
+    // the owners, packed one byte per gate.
+    const size_t num_blocks = (part.owner.size() + OWNERS_BLOCK - 1) / OWNERS_BLOCK;
+    
+    FlatIO io (partition_owners_cont (cct_name),
+	       Just (make_pair (num_blocks, OWNERS_BLOCK)));
+    add_encrypt_filter (io, crypto_fact);
+
+    for (index_t b = 0; b < num_blocks; b++) {
+	ByteBuffer block (OWNERS_BLOCK);
+	block.set (NO_OWNER);
+	for (index_t i = 0;
+	     i < OWNERS_BLOCK && b*OWNERS_BLOCK + i < part.owner.size();
+	     i++)
+	{
+	    const int owner = part.owner[b*OWNERS_BLOCK + i];
+	    block.data()[i] = owner < 0 ? NO_OWNER : byte(owner);
+	}
+	io.write (b, block);
+    }
+}
+
+
+
+void read_partition_owners (const string & cct_name,
+			    CryptoProviderFactory * crypto_fact,
+			    vector<int> & o_owner)
+    throw (better_exception)
+{
+    FlatIO io (partition_owners_cont (cct_name), boost::none);
+    add_encrypt_filter (io, crypto_fact);
+
+    o_owner.clear();
+    o_owner.reserve (io.getLen() * OWNERS_BLOCK);
+    
+    for (index_t b = 0; b < io.getLen(); b++) {
+	ByteBuffer block;
+	io.read (b, block);
+	for (index_t i = 0; i < block.len(); i++) {
+	    o_owner.push_back (block.data()[i] == NO_OWNER ?
+			       -1 : block.data()[i]);
+	}
+    }
+}
@@ -0,0 +1,99 @@
+// -*- c++ -*-
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+ */
+
+// Splitting a circuit between several cvm worker processes.
+//
+// Every gate is owned by one partition (worker), which evaluates it and sends
+// its value to the other partitions which consume it. All the gates operating
+// on one array are owned by the same partition, as array descriptors and array
+// state live inside one process.
+
+#include <vector>
+#include <string>
+
+#include <stdint.h>
+
+#include <pir/common/sym_crypto.h>
+
+#include <common/gate.h>
+
+
+#ifndef _PARTITION_CIRCUIT_H
+#define _PARTITION_CIRCUIT_H
+
+
+/// we use a 32-bit mask of the partitions a gate value is sent to
+const unsigned MAX_PARTITIONS = 32;
+
+
+/// one step for a partition to run
+struct part_step_t
+{
+    /// index into CCT_CONT
+    uint32_t step;
+    /// bit p set if partition p needs the value of this gate
+    uint32_t send_mask;
+};
+
+
+struct circuit_partition_t
+{
+    /// the owning partition of each gate, indexed by gate number. -1 for gate
+    /// numbers not in the circuit.
+    std::vector<int> owner;
+
+    /// for each partition, the steps it runs, in circuit order.
+    std::vector< std::vector<part_step_t> > steps;
+
+    /// how many gate values cross between partitions
+    size_t cut_edges;
+};
+
+
+/// Split the circuit into 'nparts' partitions of roughly equal gate count,
+/// trying to keep the number of cut edges low.
+/// @param gates all the gates in circuit (topological) order.
+void partition_circuit (const std::vector<gate_t> & gates,
+			unsigned max_gate,
+			unsigned nparts,
+			circuit_partition_t & o_part)
+    throw (bad_arg_exception);
+
+
+/// Write the partitioning into the per-partition step containers and the
+/// owners container, under the circuit name. They are MAC'ed and encrypted.
+void write_partition (const circuit_partition_t & part,
+		      const std::string & cct_name,
+		      CryptoProviderFactory * crypto_fact)
+    throw (better_exception);
+
+
+/// Read back the owners table written by write_partition()
+void read_partition_owners (const std::string & cct_name,
+			    CryptoProviderFactory * crypto_fact,
+			    std::vector<int> & o_owner)
+    throw (better_exception);
+
+
+/// name of the container with the steps for partition 'part'.
+std::string partition_steps_cont (const std::string & cct_name,
+				  unsigned part);
+
+
+/// name of the container with the gate owners table.
+std::string partition_owners_cont (const std::string & cct_name);
+
+
+#endif // _PARTITION_CIRCUIT_H
@@ -0,0 +1,340 @@
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+*/
+
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>		// min, sort
+
+#include <faerieplay/common/utils.h>
+#include <faerieplay/common/logging.h>
+#include <pir/common/sym_crypto.h>
+#include <pir/card/io_flat.h>
+
+#include "utils.h"
+#include "path-oram.h"
+
+
+// no encrypt/mac on the tree containers, as in array.cc
+// #define NO_ENCRYPT
+
+
+using std::string;
+using std::vector;
+using std::map;
+using std::pair;
+using std::make_pair;
+using std::min;
+
+using boost::optional;
+
+
+namespace
+{
+    Log::logger_t logger = Log::makeLogger ("circuit-vm.card.path-oram");
+
+    /// how many slots to fill, or elements to read, with one list read or
+    /// write
+    const size_t CHUNK = 256;
+
+    /// A stash this big is very unlikely with Z=4 (the probability falls
+    /// exponentially with the size), so worth a warning.
+    const size_t STASH_WARN = 128;
+}
+
+
+OPEN_NS
+
+
+PathOram::PathOram (const string& name,
+		    size_t N, size_t elem_size,
+		    CryptoProviderFactory * prov_fact)
+    throw (better_exception)
+    : _name	    (name),
+      N		    (N),
+      _elem_size    (elem_size),
+      _L	    (lgN_ceil (N)),
+      _leaves	    (size_t (1) << _L),
+      _idxs	    (_name + DIRSEP + "oram-idxs",
+		     Just (make_pair ((2*_leaves - 1) * Z, sizeof(index_t)))),
+      _items	    (_name + DIRSEP + "oram-items",
+		     Just (make_pair ((2*_leaves - 1) * Z, elem_size))),
+      _pos	    (N),
+      _rand_prov    (prov_fact->getRandProvider())
+{
+#ifndef NO_ENCRYPT
+    add_encrypt_filter (_idxs,  prov_fact);
+    add_encrypt_filter (_items, prov_fact);
+#endif
+
+    LOG (Log::INFO, logger,
+	 "Path ORAM " << _name << " for " << N << " elements has "
+	 << _leaves << " leaves, " << _idxs.getLen() << " slots");
+}
+
+
+void PathOram::build ()
+    throw (better_exception)
+{
+    // all slots empty
+    const size_t slots = _idxs.getLen();
+    ByteBuffer zero (_elem_size);
+    zero.set (0);
+
+    for (index_t s = 0; s < slots; s += CHUNK) {
+	const size_t n = min (CHUNK, slots - s);
+
+	vector<index_t> where (n);
+	for (index_t k = 0; k < n; k++) {
+	    where[k] = s + k;
+	}
+	_idxs.write  (where, obj_list_t (n, basic2bb (index_t (N))));
+	_items.write (where, obj_list_t (n, zero));
+    }
+
+    for (index_t i = 0; i < N; i++) {
+	_pos[i] = _rand_prov->randint (_leaves);
+    }
+}
+
+
+/// what build_subtree() needs as it goes along
+struct PathOram::build_state_t
+{
+    build_state_t (FlatIO & from, const TwoWayPermutation & perm)
+	: from (from), perm (perm), next (0), chunk_start (0)
+	{}
+
+    FlatIO & from;
+    const TwoWayPermutation & perm;
+
+    /// the leaf of each shuffled element, in order
+    vector<index_t> leaves;
+
+    /// the next shuffled element, and the ones read so far
+    index_t next, chunk_start;
+    obj_list_t chunk;
+
+    /// bucket slots waiting to be written
+    vector<index_t> slots;
+    obj_list_t idxbufs, items;
+};
+
+
+void PathOram::build (FlatIO & shuffled, const TwoWayPermutation & perm)
+    throw (better_exception)
+{
+    LOG (Log::PROGRESS, logger,
+	 "Building Path ORAM " << _name << " from " << N
+	 << " shuffled elements of " << shuffled.getName());
+
+    build_state_t st (shuffled, perm);
+
+    // Sorted independent uniform leaves, given out in the shuffled order, are
+    // independent and uniform for each element, as the shuffle is secret.
+    st.leaves.resize (N);
+    for (index_t q = 0; q < N; q++) {
+	st.leaves[q] = _rand_prov->randint (_leaves);
+    }
+    std::sort (st.leaves.begin(), st.leaves.end());
+
+    // what does not fit even in the root goes in the stash
+    elem_list_t rest = build_subtree (0, 0, st);
+    FOREACH (e, rest) {
+	_stash[e->first] = e->second;
+    }
+
+    if (!st.slots.empty()) {
+	_idxs.write  (st.slots, st.idxbufs);
+	_items.write (st.slots, st.items);
+    }
+
+    LOG (Log::INFO, logger,
+	 "Path ORAM " << _name << " built, stash has " << _stash.size()
+	 << " elements");
+}
+
+
+PathOram::elem_list_t
+PathOram::build_subtree (unsigned level, index_t node, build_state_t & st)
+    throw (better_exception)
+{
+    elem_list_t elems;
+
+    if (level == _L) {
+	// a leaf: its elements are next in the shuffled container
+	while (st.next < N && st.leaves[st.next] == node) {
+	    if (st.next == st.chunk_start + st.chunk.size()) {
+		st.chunk_start = st.next;
+		const size_t n = min (CHUNK, N - st.next);
+		vector<index_t> which (n);
+		for (index_t k = 0; k < n; k++) {
+		    which[k] = st.next + k;
+		}
+		st.from.read (which, st.chunk);
+	    }
+
+	    const index_t idx = st.perm.d (st.next);
+	    _pos[idx] = node;
+	    elems.push_back (make_pair (idx, st.chunk[st.next - st.chunk_start]));
+	    st.next++;
+	}
+    }
+    else {
+	elems = build_subtree (level+1, 2*node, st);
+	elem_list_t right = build_subtree (level+1, 2*node + 1, st);
+	elems.insert (elems.end(), right.begin(), right.end());
+    }
+
+    // everything left from below is on a path through this bucket
+    const index_t b = (index_t (1) << level) + node - 1;
+    ByteBuffer zero (_elem_size);
+    zero.set (0);
+
+    for (index_t s = 0; s < Z; s++) {
+	st.slots.push_back (b * Z + s);
+	if (!elems.empty()) {
+	    st.idxbufs.push_back (basic2bb (elems.back().first));
+	    st.items.push_back   (elems.back().second);
+	    elems.pop_back();
+	}
+	else {
+	    st.idxbufs.push_back (basic2bb (index_t (N)));
+	    st.items.push_back   (zero);
+	}
+    }
+
+    if (st.slots.size() >= CHUNK) {
+	_idxs.write  (st.slots, st.idxbufs);
+	_items.write (st.slots, st.items);
+	st.slots.clear();
+	st.idxbufs.clear();
+	st.items.clear();
+    }
+
+    return elems;
+}
+
+
+ByteBuffer PathOram::access (index_t idx,
+			     const optional <pair<size_t, ByteBuffer> >& new_val)
+    throw (better_exception)
+{
+    assert (idx < N);
+
+    const index_t leaf = _pos[idx];
+    _pos[idx] = _rand_prov->randint (_leaves);
+
+    read_path (leaf);
+
+    map<index_t, ByteBuffer>::iterator e = _stash.find (idx);
+    if (e == _stash.end()) {
+	// not written since the tree was made
+	ByteBuffer zero (_elem_size);
+	zero.set (0);
+	e = _stash.insert (make_pair (idx, zero)).first;
+    }
+
+    ByteBuffer val (e->second, ByteBuffer::deepcopy());
+
+    if (new_val) {
+	// splice in the new value at the given offset, as with the
+	// square-root scheme.
+	ByteBuffer towrite (e->second, ByteBuffer::deepcopy());
+	bbcopy (towrite, new_val->second, new_val->first);
+	e->second = towrite;
+    }
+
+    write_path (leaf);
+
+    if (_stash.size() > STASH_WARN) {
+	LOG (Log::WARN, logger,
+	     "Path ORAM " << _name << " stash has grown to " << _stash.size()
+	     << " elements");
+    }
+
+    return val;
+}
+
+
+void PathOram::path_slots (index_t leaf, vector<index_t> & o_slots) const
+{
+    o_slots.clear();
+    for (unsigned level = 0; level <= _L; level++) {
+	const index_t b = bucket (leaf, level);
+	for (index_t s = 0; s < Z; s++) {
+	    o_slots.push_back (b * Z + s);
+	}
+    }
+}
+
+
+void PathOram::read_path (index_t leaf)
+    throw (better_exception)
+{
+    vector<index_t> slots;
+    path_slots (leaf, slots);
+
+    obj_list_t idxbufs, items;
+    _idxs.read  (slots, idxbufs);
+    _items.read (slots, items);
+
+    for (index_t k = 0; k < slots.size(); k++) {
+	const index_t idx = bb2basic<index_t> (idxbufs[k]);
+	if (idx < N) {
+	    _stash[idx] = items[k];
+	}
+    }
+}
+
+
+void PathOram::write_path (index_t leaf)
+    throw (better_exception)
+{
+    vector<index_t> slots;
+    path_slots (leaf, slots);
+
+    ByteBuffer zero (_elem_size);
+    zero.set (0);
+    obj_list_t idxbufs (slots.size(), basic2bb (index_t (N))),
+	items (slots.size(), zero);
+
+    // from the leaf up, so each element goes as deep as its own path allows
+    for (unsigned level = _L + 1; level-- > 0; )
+    {
+	const index_t b = bucket (leaf, level);
+
+	size_t s = 0;
+	for (map<index_t, ByteBuffer>::iterator e = _stash.begin();
+	     e != _stash.end() && s < Z; )
+	{
+	    if (bucket (_pos[e->first], level) == b) {
+		const index_t k = level * Z + s++;
+		idxbufs[k] = basic2bb (e->first);
+		items[k]   = e->second;
+		_stash.erase (e++);
+	    }
+	    else {
+		++e;
+	    }
+	}
+    }
+
+    _idxs.write  (slots, idxbufs);
+    _items.write (slots, items);
+}
+
+
+CLOSE_NS
@@ -0,0 +1,151 @@
+// -*- c++ -*-
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+ */
+
+// A Path ORAM (Stefanov et al., CCS 2013) for the elements of an Array, as an
+// alternative to its square-root scheme for large arrays: each access reads
+// and writes one path of a binary tree of buckets on the host, O(lg N)
+// objects, and there is no reshuffle. The stash and the position map are kept
+// in card memory.
+//
+// The tree is built in one pass, writing every bucket once in a fixed order.
+// For initial elements, they first have to be in a random order, given by an
+// oblivious shuffle of their container: the shuffled elements are given a
+// sorted list of random leaves, which makes each element's leaf independent
+// and uniform, and lets the buckets be filled bottom up while the container
+// is read in order.
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>		// auto_ptr
+#include <utility>		// pair
+
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>	// boost::noncopyable
+#include <boost/optional/optional.hpp>
+
+#include <faerieplay/common/utils.h>
+#include <pir/common/sym_crypto.h>
+#include <pir/card/io_flat.h>
+#include <pir/card/permutation.h>
+
+
+#ifndef _PATH_ORAM_H
+#define _PATH_ORAM_H
+
+
+OPEN_NS
+
+
+class PathOram : boost::noncopyable
+{
+public:
+
+    /// Set up the bucket tree containers for N elements. One of the build()
+    /// calls has to come next.
+    /// @param name the container name prefix, as for an Array
+    PathOram (const std::string& name,
+	      size_t N, size_t elem_size,
+	      CryptoProviderFactory * prov_fact)
+	throw (better_exception);
+
+    /// Build the tree with all elements empty, which read as all zeroes.
+    void build ()
+	throw (better_exception);
+
+    /// Build the tree from the elements of a flat container which has been
+    /// shuffled, so that element i is at perm.p(i). The container is read
+    /// once, in order, and every bucket written once.
+    void build (FlatIO & shuffled, const TwoWayPermutation & perm)
+	throw (better_exception);
+
+    /// Read, and maybe write, one element, hiding which one.
+    /// @param new_val an offset and value to splice into the element, or none
+    ///	to just read it. The access looks the same either way.
+    /// @return the value of the element before any write
+    ByteBuffer access (index_t idx,
+		       const boost::optional <std::pair<size_t, ByteBuffer> >&
+		       new_val)
+	throw (better_exception);
+
+    size_t stash_size () const
+	{
+	    return _stash.size();
+	}
+
+
+    /// the number of slots per bucket
+    static const size_t Z = 4;
+
+
+private:
+
+    typedef std::vector<std::pair<index_t, ByteBuffer> > elem_list_t;
+
+    struct build_state_t;
+
+    /// Build the subtree under the bucket at 'level' which is number 'node'
+    /// of its level, in post-order, from the next elements of the shuffled
+    /// container.
+    /// @return the elements which did not fit, to go higher up
+    elem_list_t build_subtree (unsigned level, index_t node,
+			       build_state_t & st)
+	throw (better_exception);
+
+    /// the tree bucket at 'level' (0 is the root) on the path to 'leaf'
+    index_t bucket (index_t leaf, unsigned level) const
+	{
+	    return ((leaf + _leaves) >> (_L - level)) - 1;
+	}
+
+    /// the slot indices of the path to 'leaf', root first
+    void path_slots (index_t leaf, std::vector<index_t> & o_slots) const;
+
+    /// move the elements on the path to 'leaf' into the stash
+    void read_path (index_t leaf)
+	throw (better_exception);
+
+    /// write the path to 'leaf' back, with as many stash elements as fit, as
+    /// far down as they can go
+    void write_path (index_t leaf)
+	throw (better_exception);
+
+
+    std::string _name;
+
+    size_t N, _elem_size;
+
+    /// the tree has 2^_L leaves, and _L+1 levels
+    unsigned _L;
+    size_t _leaves;
+
+    /// the element index in each slot, N for an empty slot, and the elements.
+    /// Slot s of bucket b is at b*Z + s.
+    FlatIO _idxs, _items;
+
+    /// the leaf of each element's path
+    std::vector<index_t> _pos;
+
+    /// elements read from the tree and not yet written back, by index
+    std::map<index_t, ByteBuffer> _stash;
+
+    std::auto_ptr<RandProvider> _rand_prov;
+};
+
+
+CLOSE_NS
+
+
+#endif // _PATH_ORAM_H
@@ -23,6 +23,7 @@
 #include <utility>
 
 #include <boost/optional/optional.hpp>
+#include <boost/shared_ptr.hpp>
 
 //#include <pir/host/objio.h>
 #include <faerieplay/common/utils.h>
@@ -30,16 +31,24 @@
 
 #include <pir/card/configs.h>
 #include <pir/card/io_flat.h>
+#include <pir/card/io_filter_encrypt.h>
 #include <faerieplay/common/logging.h>
 
 #include <common/consts-sfdl.h>
 #include <common/gate.h>
 #include <common/misc.h>
 
-#include <json/get-path.h>
-// #include <json/bnfc/Parser.H>
-
 #include "array.h"
+#include "bitslice.h"
+#include "circuit-cache.h"
+#include "cvm-options.h"
+#include "input-reader.h"
+#include "optimize-circuit.h"
+#include "partition-circuit.h"
+#include "prep-circuit.h"
+#include "utils.h"
+#include "value-store.h"
+#include "value-width.h"
 
 // for stdin. wanted to use cstdio here, but it does not define std::stdin
 // apparently.
@@ -50,8 +59,13 @@ using namespace std;
 
 using pir::Array;
 using pir::ArrayHandle;
+using pir::CircuitCache;
+using pir::InputReader;
+using pir::ValueLayout;
+using pir::ValueStore;
 
 using boost::optional;
+using boost::shared_ptr;
 
 
 
@@ -69,73 +83,273 @@ namespace
 
 
 
-/// Convenience function to find an input array, squash it, and thrown an
-/// exception if it is missing.
 namespace
 {
-    vector< vector<int> > get_input_array (PathFinder & in_data,
-					   const vector<string>& path)
+    /// Find the value of a scalar input gate, and throw an exception if it is
+    /// missing.
+    /// @return the value, as an optional<int> ByteBuffer
+    ByteBuffer get_scalar_input (const InputReader & in_data,
+				 const gate_t & gate)
 	throw (bad_arg_exception)
     {
-	optional<vector<Value*> > opt_list = in_data.findList (path);
+	const string& input_name = gate.comment;
+	
+	LOG (Log::INFO, logger,
+	     "Obtaining scalar input " << input_name
+	     << " for gate " << gate.num);
+
+	optional<int> val = in_data.find (input_name);
+	if (!val) {
+	    const string msg = "Could not locate input named '" + input_name;
+	    LOG (Log::CRIT, logger, msg);
+	    throw bad_arg_exception (msg);
+	}
+		
+	return optBasic2bb<int> (val);
+    }
+}
+
+
 
-	if (!opt_list) {
-	    string name;
-	    for (unsigned i=0; i<path.size(); ++i) {
-		name += path[i] + ".";
+//
+// Support for incremental re-evaluation (cvm_options_t::incremental)
+//
+namespace
+{
+    /// Does this gate produce or operate on an array? Array descriptors are
+    /// only valid within one cvm process, and array gates have to produce the
+    /// same access pattern on every run, so they are never skipped.
+    bool is_array_gate (const gate_t & g)
+    {
+	return g.typ.kind == gate_t::Array		||
+	    g.op.kind == gate_t::ReadDynArray		||
+	    g.op.kind == gate_t::WriteDynArray		||
+	    g.op.kind == gate_t::InitDynArray;
+    }
+    
+
+    /// Work out which circuit steps have to be run again when the gates in
+    /// 'changed' have new values: the dependency cone of those gates, plus the
+    /// Output gates so that all the outputs are still printed.
+    /// @param gates all the gates, in circuit order
+    /// @param o_steps the steps (indices into 'gates') to run, in order
+    /// @return false if the whole circuit has to be run, ie. if the cone
+    /// touches an array gate, or there are array inputs or outputs.
+    bool find_dirty_steps (const vector<gate_t> & gates,
+			   unsigned max_gate,
+			   const vector<index_t> & changed,
+			   vector<index_t> & o_steps)
+    {
+	// the consumers of each gate's value
+	vector< vector<index_t> > consumers (max_gate+1);
+	FOREACH (g, gates) {
+	    FOREACH (in, g->inputs) {
+		if (*in >= 0) {
+		    consumers[*in].push_back (g->num);
+		}
 	    }
-	    throw bad_arg_exception ("Could not find the input array named "
-				     + name + " in the input data provided");
 	}
 
-	return PathFinder::squashList (*opt_list);
+	// mark the forward cone of the changed gates
+	vector<bool> dirty (max_gate+1, false);
+	vector<index_t> work (changed);
+	FOREACH (c, changed) {
+	    dirty[*c] = true;
+	}
+	
+	while (!work.empty()) {
+	    index_t g = work.back();
+	    work.pop_back();
+	    
+	    FOREACH (c, consumers[g]) {
+		if (!dirty[*c]) {
+		    dirty[*c] = true;
+		    work.push_back (*c);
+		}
+	    }
+	}
+
+	for (index_t i=0; i < gates.size(); i++)
+	{
+	    const gate_t & g = gates[i];
+	    const bool is_output = elem (gate_t::Output, g.flags);
+	    
+	    if (is_array_gate (g) &&
+		(dirty[g.num] || g.op.kind == gate_t::Input || is_output))
+	    {
+		LOG (Log::INFO, logger,
+		     "Array gate " << g.num << " needs evaluation, "
+		     "will re-run the whole circuit");
+		return false;
+	    }
+
+	    if (dirty[g.num] || is_output) {
+		o_steps.push_back (i);
+	    }
+	}
+
+	return !o_steps.empty();
+    }
+
+
+    /// Is this scalar input public (see cvm_options_t::public_inputs)?
+    bool is_public_input (const string & name)
+    {
+	std::istringstream names (g_cvm_options.public_inputs);
+	string pub;
+	while (getline (names, pub, ',')) {
+	    if (!pub.empty() &&
+		(name == pub || name.compare (0, pub.size() + 1, pub + ".") == 0))
+	    {
+		return true;
+	    }
+	}
+	return false;
     }
-}
-					   
 
-const size_t CONTAINER_OBJ_SIZE = 128;
+    
+    /// Try to set up an incremental run: open the value store from the
+    /// previous run of this circuit, check that it is the one that run left,
+    /// for this same circuit, and write in the public scalar inputs which have
+    /// changed, and all the private ones.
+    /// @param layout the value layout of this circuit, which must match the
+    /// previous one.
+    /// @param cct_key the circuit_mac() of this circuit
+    /// @param o_values the value store, if returning true.
+    /// @param o_steps the circuit steps to run, if returning true.
+    /// @return false if there is no usable previous run, or the whole circuit
+    /// needs to be run anyway. In that case nothing has been written.
+    bool prepare_incremental (const vector<gate_t> & gates,
+			      unsigned max_gate,
+			      const ValueLayout & layout,
+			      const InputReader & in_vals,
+			      const string & cct_name,
+			      const ByteBuffer & cct_key,
+			      CryptoProviderFactory * crypto_fact,
+			      shared_ptr<ValueStore> & o_values,
+			      vector<index_t> & o_steps)
+	throw (bad_arg_exception, better_exception)
+    {
+	shared_ptr<ValueStore> store;
+	try
+	{
+	    store.reset (new ValueStore (cct_name, crypto_fact));
+	}
+	catch (const better_exception & ex)
+	{
+	    LOG (Log::INFO, logger,
+		 "No values from a previous run (" << ex.what()
+		 << "), doing a full run");
+	    return false;
+	}
 
+	// the stored table may be padded
+	const vector<int> & old_table = store->table(),
+	    & new_table = layout.table();
+	if (old_table.size() < new_table.size() ||
+	    !std::equal (new_table.begin(), new_table.end(), old_table.begin()))
+	{
+	    LOG (Log::INFO, logger,
+		 "Value layout from the previous run is different,"
+		 " doing a full run");
+	    return false;
+	}
 
-int prepare_gates_container (istream & gates_in,
-			     const string& cct_name,
-			     CryptoProviderFactory * crypto_fact)
-    throw (io_exception, bad_arg_exception,  std::exception)
-{
+	// the host could have kept older values, or ones from another run, and
+	// the circuit could have changed with the same layout
+	if (!store->check_digest (cct_name, cct_key, crypto_fact)) {
+	    LOG (Log::WARN, logger,
+		 "Values on the host are not the ones the last run of this"
+		 " circuit left, doing a full run");
+	    return false;
+	}
+	
+	// compare the public scalar inputs to the previous ones. The private
+	// ones count as changed, whatever their values.
+	vector<index_t> changed;
+	obj_list_t changed_vals;
+	unsigned num_private = 0;
+	
+	FOREACH (g, gates) {
+	    if (g->op.kind != gate_t::Input || g->typ.kind != gate_t::Scalar) {
+		continue;
+	    }
 
-    string line;
-    unsigned gate_num = 0;
-    unsigned max_gate = 0;
-    ostringstream gate;
-    vector< pair<index_t,string> > gates;
+	    ByteBuffer val = get_scalar_input (in_vals, *g), old;
 
-    ByteBuffer zeros (CONTAINER_OBJ_SIZE);
-    zeros.set (0);
+	    if (!is_public_input (g->comment)) {
+		changed.push_back (g->num);
+		changed_vals.push_back (val);
+		num_private++;
+		continue;
+	    }
 
-    string
-	cct_cont    = cct_name + DIRSEP + CCT_CONT,
-	gates_cont  = cct_name + DIRSEP + GATES_CONT,
-	values_cont = cct_name + DIRSEP + VALUES_CONT;
+	    store->read (g->num, old);
 
+	    if (old.len() != val.len() ||
+		memcmp (old.data(), val.data(), val.len()) != 0)
+	    {
+		LOG (Log::INFO, logger,
+		     "Input " << g->comment << " at gate " << g->num
+		     << " has changed");
+		changed.push_back (g->num);
+		changed_vals.push_back (val);
+	    }
+	}
 
-    // read in all the gates
-    while (true) {
-	    
-	// get the gate number
-	if (gates_in >> gate_num) {
-	    gate << gate_num << endl;
-	    max_gate = max (max_gate, gate_num);
-	    
-	    // finish off this line
-	    getline (gates_in, line);
-	    LOG (Log::DEBUG, logger,
-		 "gate " << gate_num);
+	if (!find_dirty_steps (gates, max_gate, changed, o_steps)) {
+	    o_steps.clear();
+	    return false;
 	}
-	else if (gates_in.eof()) {
-	    break;		// done
+	
+	LOG (Log::INFO, logger,
+	     changed.size() - num_private << " public inputs changed; with the "
+	     << num_private << " private inputs, need to run "
+	     << o_steps.size() << " of " << gates.size() << " gates");
+
+	for (unsigned i = 0; i < changed.size(); i++) {
+	    store->write (changed[i], changed_vals[i]);
 	}
-	else {
-	    // probably just a blank line
-	    continue;
+
+	o_values = store;
+	return true;
+    }
+}
+					   
+
+namespace
+{
+    // how many objects to collect for each list write into the containers
+    const size_t PREP_BATCH = 256;
+    
+
+    /// Read the text of the next gate from the circuit file.
+    /// @return false at the end of the file
+    bool read_gate_text (istream & gates_in,
+			 unsigned & o_num, string & o_text)
+    {
+	string line;
+	ostringstream gate;
+	
+	while (true) {
+	    
+	    // get the gate number
+	    if (gates_in >> o_num) {
+		gate << o_num << endl;
+	    
+		// finish off this line
+		getline (gates_in, line);
+		LOG (Log::DEBUG, logger,
+		     "gate " << o_num);
+		break;
+	    }
+	    else if (gates_in.eof()) {
+		return false;	// done
+	    }
+	    else {
+		// probably just a blank line
+		continue;
+	    }
 	}
 	    
 	/// and the rest of the gate lines
@@ -148,111 +362,143 @@ int prepare_gates_container (istream & gates_in,
 	LOG (Log::DEBUG, logger,
 	     "gate done");
 
-	gates.push_back ( make_pair (gate_num, gate.str()) );
-	    
-	gate.str("");
+	o_text = gate.str();
+	return true;
     }
-	
-    LOG (Log::PROGRESS, logger,
-	 "Done reading circuit");
-    
 
 
-    // create and fill in the containers
-    
-    FlatIO
-	io_cct	    (cct_cont,
-		     Just (make_pair (gates.size(), CONTAINER_OBJ_SIZE))),
-	io_gates    (gates_cont,
-		     Just (make_pair (max_gate+1, CONTAINER_OBJ_SIZE))),
-	io_values   (values_cont,
-		     Just (make_pair (max_gate+1, CONTAINER_OBJ_SIZE)));
-    
-    LOG (Log::INFO, logger,
-	 "cct_cont size=" << gates.size()
-	 << "; gates_cont size=" << max_gate + 1);
-
-
-    // prepare the input extractor, from stdin. This will throw an exception on
-    // a parse error.
-    PathFinder in_vals (stdin);
-
-    LOG (Log::PROGRESS, logger, "Parsed inputs from stdin");
+    /// Collects writes to a container, and does them as list writes of
+    /// PREP_BATCH objects.
+    class batched_writer
+    {
+    public:
+	
+	batched_writer (FlatIO & io)
+	    : _io (io)
+	    {}
 
-    index_t i = 0;
-    FOREACH (g, gates) {
-	gate_t gate = unserialize_gate (g->second);
+	void write (index_t idx, const ByteBuffer & obj)
+	    {
+		_idxs.push_back (idx);
+		_objs.push_back (obj);
+		
+		if (_idxs.size() >= PREP_BATCH) {
+		    flush ();
+		}
+	    }
 
-	LOG (Log::DEBUG, logger,
-	     "Processing gate number " << gate.num);
+	/// write out what is collected so far. Has to be called after the last
+	/// write().
+	void flush ()
+	    {
+		if (!_idxs.empty()) {
+		    _io.write (_idxs, _objs);
+		    _idxs.clear();
+		    _objs.clear();
+		}
+	    }
 
-	if (gate.op.kind == gate_t::Input) {
+    private:
+	
+	FlatIO & _io;
+	
+	vector<index_t> _idxs;
+	obj_list_t _objs;
+    };
 
-	    //
-	    // get the input
-	    //
-	    const string& input_name = gate.comment;
-	    const vector<string> input_path = split (".", input_name);
-	    
-	    switch (gate.typ.kind)
-	    {
-	    case gate_t::Scalar:
+    
+    /// Writes an input array into its own container, under the name in the
+    /// gate comment, as InputReader streams in its elements. The elements are
+    /// written PREP_BATCH at a time, and every element is written once, so the
+    /// container is not filled with nulls first.
+    class input_array_loader : public pir::InputArraySink
+    {
+    public:
+
+	input_array_loader (const gate_t & gate,
+			    CryptoProviderFactory * crypto_fact)
+	    : _name	    (gate.comment),
+	      _length	    (gate.typ.params[0]),
+	      _elem_size    (gate.typ.params[1]),
+	      _num_components (_elem_size / OPT_BB_SIZE(int)),
+	      // NOTE: use the gate comment for the array's name, the runtime
+	      // has to do the same. The Array object encrypts before writing
+	      // out.
+	      _arr	    (_name,
+			     Just (make_pair (_length, _elem_size)),
+			     crypto_fact,
+			     false),
+	      _done	    (false)
 	    {
-		LOG (Log::INFO, logger,
-		     "Obtaining scalar input " << input_name
-		     << " for gate " << gate.num);
-
-		optional<int> val = in_vals.find (input_path);
-		if (!val) {
-		    const string msg = "Could not locate input named '" + input_name;
-		    LOG (Log::CRIT, logger, msg);
-		    throw bad_arg_exception (msg);
-		}
-		
-		ByteBuffer val_buf = optBasic2bb<int> (val);
-		
-		LOG (Log::INFO, logger,
-		     "writing " << val_buf.len() << " byte input value");
-		
-		io_values.write (gate.num, val_buf);
+		assert (((void) "Element size must be a multiple of the byte "
+			 "size of optional<int>",
+			 _elem_size % OPT_BB_SIZE(int) == 0));
 	    }
-	    break;
 
-	    case gate_t::Array:
+	
+	void element (size_t idx, const vector<int> & comps)
+	    throw (bad_arg_exception, std::exception)
 	    {
-		size_t length	= gate.typ.params[0],
-		    elem_size	= gate.typ.params[1];
+		// extra elements are left out, finish() reports them
+		if (idx >= _length) {
+		    return;
+		}
+		
+		// ASSUME: the array elements, per the SFDL program, are all
+		// 32-bit integers, or structs of them. We do not supported
+		// nested arrays currently.
+		if (comps.size() != _num_components) {
+		    ostringstream os;
+		    os << "The input provided for array " << _name
+		       << " element " << idx
+		       << " should have " << _num_components
+		       << " components, but actually has "
+		       << comps.size() << ends;
+		    throw bad_arg_exception (os.str());
+		}
 
-		// NOTE: use the gate comment for the array's name, the runtime
-		// has to do the same.
-		const string& arr_cont_name = input_name;
+		ByteBuffer ins_buf (_elem_size);
+		for (unsigned i=0; i < _num_components; i++)
+		{
+		    // an alias at the correct offset of ins_buf
+		    ByteBuffer member (ins_buf,
+				       i*OPT_BB_SIZE(int),
+				       OPT_BB_SIZE(int));
+		    int val = comps[i];
+		    makeOptBBJust (member, &val, sizeof (val));
+		}
 
-		string in_str;
+		LOG (Log::DEBUG, logger,
+		     "Writing element " << idx << " of array " << _arr.name());
 		
-		const size_t num_components = elem_size / OPT_BB_SIZE(int);
+		write (idx, ins_buf);
+	    }
 
-		// create the Array object to use to write. It will encrypt
-		// before writing out.
-		Array arr (arr_cont_name,
-			   Just (make_pair (length, elem_size)),
-			   crypto_fact);
 
-		assert (((void) "Element size must be a multiple of the byte size "
-			 "of optional<int>",
-			 elem_size % OPT_BB_SIZE(int) == 0));
-		    
-		//
-		// collect all the values from the input data object.
-		//
+	/// Check the length of the input read, and fill in nil values for the
+	/// missing elements.
+	/// @param read_len the number of elements in the input, none if the
+	/// array was not there
+	void finish (const optional<size_t> & read_len)
+	    throw (bad_arg_exception, std::exception)
+	    {
+		if (_done) {
+		    return;
+		}
+		_done = true;
 		
-		vector <vector<int> > vals =
-		    get_input_array (in_vals, input_path);
-
-		if (vals.size() != length) {
+		if (!read_len) {
+		    throw bad_arg_exception ("Could not find the input array "
+					     "named " + _name +
+					     " in the input data provided");
+		}
+		
+		if (*read_len != _length) {
 		    ostringstream os;
-		    os << "The input provided for array " << input_name
-		       << " should have " << length << " elements, but actually has "
-		       << vals.size() << ends;
+		    os << "The input provided for array " << _name
+		       << " should have " << _length
+		       << " elements, but actually has "
+		       << *read_len << ends;
 // TODO: make this a runtime check, based on some cmd line param or env
 // variable.
 #if STRICT_INPUT_ARRAY_LEN
@@ -262,85 +508,486 @@ int prepare_gates_container (istream & gates_in,
 			 os.str() << ", will use nil for the missing values");
 #endif
 		}
-		
-		for (unsigned l_i = 0; l_i < length; l_i++)
-		{
-		    
-		    // ASSUME: the array elements, per the SFDL program, are all
-		    // 32-bit integers, or structs of them. We do not supported
-		    // nested arrays currently.
-
-		    if (l_i < vals.size() && vals[l_i].size() != num_components) {
-			ostringstream os;
-			os << "The input provided for array " << input_name
-			   << " element " << l_i
-			   << " should have " << num_components
-			   << " components, but actually has "
-			   << vals[i].size() << ends;
-			throw bad_arg_exception (os.str());
-		    }
-		    
-		    // get all the array element components, or nil's if we have
-		    // run out of input elements.
-		    ByteBuffer ins_buf (elem_size);
-		    for (unsigned i=0; i < num_components; i++)
-		    {
-			ByteBuffer member(OPT_BB_SIZE(int));
-
-			// if we have no more input values
-			if (l_i >= vals.size()) {
-			    // insert nil values
-			    makeOptBBNothing (member);
-			}
-			else {
-			    // insert bytes for the i'th component into the buffer
-			    // for the l_i'th array element.
-			    int * val = & vals[l_i][i];
-			    makeOptBBJust (member, val, sizeof (*val));
-			
-			    LOG (Log::DEBUG, logger,
-				 "Writing int " << (*val)
-				 << ", bytebuffer " << member
-				 << " at idx " << l_i << " of array " << arr.name());
-			}
-			    
-			// an alias at the correct offset of ins_buf
-			ByteBuffer member_dest (ins_buf,
-						i*OPT_BB_SIZE(int),
-						OPT_BB_SIZE(int));
-			
-			bbcopy (member_dest, member);
-		    }
-
-		    // write the array value into the array container
-		    arr.write_clear (l_i, 0, ins_buf);
+
+		ByteBuffer nil_buf (_elem_size);
+		for (unsigned i=0; i < _num_components; i++) {
+		    ByteBuffer member (nil_buf,
+				       i*OPT_BB_SIZE(int),
+				       OPT_BB_SIZE(int));
+		    makeOptBBNothing (member);
+		}
+		for (size_t l_i = *read_len; l_i < _length; l_i++) {
+		    write (l_i, nil_buf);
 		}
 
-		// and write a blank value of the right size into the values
-		// table. the runtime will load a handle to the array and provide
-		// that handle as the actual value for this gate.
-                io_values.write (gate.num,
-				 ByteBuffer (sizeof(ArrayHandle::des_t)));
+		flush ();
+	    }
+
+    private:
+
+	/// add an element to the batch, and write out a full batch
+	void write (index_t idx, const ByteBuffer & val)
+	    {
+		_idxs.push_back (idx);
+		_vals.push_back (val);
+
+		if (_idxs.size() >= PREP_BATCH) {
+		    flush ();
+		}
+	    }
+
+	void flush ()
+	    {
+		if (!_idxs.empty()) {
+		    _arr.write_clear (_idxs, _vals);
+		    _idxs.clear();
+		    _vals.clear();
+		}
+	    }
+
+	const string _name;
+	const size_t _length, _elem_size, _num_components;
+	
+	Array _arr;
+	bool _done;
+
+	vector<index_t> _idxs;
+	obj_list_t _vals;
+    };
+
+    /// the loaders of the input arrays, by name
+    typedef map<string, shared_ptr<input_array_loader> > array_loaders_t;
+
+    
+    /// Parse the inputs from stdin, streaming the input arrays of
+    /// 'array_inputs' into their containers on the way.
+    /// @param o_loaders the loaders, to be finished by write_input()
+    void read_inputs (InputReader & in_vals,
+		      const vector<gate_t> & array_inputs,
+		      array_loaders_t & o_loaders,
+		      CryptoProviderFactory * crypto_fact)
+	throw (bad_arg_exception, std::exception)
+    {
+	FOREACH (g, array_inputs) {
+	    shared_ptr<input_array_loader> & l = o_loaders[g->comment];
+	    if (!l) {
+		l.reset (new input_array_loader (*g, crypto_fact));
+		in_vals.add_array (g->comment, l.get());
+	    }
+	}
+
+	// This will throw an exception on a parse error.
+	in_vals.read ();
+
+	LOG (Log::PROGRESS, logger, "Parsed inputs from stdin");
+    }
+
+
+    /// the prep options which change the prepared circuit, for
+    /// circuit_mac()
+    string prep_variant ()
+    {
+	return string (g_cvm_options.optimize ? "optimize," : "") +
+	    (g_cvm_options.reorder ? "reorder," : "") +
+	    (g_cvm_options.renumber ? "renumber," : "") +
+	    (g_cvm_options.batch_reads ? "batch_reads," : "") +
+	    (g_cvm_options.fuse_reads ? "fuse_reads" : "");
+    }
+
+    
+    bool is_array_input (const gate_t & gate)
+    {
+	return gate.op.kind == gate_t::Input && gate.typ.kind == gate_t::Array;
+    }
+    
+
+    /// Write the value of an Input gate: a scalar into the value store. An
+    /// array was written into its own container by its loader while the input
+    /// was read, and is checked and completed here.
+    void write_input (const gate_t & gate,
+		      const InputReader & in_vals,
+		      const array_loaders_t & loaders,
+		      ValueStore & values)
+	throw (bad_arg_exception, std::exception)
+    {
+	switch (gate.typ.kind)
+	{
+	case gate_t::Scalar:
+	{
+	    ByteBuffer val_buf = get_scalar_input (in_vals, gate);
+		
+	    LOG (Log::INFO, logger,
+		 "writing " << val_buf.len() << " byte input value");
 		
-	    } // end case Array:
+	    values.write (gate.num, val_buf);
+	}
+	break;
+
+	case gate_t::Array:
+	    // the runtime will load a handle to the array and provide that
+	    // handle as the actual value for this gate.
+	    loaders.find (gate.comment)->second->finish (
+		in_vals.array_length (gate.comment));
 	    break;
 
-	    } // end switch (gate.typ.kind)
+	} // end switch (gate.typ.kind)
+    }
+
+    /// Set up a run of a circuit found in the cache: only the values and the
+    /// input arrays are prepared. The Input gates are read from the cached
+    /// gates container.
+    void prepare_from_cache (const CircuitCache & cache,
+			     const string & cct_name,
+			     CryptoProviderFactory * crypto_fact)
+	throw (bad_arg_exception, std::exception)
+    {
+	const pir::cct_cache_info_t & info = cache.info();
+	
+	FlatIO io_gates (cache.dir() + DIRSEP + GATES_CONT, boost::none);
+
+	vector<gate_t> inputs, array_inputs;
+	FOREACH (in, info.input_gates) {
+	    ByteBuffer buf;
+	    io_gates.read (*in, buf);
+	    
+	    inputs.push_back (unserialize_gate (string (buf.cdata(), buf.len())));
+	    if (is_array_input (inputs.back())) {
+		array_inputs.push_back (inputs.back());
+	    }
+	}
+
+	InputReader in_vals (stdin);
+	array_loaders_t loaders;
+	read_inputs (in_vals, array_inputs, loaders, crypto_fact);
+
+	ValueStore values (cct_name,
+			   ValueLayout (info.value_table, info.value_elem_sizes),
+			   crypto_fact);
+
+	FOREACH (g, inputs) {
+	    write_input (*g, in_vals, loaders, values);
+	}
+    }
+}
+					   
+
+
+int prepare_gates_container (istream & gates_in,
+			     const string& cct_name,
+			     CryptoProviderFactory * crypto_fact,
+			     incremental_prep_t * o_incremental,
+			     string * o_cct_dir)
+    throw (io_exception, bad_arg_exception,  std::exception)
+{
+
+    unsigned gate_num = 0;
+    unsigned max_gate = 0;
+    size_t num_gates = 0;
+    size_t max_gate_len = 0;
+    string gate_text;
+
+    // The first pass over the circuit file finds the number of gates, the
+    // highest gate number and the longest gate, for the container sizes, and
+    // the size of every gate's value. The parsed gates are only kept if a pass
+    // over the whole circuit graph is needed, and the gate text is only kept if
+    // the file cannot be read again. Otherwise the second pass writes the gates
+    // as it reads them, so memory use does not grow much with the circuit.
+    // When the circuit is rewritten (see optimize-circuit.h), the gates are
+    // written from the rewritten ones instead.
+    const bool rewrite = g_cvm_options.optimize || g_cvm_options.reorder ||
+	g_cvm_options.renumber || g_cvm_options.batch_reads ||
+	g_cvm_options.fuse_reads;
+
+    // these options write tables for CircuitEval from the whole graph
+    const bool run_tables = g_cvm_options.incremental ||
+	g_cvm_options.partitions > 1 ||
+	g_cvm_options.bitslice || g_cvm_options.narrow;
+    
+    const bool keep_parsed = run_tables || rewrite;
+
+    const istream::pos_type start = gates_in.tellg();
+    const bool rereadable = start != istream::pos_type (-1);
 
-	} // end if (gate.op.kind == gate_t::Input)
+    if (o_incremental) {
+	*o_incremental = incremental_prep_t ();
+    }
+    if (o_cct_dir) {
+	*o_cct_dir = cct_name;
+    }
+
+    // look for the circuit in the cache of prepared circuits. A circuit not
+    // found is prepared into its cache slot.
+    shared_ptr<CircuitCache> cache;
+    if (g_cvm_options.cct_cache && !run_tables && rereadable && o_cct_dir) {
+	cache.reset (new CircuitCache (gates_in, prep_variant(), crypto_fact));
+	*o_cct_dir = cache->dir();
+	
+	if (cache->hit()) {
+	    prepare_from_cache (*cache, cct_name, crypto_fact);
+	    return cache->info().max_gate;
+	}
+    }
+
+    // the values of an incremental run are tied to the circuit which made
+    // them. The file has to be read twice for that.
+    ByteBuffer cct_key;
+    if (g_cvm_options.incremental && g_cvm_options.partitions <= 1 &&
+	o_incremental)
+    {
+	if (rereadable) {
+	    uint64_t len;
+	    cct_key = pir::circuit_mac (gates_in, prep_variant(), len,
+					crypto_fact);
+	}
 	else {
-	    // we should enter something into the values container
-	    io_values.write (gate.num, zeros);
+	    LOG (Log::WARN, logger,
+		 "Cannot re-read the circuit file to MAC it, so its values"
+		 " will not be kept for an incremental run");
+	}
+    }
+
+    const string cct_dir = cache ? cache->dir() : cct_name;
+    const string
+	cct_cont    = cct_dir + DIRSEP + CCT_CONT,
+	gates_cont  = cct_dir + DIRSEP + GATES_CONT;
+    
+    // for the cache
+    pir::cct_cache_info_t cache_info;
+
+    vector<gate_t> parsed;
+    vector<string> gate_texts;
+    ValueLayout layout;
+
+    // the input arrays are loaded while the inputs are read, before the
+    // second pass. The rewriting passes keep them, and their names.
+    vector<gate_t> array_inputs;
+    
+    while (read_gate_text (gates_in, gate_num, gate_text)) {
+	num_gates++;
+	max_gate = max (max_gate, gate_num);
+	max_gate_len = max (max_gate_len, gate_text.size());
+
+	const gate_t gate = unserialize_gate (gate_text);
+	layout.add (gate);
+
+	if (is_array_input (gate)) {
+	    array_inputs.push_back (gate);
 	}
+	if (keep_parsed) {
+	    parsed.push_back (gate);
+	}
+	if (!rereadable && !rewrite) {
+	    gate_texts.push_back (gate_text);
+	}
+    }
+	
+    LOG (Log::PROGRESS, logger,
+	 "Done reading circuit, " << num_gates << " gates");
+
+    if (rereadable) {
+	gates_in.clear();
+	gates_in.seekg (start);
+    }
+
+    // rewrite the parsed circuit, and redo the sizes and the value layout
+    vector<int> orig_nums;
+    if (rewrite) {
+	if (g_cvm_options.optimize) {
+	    size_t removed = simplify_circuit (parsed);
+	    removed += merge_common_gates (parsed);
+	    removed += remove_dead_gates (parsed);
+	    removed += merge_select_chains (parsed);
+	    
+	    LOG (Log::PROGRESS, logger,
+		 "Optimized the circuit, removed " << removed << " gates");
+	}
+	if (g_cvm_options.reorder) {
+	    reorder_gates (parsed);
+	}
+	// after reordering, which would scatter the clusters again
+	if (g_cvm_options.batch_reads) {
+	    const size_t moved = cluster_array_reads (parsed);
+	    LOG (Log::PROGRESS, logger,
+		 "Clustered " << moved << " array reads");
+	}
+	// after clustering, as the Slicers go after the read clusters
+	if (g_cvm_options.fuse_reads) {
+	    fuse_read_slicers (parsed);
+	}
+	// last, as the other passes may remove gates, and the new numbers
+	// follow the circuit order
+	if (g_cvm_options.renumber) {
+	    renumber_gates (parsed, orig_nums);
+	}
+
+	num_gates = parsed.size();
+	max_gate = max_gate_len = 0;
+	layout = ValueLayout ();
+	
+	FOREACH (g, parsed) {
+	    gate_texts.push_back (serialize_gate (*g));
+	    max_gate = max (max_gate, unsigned (g->num));
+	    max_gate_len = max (max_gate_len, gate_texts.back().size());
+	    layout.add (*g);
+	}
+    }
+    
+
+    // read the inputs from stdin, loading the input arrays on the way
+    InputReader in_vals (stdin);
+    array_loaders_t loaders;
+    read_inputs (in_vals, array_inputs, loaders, crypto_fact);
+
+
+    // if asked, try to keep the values from the previous run. Not done for a
+    // partitioned circuit, where every worker runs all its gates.
+    shared_ptr<ValueStore> values;
+    vector<index_t> eval_steps;
+    
+    bool incremental =
+	cct_key.len() > 0 &&
+	prepare_incremental (parsed, max_gate, layout, in_vals, cct_name,
+			     cct_key, crypto_fact,
+			     values, eval_steps);
+
+
+    // create and fill in the containers. The gate objects are just big enough
+    // for the longest gate.
+    
+    FlatIO
+	io_cct	    (cct_cont,
+		     Just (make_pair (num_gates, max_gate_len))),
+	io_gates    (gates_cont,
+		     Just (make_pair (max_gate+1, max_gate_len)));
+    
+    if (!incremental) {
+	values.reset (new ValueStore (cct_name, layout, crypto_fact));
+    }
+
+    // the circuit and values are written encrypted and MAC'ed right away, so
+    // they need no do_encrypt() pass. The gates container stays in the clear,
+    // as CircuitEval reads it.
+    add_encrypt_filter (io_cct, crypto_fact);
+    
+    LOG (Log::INFO, logger,
+	 "cct_cont size=" << num_gates
+	 << "; gates_cont size=" << max_gate + 1
+	 << "; gate size=" << max_gate_len);
+
+    batched_writer
+	cct_writer (io_cct),
+	gates_writer (io_gates);
+
+    for (index_t i = 0; i < num_gates; i++) {
+
+	if (rereadable && !rewrite) {
+	    read_gate_text (gates_in, gate_num, gate_text);
+	}
+	else {
+	    gate_text.swap (gate_texts[i]);
+	}
+
+	const gate_t gate = keep_parsed ? parsed[i] : unserialize_gate (gate_text);
+
+	LOG (Log::DEBUG, logger,
+	     "Processing gate number " << gate.num);
+
+	if (incremental) {
+	    // the values are kept from the previous run, and the changed
+	    // inputs were already written in by prepare_incremental()
+	}
+	else if (gate.op.kind == gate_t::Input) {
+	    write_input (gate, in_vals, loaders, *values);
+	    cache_info.input_gates.push_back (gate.num);
+	}
+
+	// the other values are written by CircuitEval before they are read, so
+	// they are not filled in here.
 	
 	// write the string form of the gate into the two containers.
-	ByteBuffer gatestring = ByteBuffer (g->second, ByteBuffer::SHALLOW);
+	ByteBuffer gatestring (gate_text);
+
+	gates_writer.write (gate.num, gatestring);
+	cct_writer.write   (i,	      gatestring);
+
+    } // end for (i < num_gates)
+
+    cct_writer.flush();
+    gates_writer.flush();
+
+    // the original gate numbers, for the LOGVALS trace
+    if (!orig_nums.empty()) {
+	write_int_table (cct_dir + DIRSEP + ORIG_NUMS_CONT, orig_nums,
+			 crypto_fact);
+    }
+
+    if (cache) {
+	cache_info.num_gates = num_gates;
+	cache_info.max_gate  = max_gate;
+	cache_info.value_table = layout.table();
+	for (unsigned c = 0; c < pir::NUM_VALUE_CLASSES; c++) {
+	    cache_info.value_elem_sizes.push_back (
+		layout.elem_size (pir::value_class_t (c)));
+	}
+	cache->store (cache_info);
+    }
+
 
-	io_gates.write (g->first, gatestring);
-	io_cct.write   (i++,      gatestring);
+    // the list of steps for CircuitEval to run stays in card memory, as the
+    // host should not be able to make it skip any.
+    if (o_incremental) {
+	o_incremental->incremental = incremental;
+	o_incremental->steps.swap (eval_steps);
+	o_incremental->cct_key = cct_key;
+    }
 
-    } // end FOREACH (g, gates)
+    const bool bitslice = prep_bitslices (), narrow = prep_narrows ();
+
+    // split the circuit between worker processes
+    if (g_cvm_options.partitions > 1) {
+	circuit_partition_t part;
+	partition_circuit (parsed, max_gate, g_cvm_options.partitions, part);
+	write_partition (part, cct_name, crypto_fact);
+    }
+    // the bit store slots for bitsliced evaluation of the boolean gates, and
+    // the lane slots of the narrow gates
+    else if (bitslice || narrow)
+    {
+	vector<value_range_t> ranges;
+	infer_value_ranges (parsed, max_gate, ranges);
+	
+	vector<int> bool_table;
+	if (bitslice) {
+	    find_bool_gates (parsed, max_gate, bool_table, &ranges);
+	    write_int_table (cct_name + DIRSEP + BOOL_SLOTS_CONT, bool_table,
+			     crypto_fact);
+	}
+	
+	if (narrow) {
+	    vector<int> table;
+	    find_narrow_gates (parsed, max_gate, ranges, bool_table, table);
+	    write_int_table (cct_name + DIRSEP + NARROW_SLOTS_CONT, table,
+			     crypto_fact);
+	}
+    }
 	
     return max_gate;
 }
 
+
+
+// The bit store and narrow lanes are not written to the values container,
+// which the next run takes its values from with CVM_INCREMENTAL, even after a
+// full run. The workers of a partitioned circuit keep all their values there
+// too.
+bool prep_bitslices ()
+{
+    return g_cvm_options.bitslice && !g_cvm_options.incremental &&
+	g_cvm_options.partitions <= 1;
+}
+
+bool prep_narrows ()
+{
+    return g_cvm_options.narrow && !g_cvm_options.incremental &&
+	g_cvm_options.partitions <= 1;
+}
@@ -15,12 +15,52 @@
     
 #include <istream>
 #include <string>
+#include <vector>
 
 #include <pir/common/sym_crypto.h>
 
+
+/// What prep hands on to the evaluation of the circuit in the same process,
+/// with CVM_INCREMENTAL. It stays in card memory, so the host cannot change
+/// it.
+struct incremental_prep_t
+{
+    incremental_prep_t () : incremental (false) {}
+    
+    /// the values from the previous run were kept, and only 'steps' (indices
+    /// into CCT_CONT, in order) need to be run
+    bool incremental;
+    std::vector<index_t> steps;
+
+    /// the circuit_mac() of the circuit file and prep options, to save the
+    /// values digest with after the run (see ValueStore::save_digest()).
+    /// Empty if the values cannot be kept for the next run.
+    ByteBuffer cct_key;
+};
+
+
+/// Prepare the circuit, gates and values containers, and any input arrays. The
+/// circuit and values containers are written encrypted, ready for CircuitEval.
+/// @param o_incremental if not NULL, filled in for an incremental run (see
+/// cvm_options_t::incremental).
+/// @param o_cct_dir if not NULL, the prepared circuit cache may be used (see
+/// circuit-cache.h), and this is set to the directory with the circuit and
+/// gates containers, for CircuitEval. Otherwise they are under cct_name.
 int prepare_gates_container (std::istream & gates_in,
 			     const std::string& cct_name,
-			     CryptoProviderFactory * crypto_fact)
+			     CryptoProviderFactory * crypto_fact,
+			     incremental_prep_t * o_incremental = NULL,
+			     std::string * o_cct_dir = NULL)
     throw (io_exception, bad_arg_exception,  std::exception);
 
 
+/// Does prepare_gates_container() write the bit store slots (BOOL_SLOTS_CONT)
+/// for CircuitEval::enable_bitslice()? Not with CVM_INCREMENTAL, as the next
+/// run needs all the values in the values container, or for a partitioned
+/// circuit.
+bool prep_bitslices ();
+
+/// and the narrow lane slots (NARROW_SLOTS_CONT), for enable_narrow()?
+bool prep_narrows ();
+
+
@@ -47,6 +47,12 @@
 #include <common/consts-sfdl.h>
 
 #include "array.h"
+#include "bitslice.h"
+#include "cvm-options.h"
+#include "partition-circuit.h"
+#include "worker-links.h"
+#include "utils.h"
+#include "value-width.h"
 
 #include "run-circuit.h"
 
@@ -112,31 +118,57 @@ INSTANTIATE_STATIC_INIT(CircuitEval);
 
 
 CircuitEval::CircuitEval (const std::string& cctname,
-			  CryptoProviderFactory * fact)
+			  CryptoProviderFactory * fact,
+			  const std::vector<index_t> * steps,
+			  const std::string& cct_dir)
     // tell the HostIO to not use a write cache (size 0)
-    : _gates_io (cctname + DIRSEP + GATES_CONT, none),
-      _cct_io	(cctname + DIRSEP + CCT_CONT, none),
-      _vals_io	(cctname + DIRSEP + VALUES_CONT, none),
-      _prov_fact    (fact)
+    : _gates_io ((cct_dir.empty() ? cctname : cct_dir) + DIRSEP + GATES_CONT,
+		 none),
+      _cct_io	((cct_dir.empty() ? cctname : cct_dir) + DIRSEP + CCT_CONT,
+		 none),
+      _vals	(cctname, fact),
+      _prov_fact    (fact),
+      _cctname	    (cctname),
+      _incremental  (steps != NULL),
+      _links	    (NULL),
+      _part	    (0),
+      _send_mask    (0),
+      _fuse_reads   (false)
 {
-    // NOTE: how are the keys set up? _vals_io calls initExisting() on the
+    if (steps) {
+	_steps = *steps;
+    }
+    
+    // NOTE: how are the keys set up? _cct_io calls initExisting() on the
     // filter, which then reads in the container keys using its #master pointer
-    // (the FlatIO object).
-    _vals_io.appendFilter (auto_ptr<HostIOFilter>
-			   (new IOFilterEncrypt (&_vals_io,
-						 shared_ptr<SymWrapper> (
-						     new SymWrapper (fact)))));
-
+    // (the FlatIO object). The value store does the same for its containers.
     _cct_io.appendFilter (auto_ptr<HostIOFilter>
 			  (new IOFilterEncrypt (&_cct_io,
 						shared_ptr<SymWrapper> (
 						    new SymWrapper (fact)))));
+
+#ifdef LOGVALS
+    // the container may be left from an older run, so only look at it if
+    // renumbering is on.
+    if (g_cvm_options.renumber) {
+	read_int_table ((cct_dir.empty() ? cctname : cct_dir) +
+			DIRSEP + ORIG_NUMS_CONT,
+			fact, _orig_nums);
+    }
+#endif
 }
 
 void CircuitEval::eval ()
 {
+    if (_incremental) {
+	eval_incremental ();
+	return;
+    }
+    
     size_t num_gates = _cct_io.getLen();
     gate_t gate;
+
+    _fuse_reads = true;
     
     for (unsigned i=0; i < num_gates; i++) {
 
@@ -149,11 +181,154 @@ void CircuitEval::eval ()
 
 	LOG (Log::DEBUG, logger, gate << LOG_ENDL);
 
-	do_gate (gate);
+	// a cluster of reads on one array, which are read in one batch and then
+	// run as usual
+	if (gate.op.kind == gate_t::ReadDynArray && gate.op.params[0] > 1) {
+	    vector<gate_t> cluster (1, gate);
+	    for (int k = 1; k < gate.op.params[0] && i+1 < num_gates; k++) {
+		read_gate_at_step (gate, ++i);
+		cluster.push_back (gate);
+	    }
+	    
+	    do_read_cluster (cluster);
+	    
+	    FOREACH (c, cluster) {
+		run_gate (*c);
+	    }
+	    continue;
+	}
+
+	run_gate (gate);
+    }
+
+    if (_slicer) {
+	vector<gate_t> done;
+	_slicer->flush_all (done);
+	log_sliced (done);
+    }
+
+    _fuse_reads = false;
+    if (!_held_vals.empty()) {
+	LOG (Log::WARN, logger,
+	     _held_vals.size() << " fused array read values were not used up");
+	_held_vals.clear();
     }
 }    
 
 
+void CircuitEval::enable_bitslice ()
+{
+    vector<int> table;
+    read_int_table (_cctname + DIRSEP + BOOL_SLOTS_CONT, _prov_fact, table);
+
+    _slicer.reset (new BitSlicer (table));
+}
+
+
+void CircuitEval::enable_narrow ()
+{
+    vector<int> table;
+    read_int_table (_cctname + DIRSEP + NARROW_SLOTS_CONT, _prov_fact, table);
+
+    _narrow.reset (new NarrowStore (table));
+}
+
+
+void CircuitEval::run_gate (const gate_t& g)
+{
+    if (_slicer && _slicer->is_sliceable (g.num)) {
+	vector<gate_t> done;
+	_slicer->add (g, done);
+	log_sliced (done);
+    }
+    else {
+	do_gate (g);
+    }
+}
+
+
+void CircuitEval::log_sliced (const vector<gate_t> & gates)
+{
+#ifdef LOGVALS
+    FOREACH (g, gates) {
+	log_gate_value (*g, optBasic2bb (_slicer->get (g->num)));
+    }
+#endif
+}
+
+
+void CircuitEval::eval_incremental ()
+{
+    size_t num_steps = _steps.size();
+    gate_t gate;
+
+    LOG (Log::INFO, logger,
+	 "Incremental run of " << num_steps << " out of "
+	 << _cct_io.getLen() << " gates");
+    
+    for (unsigned i=0; i < num_steps; i++) {
+
+	if (i % 100 == 0) {
+	    LOG (Log::PROGRESS, s_progress_logger,
+		 "Doing incremental step " << i << " @" << epoch_secs());
+	}
+
+	read_gate_at_step (gate, _steps[i]);
+
+	LOG (Log::DEBUG, logger, gate << LOG_ENDL);
+
+	do_gate (gate);
+    }
+}
+
+
+void CircuitEval::eval_partition (unsigned part, WorkerLinks & links)
+{
+    read_partition_owners (_cctname, _prov_fact, _owner);
+    
+    FlatIO steps_io (partition_steps_cont (_cctname, part), none);
+    steps_io.appendFilter (auto_ptr<HostIOFilter>
+			   (new IOFilterEncrypt (&steps_io,
+						 shared_ptr<SymWrapper> (
+						     new SymWrapper (_prov_fact)))));
+
+    size_t num_steps = steps_io.getLen();
+    gate_t gate;
+    ByteBuffer step_buf;
+
+    LOG (Log::INFO, logger,
+	 "Partition " << part << " has " << num_steps << " out of "
+	 << _cct_io.getLen() << " gates");
+
+    _links = &links;
+    _part  = part;
+    
+    for (unsigned i=0; i < num_steps; i++) {
+
+	if (i % 100 == 0) {
+	    LOG (Log::PROGRESS, s_progress_logger,
+		 "Doing partition step " << i << " @" << epoch_secs());
+	}
+
+	steps_io.read (i, step_buf);
+	part_step_t step;
+	assert (step_buf.len() == sizeof(step));
+	memcpy (&step, step_buf.data(), sizeof(step));
+
+	read_gate_at_step (gate, step.step);
+
+	LOG (Log::DEBUG, logger, gate << LOG_ENDL);
+
+	// put_gate_val() sends the value on to these workers
+	_send_mask = step.send_mask;
+	do_gate (gate);
+    }
+
+    _links     = NULL;
+    _send_mask = 0;
+}
+
+
 void CircuitEval::read_gate_at_step (gate_t & o_gate,
 				     int step_num)
     
@@ -305,6 +480,32 @@ void CircuitEval::do_gate (const gate_t& g)
     break;
 
     
+    case gate_t::Mux:
+    {
+	const unsigned n = g.op.params[0];
+	assert (g.inputs.size() == 2*n + 1);
+	// we do not select on arrays now.
+	assert (g.typ.kind != gate_t::Array);
+
+	// the selectors, the values and the default, all read in any case
+	obj_list_t ins;
+	get_gate_vals (g.inputs, ins);
+
+	// the first true selector picks its value. A nil selector is false,
+	// as for Select.
+	unsigned pick = 2*n;
+	for (unsigned k = n; k-- > 0; ) {
+	    optional<int> selector = bb2optBasic<int> (ins[k]);
+	    if (selector && *selector) {
+		pick = n + k;
+	    }
+	}
+
+	res_bytes = ins[pick];
+    }
+    break;
+
+    
     case gate_t::ReadDynArray:
     {
 	optional<int> 	    enable_i= get_int_val (g.inputs[0]);
@@ -313,8 +514,20 @@ void CircuitEval::do_gate (const gate_t& g)
 
 	bool enable = enable_i ? (*enable_i != 0) : false;
 	
-	ByteBuffer val;
-	ByteBuffer arr2 = do_read_array (enable, arr_ptr, idx, val);
+	ByteBuffer val, arr2;
+	
+	std::map<int, ByteBuffer>::iterator batched = _batched_reads.find (g.num);
+	if (batched != _batched_reads.end()) {
+	    val = batched->second;
+	    _batched_reads.erase (batched);
+	    
+	    // the same array, as from do_read_array()
+	    arr2 = optBasic2bb<ArrayHandle::des_t> (
+		get_array (arr_ptr).getDescriptor());
+	}
+	else {
+	    arr2 = do_read_array (enable, arr_ptr, idx, val);
+	}
 
 	ByteBuffer outs [] = { arr2, val };
 	res_bytes = concat_bufs (outs, outs + ARRLEN(outs));
@@ -464,7 +677,13 @@ void CircuitEval::do_gate (const gate_t& g)
 #endif
     
 
-    if (res_bytes.len() > 0) {
+    if (_fuse_reads &&
+	g.op.kind == gate_t::ReadDynArray && g.op.params[1] > 0)
+    {
+	// only read by the Slicers which follow
+	_held_vals[g.num] = std::make_pair (g.op.params[1], res_bytes);
+    }
+    else if (res_bytes.len() > 0) {
 	put_gate_val (g.num, res_bytes);
     }
     
@@ -540,7 +759,8 @@ void CircuitEval::log_gate_value (const gate_t& g, const ByteBuffer& val)
     // that a text diff can reveal where the traces diverge.
     LOG ( Log::DEBUG, gate_logger,
 	  std::setiosflags(std::ios::left)
-	  << std::setw(14) << g.num
+	  << std::setw(14)
+	  << (g.num < _orig_nums.size() ? _orig_nums[g.num] : int (g.num))
 //	 << std::setw(12) << (res ? itoa(*res) : "N")
 	  << write_value (g, val) );
     
@@ -550,17 +770,98 @@ void CircuitEval::log_gate_value (const gate_t& g, const ByteBuffer& val)
 
 
 
+void CircuitEval::get_gate_vals (const vector<int> & gate_nums,
+				 obj_list_t & o_vals)
+{
+    o_vals.resize (gate_nums.size());
+
+    // the values kept elsewhere than the value store are got one at a time
+    vector<index_t> stored;
+    vector<unsigned> where;
+    for (unsigned i = 0; i < gate_nums.size(); i++) {
+	const int num = gate_nums[i];
+	if (_held_vals.count (num)				||
+	    (_links && _owner[num] != int(_part))		||
+	    (_slicer && _slicer->is_bool (num))			||
+	    (_narrow && _narrow->has (num)))
+	{
+	    o_vals[i] = get_gate_val (num);
+	}
+	else {
+	    stored.push_back (num);
+	    where.push_back (i);
+	}
+    }
+
+    if (stored.empty()) {
+	return;
+    }
+    
+    obj_list_t vals;
+    _vals.read (stored, vals);
+    for (unsigned j = 0; j < where.size(); j++) {
+	o_vals[where[j]] = vals[j];
+    }
+}
+
+
 void CircuitEval::put_gate_val (int gate_num, const ByteBuffer& val)
 {
-    _vals_io.write (static_cast<index_t>(gate_num), val);
+    if (_slicer && _slicer->is_bool (gate_num)) {
+	_slicer->put (gate_num, bb2optBasic<int> (val));
+	return;
+    }
+
+    if (_narrow && _narrow->has (gate_num)) {
+	_narrow->put (gate_num, bb2optBasic<int> (val));
+	return;
+    }
+    
+    _vals.write (static_cast<index_t>(gate_num), val);
+
+    if (_links && _send_mask) {
+	for (unsigned p = 0; p < MAX_PARTITIONS; p++) {
+	    if (_send_mask & (1U << p)) {
+		_links->send (p, gate_num, val);
+	    }
+	}
+    }
 }
 
 
 ByteBuffer CircuitEval::get_gate_val (int gate_num)
 {
     ByteBuffer buf;
+
+    // a fused array read, dropped after its last Slicer
+    std::map<int, std::pair<int, ByteBuffer> >::iterator held =
+	_held_vals.find (gate_num);
+    if (held != _held_vals.end()) {
+	buf = held->second.second;
+	if (--held->second.first == 0) {
+	    _held_vals.erase (held);
+	}
+	return buf;
+    }
+
+    // a value computed by another worker
+    if (_links && _owner[gate_num] != int(_part)) {
+	return _links->receive (gate_num);
+    }
+
+    // a value in the bit store, which may still need its batch done
+    if (_slicer && _slicer->is_bool (gate_num)) {
+	vector<gate_t> done;
+	_slicer->ensure (gate_num, done);
+	log_sliced (done);
+	return optBasic2bb (_slicer->get (gate_num));
+    }
+
+    if (_narrow && _narrow->has (gate_num)) {
+	return optBasic2bb (_narrow->get (gate_num));
+    }
     
-    _vals_io.read (static_cast<index_t>(gate_num), buf);
+    _vals.read (static_cast<index_t>(gate_num), buf);
 
     LOG (Log::DUMP, logger, "get_gate_val for gate " << gate_num
 	  << ": len=" << buf.len());
@@ -613,6 +914,41 @@ ByteBuffer CircuitEval::do_read_array (bool enable,
 }
 
 
+void CircuitEval::do_read_cluster (const vector<gate_t> & cluster)
+{
+    vector<bool> enables;
+    vector< optional<index_t> > idxs;
+    ArrayHandle * arr = NULL;
+    
+    FOREACH (g, cluster) {
+	if (g->op.kind != gate_t::ReadDynArray) {
+	    throw bad_arg_exception ("Gate " + itoa (g->num) +
+				     " in a read cluster is not a read");
+	}
+	
+	optional<int> enable_i = get_int_val (g->inputs[0]);
+	ArrayHandle & a = get_array (get_gate_val (g->inputs[1]));
+
+	if (arr != NULL && &a != arr) {
+	    throw bad_arg_exception ("Gate " + itoa (g->num) + " in a read "
+				     "cluster is on a different array");
+	}
+	arr = &a;
+	
+	enables.push_back (enable_i ? (*enable_i != 0) : false);
+	idxs.push_back (static_cast<optional<index_t> > (
+			    get_int_val (g->inputs[2])));
+    }
+
+    vector<ByteBuffer> vals;
+    arr->read_batch (enables, idxs, vals);
+
+    for (index_t k = 0; k < cluster.size(); k++) {
+	_batched_reads[cluster[k].num] = vals[k];
+    }
+}
+
+
 ByteBuffer CircuitEval::do_write_array (bool enable,
 					const ByteBuffer& arr_ptr_buf,
 					size_t off,
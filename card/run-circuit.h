@@ -14,8 +14,13 @@
  */
 
 #include <string>
+#include <map>
+#include <vector>
+
+#include <stdint.h>
 
 #include <boost/optional/optional.hpp>
+#include <boost/shared_ptr.hpp>
 
 #include <faerieplay/common/utils.h>
 #include <pir/common/sym_crypto.h>
@@ -23,6 +28,8 @@
 
 #include <common/gate.h>
 
+#include "value-store.h"
+
 
 #ifndef _RUN_CIRCUIT_H
 #define _RUN_CIRCUIT_H
@@ -31,6 +38,11 @@
 OPEN_NS
 
 
+class WorkerLinks;
+class BitSlicer;
+class NarrowStore;
+
+
 class CircuitEval
 {
 
@@ -38,16 +50,44 @@ public:
 
     /// Create an evaluator, giving it the name of a circuit created by
     /// prep-circuit.cc
+    /// @param steps if not NULL, only run these steps (indices into CCT_CONT,
+    /// from prepare_gates_container()), and reuse the other values from the
+    /// previous run.
+    /// @param cct_dir where the circuit and gates containers are, if not under
+    /// cctname, eg. a cache slot from prepare_gates_container()
     CircuitEval (const std::string& cctname,
-		 CryptoProviderFactory * fact);
+		 CryptoProviderFactory * fact,
+		 const std::vector<index_t> * steps = NULL,
+		 const std::string& cct_dir = "");
 
     /// Evaluate the circuit!
     void eval ();
 
+    /// Evaluate one partition of a circuit split by partition_circuit(),
+    /// exchanging boundary values with the other workers over 'links'.
+    void eval_partition (unsigned part, WorkerLinks & links);
+
+    /// Evaluate the boolean gates with a BitSlicer, using the table from
+    /// BOOL_SLOTS_CONT. Only for a full eval().
+    void enable_bitslice ();
+
+    /// Keep the 8- and 16-bit gates in a NarrowStore, using the table from
+    /// NARROW_SLOTS_CONT. Only for a full eval().
+    void enable_narrow ();
+
 
 private:
 
+    /// Evaluate just the circuit steps in _steps
+    void eval_incremental ();
+
     void do_gate (const gate_t& g);
+
+    /// do_gate(), or queue the gate with the BitSlicer if it is sliceable.
+    void run_gate (const gate_t& g);
+
+    /// log the values of gates done by the BitSlicer
+    void log_sliced (const std::vector<gate_t> & gates);
     
     /// Read the gate at the given circuit step.
     void read_gate_at_step (gate_t & o_gate,
@@ -69,6 +109,11 @@ private:
 			      boost::optional<index_t> idx,
 			      ByteBuffer & o_val);
 
+    /// Do the reads of a cluster of ReadDynArray gates (see
+    /// cluster_array_reads()) as one batch, leaving the values in
+    /// _batched_reads for do_gate().
+    void do_read_cluster (const std::vector<gate_t> & cluster);
+
     /// @return the descriptot of the resulting array
     ByteBuffer do_write_array (bool enable,
 			       const ByteBuffer& arr_ptr_buf,
@@ -83,6 +128,11 @@ private:
     std::string get_string_val (int gate_num);
 
     ByteBuffer get_gate_val (int gate_num);
+
+    /// get the values of several gates, with list reads for the ones in the
+    /// value store.
+    void get_gate_vals (const std::vector<int> & gate_nums,
+			obj_list_t & o_vals);
     void put_gate_val (int gate_num, const ByteBuffer& val);
     
     /// Log the gate value to the values log
@@ -90,11 +140,51 @@ private:
     
     FlatIO
     _gates_io,			// the gates s.t. gate number g is at _gates_io[g]
-	_cct_io,		// the gates in (topological) order of execution
-	_vals_io;		// values, s.t. val of gate g is at _vals_io[g]
+	_cct_io;		// the gates in (topological) order of execution
+
+    ValueStore _vals;		// the gate values
 
     CryptoProviderFactory * _prov_fact;
 
+    std::string _cctname;
+
+    bool _incremental;
+    std::vector<index_t> _steps;
+
+    //
+    // when running a partition: the links to the other workers, the owning
+    // partition of every gate, and which workers need the value of the
+    // current gate.
+    //
+    WorkerLinks * _links;
+    unsigned _part;
+    std::vector<int> _owner;
+    uint32_t _send_mask;
+
+    /// keeps the boolean gate values, if bitslicing is enabled
+    boost::shared_ptr<BitSlicer> _slicer;
+
+    /// keeps the narrow gate values, if enabled
+    boost::shared_ptr<NarrowStore> _narrow;
+
+    /// values of ReadDynArray gates already read by do_read_cluster()
+    std::map<int, ByteBuffer> _batched_reads;
+
+    /// keep the values of ReadDynArray gates marked by fuse_read_slicers() in
+    /// _held_vals instead of the value store. Only in a full eval(), where
+    /// the Slicers come right after the reads.
+    bool _fuse_reads;
+
+    /// the values of fused ReadDynArray gates, with the number of Slicers yet
+    /// to read each one.
+    std::map<int, std::pair<int, ByteBuffer> > _held_vals;
+
+#ifdef LOGVALS
+    /// the original gate numbers of a renumbered circuit, to log instead of
+    /// the gate numbers. Empty if not renumbered.
+    std::vector<int> _orig_nums;
+#endif
+
 public:
 
     static Log::logger_t logger, gate_logger;
@@ -16,6 +16,7 @@
 #include "array.h"
 
 #include "batcher-permute.h"
+#include "cvm-options.h"
 #include "utils.h"
 
 #include <stream/helpers.h>
@@ -82,6 +83,9 @@ int main (int argc, char *argv[])
     g_configs.cryptprov = configs::CryptAny;
     
     do_configs (argc, argv);
+    // eg. to run the commands with CVM_BACKGROUND_REPERMUTE=1 or
+    // CVM_PATH_ORAM_MIN=1
+    init_cvm_options ();
 
     auto_ptr<CryptoProviderFactory> prov_fact = init_crypt (g_configs);
 
@@ -46,6 +46,61 @@ void print_comp_indices (index_t a, index_t b)
 }
 
 
+// records the comparators of run_batcher(), and which ones start a new pass
+struct comparator_log : public BatcherInfoListener
+{
+    comparator_log ()
+	: pending (false)
+	{}
+    
+    void operator() (index_t a, index_t b)
+	{
+	    comps.push_back (make_pair (a, b));
+	    passes.push_back (pending);
+	    pending = false;
+	}
+
+    virtual void newpass ()
+	{
+	    pending = true;
+	}
+
+    vector<pair<index_t,index_t> > comps;
+    vector<bool> passes;
+    bool pending;
+};
+
+
+// check that BatcherCursor gives the same comparators as run_batcher()
+void check_cursor (size_t N)
+{
+    comparator_log log;
+    run_batcher (N, log, &log);
+
+    BatcherCursor cur (N);
+    index_t a, b;
+    bool newpass;
+    size_t i = 0;
+    for (; cur.next (a, b, newpass); i++)
+    {
+	if (i >= log.comps.size()		||
+	    make_pair (a, b) != log.comps[i]	||
+	    newpass != log.passes[i])
+	{
+	    cerr << "** cursor error at comparator " << i
+		 << " for N=" << N << endl;
+	    return;
+	}
+    }
+
+    if (i != log.comps.size() || BatcherCursor::size (N) != i) {
+	cerr << "** cursor gave " << i << " comparators and size "
+	     << BatcherCursor::size (N) << " instead of " << log.comps.size()
+	     << " for N=" << N << endl;
+    }
+}
+
+
 
 
 int main (int argc, char * argv[])
@@ -84,4 +139,10 @@ int main (int argc, char * argv[])
 	    cerr << "** error at i=" << i << endl;
 	}
     }
+
+    // and the cursor, on N and a few smaller sizes
+    for (size_t n = 1; n <= N; n = n < 64 ? n+1 : n*2) {
+	check_cursor (n);
+    }
+    check_cursor (N);
 }
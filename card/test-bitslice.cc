@@ -0,0 +1,167 @@
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+ */
+
+// check the bitsliced evaluation against do_bin_op() and do_un_op() on random
+// boolean circuits.
+
+#include <vector>
+#include <iostream>
+
+#include <stdlib.h>
+
+#include <boost/optional/optional.hpp>
+
+#include <common/gate.h>
+
+#include "bitslice.h"
+
+
+using namespace std;
+
+using boost::optional;
+
+
+static const gate_t::binop_t BINOPS[] = {
+    gate_t::Eq, gate_t::LT, gate_t::GT, gate_t::LTEq, gate_t::GTEq,
+    gate_t::NEq, gate_t::And, gate_t::Or,
+    gate_t::BAnd, gate_t::BOr, gate_t::BXor
+};
+
+
+optional<int> random_val ()
+{
+    switch (random() % 3) {
+    case 0:  return 0;
+    case 1:  return 1;
+    default: return optional<int> ();
+    }
+}
+
+
+string show (optional<int> x)
+{
+    return x ? itoa (*x) : "N";
+}
+
+
+int main (int argc, char * argv[])
+{
+    const unsigned N_IN   = argc > 1 ? atoi (argv[1]) : 50;
+    const unsigned N_GATE = argc > 2 ? atoi (argv[2]) : 2000;
+
+    srandom (argc > 3 ? atoi (argv[3]) : time(NULL));
+    
+    vector<gate_t> gates (N_IN + N_GATE);
+
+    // the inputs are Lits, so find_bool_gates() counts them as boolean; their
+    // real values (including nils) are put in directly.
+    for (unsigned i = 0; i < N_IN; i++) {
+	gates[i].num = i;
+	gates[i].typ.kind = gate_t::Scalar;
+	gates[i].op.kind = gate_t::Lit;
+	gates[i].op.params[0] = 0;
+    }
+    
+    for (unsigned i = N_IN; i < gates.size(); i++) {
+	gate_t & g = gates[i];
+	g.num = i;
+	g.typ.kind = gate_t::Scalar;
+	
+	switch (random() % 4) {
+	case 0:
+	    g.op.kind = gate_t::UnOp;
+	    g.op.params[0] = gate_t::LNot;
+	    break;
+	case 1:
+	    g.op.kind = gate_t::Select;
+	    g.op.params[0] = 0;
+	    break;
+	default:
+	    g.op.kind = gate_t::BinOp;
+	    g.op.params[0] = BINOPS[random() % ARRLEN(BINOPS)];
+	}
+
+	size_t arity = g.op.kind == gate_t::UnOp ? 1 :
+	    g.op.kind == gate_t::Select ? 3 : 2;
+	for (unsigned j = 0; j < arity; j++) {
+	    // mostly nearby gates, so batches get flushed early too
+	    unsigned back = 1 + random() % (random() % 2 ? 8 : i);
+	    g.inputs.push_back (i - std::min (back, i));
+	}
+    }
+
+    vector<int> table;
+    size_t num_bool = find_bool_gates (gates, gates.size()-1, table);
+    assert (num_bool == gates.size());
+
+    pir::BitSlicer slicer (table);
+    vector< optional<int> > ref (gates.size());
+    vector<gate_t> done;
+
+    for (unsigned i = 0; i < N_IN; i++) {
+	ref[i] = random_val ();
+	slicer.put (i, ref[i]);
+    }
+
+    for (unsigned i = N_IN; i < gates.size(); i++)
+    {
+	const gate_t & g = gates[i];
+	assert (slicer.is_sliceable (i));
+	
+	switch (g.op.kind) {
+	case gate_t::UnOp:
+	    ref[i] = do_un_op (gate_t::LNot, ref[g.inputs[0]]);
+	    break;
+	case gate_t::Select:
+	    // a nil selector selects the second value, as in do_gate()
+	    ref[i] = ref[g.inputs[0]] && *ref[g.inputs[0]] ?
+		ref[g.inputs[1]] : ref[g.inputs[2]];
+	    break;
+	default:
+	    ref[i] = do_bin_op (gate_t::binop_t (g.op.params[0]),
+				ref[g.inputs[0]], ref[g.inputs[1]]);
+	}
+
+	slicer.add (g, done);
+
+	// read a random earlier value now and then, as CircuitEval does for
+	// non-sliced gates
+	if (random() % 16 == 0) {
+	    unsigned j = random() % (i+1);
+	    slicer.ensure (j, done);
+	    if (slicer.get (j) != ref[j]) {
+		cerr << "Early read of gate " << j << " gave "
+		     << show (slicer.get (j)) << ", expected " << show (ref[j])
+		     << endl;
+		exit (EXIT_FAILURE);
+	    }
+	}
+    }
+
+    slicer.flush_all (done);
+    assert (done.size() == N_GATE);
+
+    for (unsigned i = 0; i < gates.size(); i++) {
+	if (slicer.get (i) != ref[i]) {
+	    cerr << "Gate " << i << " (" << gates[i] << ") gave "
+		 << show (slicer.get (i)) << ", expected " << show (ref[i])
+		 << endl;
+	    exit (EXIT_FAILURE);
+	}
+    }
+
+    cout << "All " << gates.size() << " gates OK" << endl;
+    
+    return 0;
+}
@@ -0,0 +1,119 @@
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+ */
+
+// check the streaming C-Json reader on a generated input with scalars, nested
+// records, a plain list and two streamed arrays, one of records.
+
+#include <vector>
+#include <iostream>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "input-reader.h"
+
+
+using namespace std;
+
+using pir::InputReader;
+using pir::InputArraySink;
+
+
+namespace
+{
+    /// checks that element i is { i, -i } or [ i ], per the number of
+    /// components.
+    class check_sink : public InputArraySink
+    {
+    public:
+	check_sink (unsigned comps)
+	    : _comps (comps), _next (0)
+	    {}
+
+	void element (size_t idx, const vector<int> & comps)
+	    throw (bad_arg_exception, std::exception)
+	    {
+		if (idx != _next++ || comps.size() != _comps ||
+		    comps[0] != int (idx) || (_comps > 1 && comps[1] != -int (idx)))
+		{
+		    cerr << "Bad array element " << idx << endl;
+		    exit (EXIT_FAILURE);
+		}
+	    }
+
+    private:
+	unsigned _comps;
+	size_t _next;
+    };
+
+
+    void check (bool ok, const char * what)
+    {
+	if (!ok) {
+	    cerr << "Failed: " << what << endl;
+	    exit (EXIT_FAILURE);
+	}
+    }
+}
+
+
+int main (int argc, char * argv[])
+{
+    const unsigned N = argc > 1 ? atoi (argv[1]) : 100000;
+
+    FILE * f = tmpfile ();
+    fprintf (f, "{ a = 35, s = { x = -1, y = true }, l = [4, 5, [6]] }\n");
+    fprintf (f, "{ arr = [");
+    for (unsigned i = 0; i < N; i++) {
+	fprintf (f, "%s{ f=%u, g=-%u }\n", i > 0 ? ", " : "", i, i);
+    }
+    fprintf (f, "], b = 28,\n  ints = [");
+    for (unsigned i = 0; i < N; i++) {
+	fprintf (f, "%s%u", i > 0 ? "," : "", i);
+    }
+    fprintf (f, "] }\n");
+    rewind (f);
+
+    check_sink recs (2), ints (1);
+    
+    InputReader in (f);
+    in.add_array ("arr", &recs);
+    in.add_array ("ints", &ints);
+    in.add_array ("missing", &ints);
+    in.read ();
+
+    check (in.find ("a") == 35 && in.find ("b") == 28, "top level scalars");
+    check (in.find ("s.x") == -1 && in.find ("s.y") == 1, "record fields");
+    check (in.find ("l.1") == 5 && in.find ("l.2.0") == 6, "list elements");
+    check (!in.find ("c") && !in.find ("arr.0.f"), "missing scalars");
+    check (in.array_length ("arr") == size_t (N) &&
+	   in.array_length ("ints") == size_t (N),
+	   "array lengths");
+    check (!in.array_length ("missing"), "missing array");
+
+    // and a syntax error is reported
+    FILE * bad = tmpfile ();
+    fprintf (bad, "{ a = 1,\n b = [1, 2 }");
+    rewind (bad);
+    try {
+	InputReader (bad).read ();
+	check (false, "syntax error");
+    }
+    catch (const bad_arg_exception & ex) {
+	cout << "Expected error: " << ex.what() << endl;
+    }
+
+    cout << "Read " << N << " element arrays OK" << endl;
+    return 0;
+}
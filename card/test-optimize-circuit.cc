@@ -0,0 +1,508 @@
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+ */
+
+// check that the circuit rewriting passes keep the Output values of random
+// scalar circuits, evaluated with do_bin_op() and do_un_op(), including with
+// nil inputs. Also check the clustering of array reads on random circuits
+// with arrays, which are modelled as maps from index to value.
+
+#include <vector>
+#include <map>
+#include <iostream>
+
+#include <stdlib.h>
+
+#include <boost/optional/optional.hpp>
+
+#include <common/gate.h>
+
+#include "optimize-circuit.h"
+
+
+using namespace std;
+
+using boost::optional;
+
+
+namespace
+{
+    /// the Output values of a circuit, by gate number. The Input gates get
+    /// their value from 'inputs', by gate number.
+    /// @param o_order if not NULL, gets the Output gate numbers in order
+    map<int, optional<int> > eval (const vector<gate_t> & gates,
+				   const map<int, optional<int> > & inputs,
+				   vector<int> * o_order = NULL)
+    {
+	map<int, optional<int> > vals, outs;
+
+	// the array of each array descriptor gate, and the array contents
+	map<int, int> array_of;
+	map<int, map<int, optional<int> > > arrays;
+
+	FOREACH (g, gates) {
+	    FOREACH (in, g->inputs) {
+		if (!vals.count (*in)) {
+		    cerr << "Gate " << g->num << " comes before its input "
+			 << *in << endl;
+		    exit (EXIT_FAILURE);
+		}
+	    }
+	    
+	    optional<int> v;
+	    switch (g->op.kind) {
+	    case gate_t::Lit:
+		v = g->op.params[0];
+		break;
+	    case gate_t::Input:
+		v = inputs.find (g->num)->second;
+		break;
+	    case gate_t::UnOp:
+		v = do_un_op (gate_t::unop_t (g->op.params[0]),
+			      vals[g->inputs[0]]);
+		break;
+	    case gate_t::BinOp:
+		v = do_bin_op (gate_t::binop_t (g->op.params[0]),
+			       vals[g->inputs[0]], vals[g->inputs[1]]);
+		break;
+	    case gate_t::Select:
+	    {
+		optional<int> sel = vals[g->inputs[0]];
+		v = sel && *sel ? vals[g->inputs[1]] : vals[g->inputs[2]];
+		break;
+	    }
+	    case gate_t::Mux:
+	    {
+		const unsigned n = g->op.params[0];
+		v = vals[g->inputs[2*n]];
+		for (unsigned k = n; k-- > 0; ) {
+		    optional<int> sel = vals[g->inputs[k]];
+		    if (sel && *sel) {
+			v = vals[g->inputs[n+k]];
+		    }
+		}
+		break;
+	    }
+	    case gate_t::InitDynArray:
+		array_of[g->num] = g->num;
+		break;
+	    case gate_t::ReadDynArray:
+	    {
+		// the array descriptor part of the value is left out
+		optional<int> en = vals[g->inputs[0]], idx = vals[g->inputs[2]];
+		if (en && *en && idx) {
+		    v = arrays[array_of[g->inputs[1]]][*idx];
+		}
+		array_of[g->num] = array_of[g->inputs[1]];
+		break;
+	    }
+	    case gate_t::WriteDynArray:
+	    {
+		optional<int> en = vals[g->inputs[0]], idx = vals[g->inputs[2]];
+		if (en && *en && idx) {
+		    arrays[array_of[g->inputs[1]]][*idx] = vals[g->inputs[3]];
+		}
+		array_of[g->num] = array_of[g->inputs[1]];
+		break;
+	    }
+	    case gate_t::Slicer:
+		// offset 0 is the array descriptor of a read, otherwise the value
+		if (g->op.params[0] == 0) {
+		    array_of[g->num] = array_of[g->inputs[0]];
+		}
+		else {
+		    v = vals[g->inputs[0]];
+		}
+		break;
+	    default:
+		assert (false);
+	    }
+
+	    vals[g->num] = v;
+	    if (elem (gate_t::Output, g->flags)) {
+		outs[g->num] = v;
+		if (o_order) {
+		    o_order->push_back (g->num);
+		}
+	    }
+	}
+	return outs;
+    }
+
+
+    /// a gate with no inputs
+    gate_t make_gate (int num, gate_t::gate_op_kind_t kind)
+    {
+	gate_t g;
+	g.num = num;
+	g.depth = 0;
+	g.typ.kind = gate_t::Scalar;
+	g.op.kind = kind;
+	return g;
+    }
+
+    
+    /// a random scalar gate, half the time a literal or input, as the values
+    /// read from the arrays are often nil.
+    int pick (const vector<int> & scalars)
+    {
+	return scalars[random() % (random() % 2 ? 8 : scalars.size())];
+    }
+
+    
+    /// check cluster_array_reads() on a random circuit with two arrays,
+    /// whose reads and writes are mixed with scalar gates.
+    void check_read_clusters (unsigned n_gate)
+    {
+	const unsigned ARR_LEN = 6;
+	
+	vector<gate_t> gates;
+	map<int, optional<int> > inputs;
+	// the gates which have scalar values
+	vector<int> scalars;
+	
+	int num = 0;
+	for (int i = 0; i < 4; i++, num++) {
+	    gates.push_back (make_gate (num, gate_t::Lit));
+	    gates.back().op.params[0] = i;
+	    scalars.push_back (num);
+	}
+	for (int i = 0; i < 4; i++, num++) {
+	    gates.push_back (make_gate (num, gate_t::Input));
+	    inputs[num] = i == 0 ? optional<int>() : optional<int>(random() % ARR_LEN);
+	    scalars.push_back (num);
+	}
+
+	// the current descriptor gate of each array
+	int desc[2];
+	for (int a = 0; a < 2; a++, num++) {
+	    gates.push_back (make_gate (num, gate_t::InitDynArray));
+	    gates.back().typ.kind = gate_t::Array;
+	    gates.back().op.params[0] = 4;
+	    gates.back().op.params[1] = ARR_LEN;
+	    desc[a] = num;
+	}
+
+	for (unsigned i = 0; i < n_gate; i++, num++)
+	{
+	    const int a = random() % 2;
+	    gate_t g = make_gate (num, gate_t::ReadDynArray);
+	    
+	    g.inputs.push_back (random() % 4 ? 1 : pick (scalars));
+	    g.inputs.push_back (desc[a]);
+	    g.inputs.push_back (pick (scalars));
+
+	    switch (random() % 6) {
+	    case 0:
+		g.op.kind = gate_t::WriteDynArray;
+		g.inputs.push_back (pick (scalars));
+		desc[a] = num;
+		gates.push_back (g);
+		break;
+	    case 1:
+	    case 2:
+	    case 3:
+	    {
+		g.op.params[0] = 0;
+		if (random() % 10 == 0) {
+		    g.flags.push_back (gate_t::Output);
+		}
+		gates.push_back (g);
+		
+		// the value, and sometimes the descriptor for the next operation
+		gate_t val = make_gate (++num, gate_t::Slicer);
+		val.inputs.push_back (g.num);
+		val.op.params[0] = 4;
+		val.op.params[1] = 4;
+		if (random() % 3 == 0) {
+		    val.flags.push_back (gate_t::Output);
+		}
+		gates.push_back (val);
+		scalars.push_back (num);
+
+		if (random() % 2) {
+		    gate_t d = make_gate (++num, gate_t::Slicer);
+		    d.inputs.push_back (g.num);
+		    d.op.params[0] = 0;
+		    d.op.params[1] = 4;
+		    gates.push_back (d);
+		    desc[a] = num;
+		}
+		break;
+	    }
+	    default:
+		g.op.kind = gate_t::BinOp;
+		g.op.params[0] = random() % 2 ? gate_t::Plus : gate_t::Minus;
+		g.inputs.erase (g.inputs.begin() + 1);
+		if (random() % 3 == 0) {
+		    g.flags.push_back (gate_t::Output);
+		}
+		scalars.push_back (num);
+		gates.push_back (g);
+	    }
+	}
+
+	vector<int> out_order;
+	const map<int, optional<int> > expect = eval (gates, inputs, &out_order);
+
+	vector<gate_t> cl (gates);
+	const size_t moved = cluster_array_reads (cl);
+
+	vector<int> new_order;
+	if (eval (cl, inputs, &new_order) != expect || new_order != out_order)
+	{
+	    cerr << "cluster_array_reads changed the outputs" << endl;
+	    exit (EXIT_FAILURE);
+	}
+
+	// the clusters are marked, and are reads of one array
+	size_t in_clusters = 0;
+	for (unsigned i = 0; i < cl.size(); i++) {
+	    if (cl[i].op.kind != gate_t::ReadDynArray || cl[i].op.params[0] < 2) {
+		continue;
+	    }
+	    const unsigned k = cl[i].op.params[0];
+	    if (k > MAX_READ_CLUSTER || i + k > cl.size()) {
+		cerr << "Bad cluster size " << k << endl;
+		exit (EXIT_FAILURE);
+	    }
+	    for (unsigned j = i+1; j < i+k; j++) {
+		if (cl[j].op.kind != gate_t::ReadDynArray ||
+		    cl[j].op.params[0] != 0 ||
+		    cl[j].inputs[1] != cl[i].inputs[1])
+		{
+		    cerr << "Gate " << cl[j].num << " does not belong in the cluster"
+			 << " of " << cl[i].num << endl;
+		    exit (EXIT_FAILURE);
+		}
+	    }
+	    in_clusters += k - 1;
+	}
+	if (in_clusters != moved) {
+	    cerr << "cluster_array_reads moved " << moved << " reads but marked "
+		 << in_clusters << endl;
+	    exit (EXIT_FAILURE);
+	}
+
+	cout << moved << " array reads clustered" << endl;
+
+	// and the Slicers fused with their reads
+	const size_t fused = fuse_read_slicers (cl);
+
+	new_order.clear();
+	if (eval (cl, inputs, &new_order) != expect || new_order != out_order)
+	{
+	    cerr << "fuse_read_slicers changed the outputs" << endl;
+	    exit (EXIT_FAILURE);
+	}
+
+	// the marked reads are only used by that many Slicers, and few values
+	// are held at once
+	map<int, int> held;
+	size_t max_held = 0, num_marked = 0;
+	FOREACH (g, cl) {
+	    FOREACH (in, g->inputs) {
+		if (held.count (*in) &&
+		    (g->op.kind != gate_t::Slicer || --held[*in] < 0))
+		{
+		    cerr << "Gate " << g->num << " uses fused read " << *in
+			 << endl;
+		    exit (EXIT_FAILURE);
+		}
+	    }
+	    if (g->op.kind == gate_t::ReadDynArray && g->op.params[1] > 0) {
+		held[g->num] = g->op.params[1];
+		num_marked++;
+	    }
+	    for (map<int, int>::iterator h = held.begin(); h != held.end(); ) {
+		if (h->second == 0) {
+		    held.erase (h++);
+		}
+		else {
+		    ++h;
+		}
+	    }
+	    max_held = max (max_held, held.size());
+	}
+	if (!held.empty() || num_marked != fused || max_held > MAX_READ_CLUSTER) {
+	    cerr << "fuse_read_slicers left " << held.size()
+		 << " reads with unused values, or held " << max_held << endl;
+	    exit (EXIT_FAILURE);
+	}
+
+	cout << fused << " array reads fused with their Slicers" << endl;
+    }
+}
+
+
+int main (int argc, char * argv[])
+{
+    const unsigned N_LIT  = argc > 1 ? atoi (argv[1]) : 12;
+    const unsigned N_GATE = argc > 2 ? atoi (argv[2]) : 2000;
+
+    srandom (argc > 3 ? atoi (argv[3]) : time(NULL));
+
+    // the literals include the identity elements, and the inputs may be nil
+    const int LITS[] = { 0, 1, -1, 2, 4, 8, 3, 5 };
+    const unsigned N_INPUT = 8;
+
+    vector<gate_t> gates;
+    map<int, optional<int> > inputs;
+
+    // leave gaps in the numbering
+    int num = 0;
+    for (unsigned i = 0; i < N_LIT + N_INPUT + N_GATE; i++, num += 1 + random() % 3)
+    {
+	gate_t g;
+	g.num = num;
+	g.depth = 0;
+	g.typ.kind = gate_t::Scalar;
+
+	if (i < N_LIT) {
+	    g.op.kind = gate_t::Lit;
+	    g.op.params[0] = LITS[random() % ARRLEN(LITS)];
+	}
+	else if (i < N_LIT + N_INPUT) {
+	    g.op.kind = gate_t::Input;
+	    inputs[num] = random() % 4 == 0 ?
+		optional<int>() : optional<int> (random() % 7 - 2);
+	}
+	else if (gates.size() > N_LIT + N_INPUT && random() % 6 == 0) {
+	    // a copy of an earlier gate, maybe with commuted inputs
+	    const gate_t & c = gates[N_LIT + N_INPUT +
+				     random() % (gates.size() - N_LIT - N_INPUT)];
+	    g.op = c.op;
+	    g.inputs = c.inputs;
+	    if (random() % 2) {
+		std::swap (g.inputs[0], g.inputs[1]);
+	    }
+	}
+	else {
+	    for (unsigned j = 0; j < 3; j++) {
+		g.inputs.push_back (gates[random() % gates.size()].num);
+	    }
+
+	    switch (random() % 6) {
+	    case 0:
+		g.op.kind = gate_t::UnOp;
+		g.op.params[0] = random() % (gate_t::BNot + 1);
+		break;
+	    case 1:
+		g.op.kind = gate_t::Select;
+		// often an else-if on the gate before
+		if (random() % 2) {
+		    g.inputs[2] = gates.back().num;
+		}
+		break;
+	    default:
+		g.op.kind = gate_t::BinOp;
+		g.op.params[0] = random() % (gate_t::BXor + 1);
+		// no shifts, which may be out of range
+		if (g.op.params[0] == gate_t::SL ||
+		    g.op.params[0] == gate_t::SR)
+		{
+		    g.op.params[0] = gate_t::Times;
+		}
+	    }
+
+	    if (random() % 10 == 0) {
+		g.flags.push_back (gate_t::Output);
+	    }
+	}
+
+	gates.push_back (g);
+    }
+
+    vector<int> out_order;
+    const map<int, optional<int> > expect = eval (gates, inputs, &out_order);
+
+    vector<gate_t> opt (gates);
+    size_t removed = simplify_circuit (opt);
+
+    if (eval (opt, inputs) != expect) {
+	cerr << "simplify_circuit changed the outputs" << endl;
+	exit (EXIT_FAILURE);
+    }
+
+    removed += merge_common_gates (opt);
+
+    if (eval (opt, inputs) != expect) {
+	cerr << "merge_common_gates changed the outputs" << endl;
+	exit (EXIT_FAILURE);
+    }
+    
+    removed += remove_dead_gates (opt);
+
+    if (eval (opt, inputs) != expect) {
+	cerr << "remove_dead_gates changed the outputs" << endl;
+	exit (EXIT_FAILURE);
+    }
+
+    const size_t num_selects = merge_select_chains (opt);
+    removed += num_selects;
+
+    if (eval (opt, inputs) != expect) {
+	cerr << "merge_select_chains changed the outputs" << endl;
+	exit (EXIT_FAILURE);
+    }
+
+    // every remaining gate is an Output or feeds one
+    map<int, unsigned> uses;
+    FOREACH (g, opt) {
+	FOREACH (in, g->inputs) {
+	    uses[*in]++;
+	}
+    }
+    FOREACH (g, opt) {
+	if (!elem (gate_t::Output, g->flags) && uses[g->num] == 0) {
+	    cerr << "Dead gate " << g->num << " was not removed" << endl;
+	    exit (EXIT_FAILURE);
+	}
+    }
+
+    reorder_gates (opt);
+
+    vector<int> new_order;
+    if (eval (opt, inputs, &new_order) != expect || new_order != out_order) {
+	cerr << "reorder_gates changed the outputs or their order" << endl;
+	exit (EXIT_FAILURE);
+    }
+
+    // and renumbered, with the inputs and outputs mapped to the new numbers
+    vector<int> orig_nums;
+    renumber_gates (opt, orig_nums);
+
+    map<int, optional<int> > new_inputs;
+    for (unsigned i = 0; i < orig_nums.size(); i++) {
+	if (inputs.count (orig_nums[i])) {
+	    new_inputs[i] = inputs.find (orig_nums[i])->second;
+	}
+    }
+    
+    map<int, optional<int> > outs = eval (opt, new_inputs), orig_outs;
+    FOREACH (o, outs) {
+	orig_outs[orig_nums[o->first]] = o->second;
+    }
+    if (orig_outs != expect) {
+	cerr << "renumber_gates changed the outputs" << endl;
+	exit (EXIT_FAILURE);
+    }
+
+    cout << "All " << expect.size() << " outputs OK; "
+	 << removed << " of " << gates.size() << " gates removed, "
+	 << num_selects << " of them Selects merged into Muxes" << endl;
+
+    check_read_clusters (N_GATE / 4);
+
+    return 0;
+}
@@ -0,0 +1,202 @@
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+ */
+
+// check partition_circuit() on random circuits with arrays, whose operations
+// chain through the descriptors taken out of a read by a Slicer: all the
+// operations on one array must have the same owner, and every gate must be
+// run by its owner, once, in circuit order.
+
+#include <vector>
+#include <map>
+#include <iostream>
+
+#include <stdlib.h>
+
+#include <common/gate.h>
+
+#include "partition-circuit.h"
+
+
+using namespace std;
+
+
+namespace
+{
+    /// a gate with no inputs
+    gate_t make_gate (int num, gate_t::gate_op_kind_t kind)
+    {
+	gate_t g;
+	g.num = num;
+	g.depth = 0;
+	g.typ.kind = gate_t::Scalar;
+	g.op.kind = kind;
+	return g;
+    }
+
+
+    /// a random circuit on 'n_arr' arrays, with reads, writes and scalar
+    /// gates mixed. The descriptor for the next operation on an array is
+    /// the last write, or sometimes a Slicer of the last read.
+    /// @param o_array_of the InitDynArray gate of each array operation
+    void make_circuit (unsigned n_arr, unsigned n_gate,
+		       vector<gate_t> & o_gates,
+		       map<int, int> & o_array_of)
+    {
+	const unsigned ARR_LEN = 6;
+
+	vector<int> scalars;
+	int num = 0;
+	for (int i = 0; i < 4; i++, num++) {
+	    o_gates.push_back (make_gate (num, gate_t::Lit));
+	    o_gates.back().op.params[0] = i;
+	    scalars.push_back (num);
+	}
+
+	// the current descriptor gate of each array
+	vector<int> desc (n_arr);
+	for (unsigned a = 0; a < n_arr; a++, num++) {
+	    o_gates.push_back (make_gate (num, gate_t::InitDynArray));
+	    o_gates.back().typ.kind = gate_t::Array;
+	    o_gates.back().op.params[0] = 4;
+	    o_gates.back().op.params[1] = ARR_LEN;
+	    desc[a] = num;
+	    o_array_of[num] = num;
+	}
+
+	for (unsigned i = 0; i < n_gate; i++, num++)
+	{
+	    const int a = random() % n_arr;
+	    const int root = o_array_of[desc[a]];
+
+	    gate_t g = make_gate (num, gate_t::ReadDynArray);
+	    g.inputs.push_back (scalars[random() % scalars.size()]);
+	    g.inputs.push_back (desc[a]);
+	    g.inputs.push_back (scalars[random() % scalars.size()]);
+
+	    switch (random() % 5) {
+	    case 0:
+		g.op.kind = gate_t::WriteDynArray;
+		g.inputs.push_back (scalars[random() % scalars.size()]);
+		o_gates.push_back (g);
+		o_array_of[num] = root;
+		desc[a] = num;
+		break;
+	    case 1:
+	    case 2:
+	    {
+		o_gates.push_back (g);
+		o_array_of[num] = root;
+
+		gate_t val = make_gate (++num, gate_t::Slicer);
+		val.inputs.push_back (g.num);
+		val.op.params[0] = 4;
+		val.op.params[1] = 4;
+		o_gates.push_back (val);
+		scalars.push_back (num);
+
+		// a scalar-typed descriptor, as in the compiled circuits
+		if (random() % 2) {
+		    gate_t d = make_gate (++num, gate_t::Slicer);
+		    d.inputs.push_back (g.num);
+		    d.op.params[0] = 0;
+		    d.op.params[1] = 4;
+		    o_gates.push_back (d);
+		    o_array_of[num] = root;
+		    desc[a] = num;
+		}
+		break;
+	    }
+	    default:
+		g.op.kind = gate_t::BinOp;
+		g.op.params[0] = gate_t::Plus;
+		g.inputs.erase (g.inputs.begin() + 1);
+		if (random() % 3 == 0) {
+		    g.flags.push_back (gate_t::Output);
+		}
+		o_gates.push_back (g);
+		scalars.push_back (num);
+	    }
+	}
+    }
+
+
+    void check_partition (unsigned n_arr, unsigned n_gate, unsigned nparts)
+    {
+	vector<gate_t> gates;
+	map<int, int> array_of;
+	make_circuit (n_arr, n_gate, gates, array_of);
+
+	circuit_partition_t part;
+	partition_circuit (gates, gates.back().num, nparts, part);
+
+	// one owner per array
+	map<int, int> array_owner;
+	for (map<int, int>::iterator a = array_of.begin();
+	     a != array_of.end(); ++a)
+	{
+	    const int owner = part.owner[a->first];
+	    if (!array_owner.count (a->second)) {
+		array_owner[a->second] = owner;
+	    }
+	    else if (array_owner[a->second] != owner) {
+		cerr << "Gate " << a->first << " on array " << a->second
+		     << " is in partition " << owner << ", the array in "
+		     << array_owner[a->second] << endl;
+		exit (EXIT_FAILURE);
+	    }
+	}
+
+	// every gate run once, by its owner, in circuit order
+	vector<int> runs (gates.size(), 0);
+	for (unsigned p = 0; p < nparts; p++) {
+	    for (unsigned i = 0; i < part.steps[p].size(); i++) {
+		const part_step_t & s = part.steps[p][i];
+		if (s.step >= gates.size() ||
+		    part.owner[gates[s.step].num] != int(p) ||
+		    (i > 0 && s.step <= part.steps[p][i-1].step))
+		{
+		    cerr << "Bad step " << s.step << " in partition " << p
+			 << endl;
+		    exit (EXIT_FAILURE);
+		}
+		runs[s.step]++;
+	    }
+	}
+	for (unsigned s = 0; s < gates.size(); s++) {
+	    if (runs[s] != 1) {
+		cerr << "Step " << s << " run " << runs[s] << " times" << endl;
+		exit (EXIT_FAILURE);
+	    }
+	}
+
+	cout << gates.size() << " gates on " << n_arr << " arrays in " << nparts
+	     << " partitions, " << part.cut_edges << " cut edges" << endl;
+    }
+}
+
+
+int main (int argc, char * argv[])
+{
+    const unsigned N_GATE = argc > 1 ? atoi (argv[1]) : 2000;
+
+    srandom (argc > 2 ? atoi (argv[2]) : time(NULL));
+
+    for (unsigned nparts = 2; nparts <= 4; nparts++) {
+	check_partition (2*nparts, N_GATE, nparts);
+    }
+
+    cout << "Partitions OK" << endl;
+
+    return EXIT_SUCCESS;
+}
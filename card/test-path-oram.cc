@@ -0,0 +1,124 @@
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+ */
+
+// Run random reads and writes on a PathOram, built from a shuffled flat
+// container, and check them against the same operations on a vector in
+// memory.
+
+#include "path-oram.h"
+#include "batcher-permute.h"
+
+#include <pir/common/sym_crypto.h>
+#include <pir/card/lib.h>
+#include <pir/card/configs.h>
+#include <pir/card/io_flat.h>
+#include <pir/card/permutation.h>
+
+#include <vector>
+#include <memory>
+#include <iostream>
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+using namespace std;
+
+using pir::PathOram;
+using pir::Shuffler;
+
+using boost::shared_ptr;
+
+using boost::optional;
+
+
+int main (int argc, char * argv[])
+{
+    const size_t N	   = argc > 1 ? atoi (argv[1]) : 1000;
+    const size_t ELEM_SIZE = sizeof(int) * 2;
+    const unsigned OPS	   = 20 * N;
+
+    init_default_configs ();
+    do_configs (argc, argv);
+
+    auto_ptr<CryptoProviderFactory> prov_fact = init_crypt (g_configs);
+
+    srandom (time(NULL));
+
+    // the initial values, in a flat container as prep leaves them
+    vector<ByteBuffer> ref (N);
+    shared_ptr<FlatIO> init (new FlatIO ("test-path-oram-init",
+					 Just (make_pair (N, ELEM_SIZE))));
+    for (index_t i = 0; i < N; i++) {
+	ref[i] = ByteBuffer (ELEM_SIZE);
+	bbcopy (ref[i], basic2bb (int (i)), 0);
+	bbcopy (ref[i], basic2bb (int (random())), sizeof(int));
+	init->write (i, ref[i]);
+    }
+
+    // shuffled as Array does before building the tree
+    shared_ptr<TwoWayPermutation> lr
+	(new UnbalancedLRPermutation (lgN_ceil(N), lgN_ceil(N),
+				      prov_fact.get()));
+    lr->randomize();
+    shared_ptr<TwoWayPermutation> perm (new RangeAdapterPermutation (lr, N));
+
+    Shuffler shuffler (init, perm, N);
+    shuffler.shuffle ();
+
+    PathOram oram ("test-path-oram", N, ELEM_SIZE, prov_fact.get());
+    oram.build (*init, *perm);
+
+    size_t max_stash = oram.stash_size();
+    unsigned errors = 0;
+
+    for (unsigned op = 0; op < OPS; op++)
+    {
+	const index_t i = random() % N;
+	const int r = random();
+
+	optional<pair<size_t, ByteBuffer> > new_val;
+	if (r % 3 != 0) {
+	    // write the second int, or both, or a disabled write
+	    ByteBuffer val = basic2bb (r);
+	    const size_t off = r % 2 ? sizeof(int) : 0;
+	    new_val = r % 5 != 0 ?
+		Just	(make_pair (off, val)) :
+		Nothing (make_pair (off, val));
+	}
+
+	ByteBuffer got = oram.access (i, new_val);
+
+	if (got.len() != ref[i].len() ||
+	    memcmp (got.data(), ref[i].data(), got.len()) != 0)
+	{
+	    cerr << "** wrong value for index " << i << " at op " << op << endl;
+	    errors++;
+	}
+
+	if (new_val) {
+	    ByteBuffer updated (ref[i], ByteBuffer::deepcopy());
+	    bbcopy (updated, new_val->second, new_val->first);
+	    ref[i] = updated;
+	}
+
+	max_stash = max (max_stash, oram.stash_size());
+    }
+
+    cout << OPS << " accesses on " << N << " elements, " << errors
+	 << " errors, largest stash " << max_stash << endl;
+
+    return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
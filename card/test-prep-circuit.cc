@@ -44,8 +44,10 @@ void usage (char *argv[]) {
 	"\tand ordered topologically." << endl
 	 << GATES_CONT << ": container with the circuit gates, in text encoding,\n"
 	"\tand with gate number g in cont[g]." << endl
-	 << VALUES_CONT << ": container with the circuit values,\n"
-	"\tinitially blank except for the inputs" << endl;
+	 << VALUES_CONT << "-{scalar,array,wide}: containers with the circuit\n"
+	"\tvalues by size class, initially blank except for the inputs" << endl
+	 << VALUE_SLOTS_CONT << ": the value container and slot of each gate"
+	 << endl;
 }
 
 
@@ -0,0 +1,131 @@
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+ */
+
+// check that the inferred value ranges hold on random circuits evaluated with
+// do_bin_op() and do_un_op(), and that the narrow lanes keep the values.
+
+#include <vector>
+#include <iostream>
+
+#include <stdlib.h>
+
+#include <boost/optional/optional.hpp>
+
+#include <common/gate.h>
+
+#include "value-width.h"
+
+
+using namespace std;
+
+using boost::optional;
+
+
+int main (int argc, char * argv[])
+{
+    const unsigned N_LIT  = argc > 1 ? atoi (argv[1]) : 20;
+    const unsigned N_GATE = argc > 2 ? atoi (argv[2]) : 2000;
+
+    srandom (argc > 3 ? atoi (argv[3]) : time(NULL));
+    
+    vector<gate_t> gates (N_LIT + N_GATE);
+    vector< optional<int> > vals (gates.size());
+
+    // mostly small literals, some large
+    for (unsigned i = 0; i < N_LIT; i++) {
+	gates[i].num = i;
+	gates[i].typ.kind = gate_t::Scalar;
+	gates[i].op.kind = gate_t::Lit;
+	gates[i].op.params[0] = random() % 4 == 0 ?
+	    int(random()) - RAND_MAX/2 : int(random() % 40) - 8;
+	vals[i] = gates[i].op.params[0];
+    }
+    
+    for (unsigned i = N_LIT; i < gates.size(); i++)
+    {
+	gate_t & g = gates[i];
+	g.num = i;
+	g.typ.kind = gate_t::Scalar;
+
+	for (unsigned j = 0; j < 3; j++) {
+	    g.inputs.push_back (random() % i);
+	}
+	
+	switch (random() % 5) {
+	case 0:
+	    g.op.kind = gate_t::UnOp;
+	    g.op.params[0] = random() % (gate_t::BNot + 1);
+	    vals[i] = do_un_op (gate_t::unop_t (g.op.params[0]),
+				vals[g.inputs[0]]);
+	    break;
+	case 1:
+	    g.op.kind = gate_t::Select;
+	    vals[i] = vals[g.inputs[0]] && *vals[g.inputs[0]] ?
+		vals[g.inputs[1]] : vals[g.inputs[2]];
+	    break;
+	default:
+	{
+	    g.op.kind = gate_t::BinOp;
+	    g.op.params[0] = random() % (gate_t::BXor + 1);
+	    optional<int> x = vals[g.inputs[0]], y = vals[g.inputs[1]];
+	    // skip the undefined cases
+	    if ((g.op.params[0] == gate_t::SL || g.op.params[0] == gate_t::SR)
+		&& y && (*y < 0 || *y > 31))
+	    {
+		g.op.params[0] = gate_t::Plus;
+	    }
+	    vals[i] = do_bin_op (gate_t::binop_t (g.op.params[0]), x, y);
+	}
+	}
+    }
+
+    vector<value_range_t> ranges;
+    infer_value_ranges (gates, gates.size()-1, ranges);
+
+    size_t narrow = 0;
+    for (unsigned i = 0; i < gates.size(); i++) {
+	if (vals[i] && (*vals[i] < ranges[i].lo || *vals[i] > ranges[i].hi)) {
+	    cerr << "Gate " << i << " (" << gates[i] << ") value " << *vals[i]
+		 << " is outside its range [" << ranges[i].lo << ","
+		 << ranges[i].hi << "]" << endl;
+	    exit (EXIT_FAILURE);
+	}
+	if (value_width (ranges[i]) < 32) {
+	    narrow++;
+	}
+    }
+
+    vector<int> table;
+    size_t num = find_narrow_gates (gates, gates.size()-1, ranges,
+				    vector<int>(), table);
+    assert (num == narrow);
+
+    pir::NarrowStore store (table);
+    for (unsigned i = 0; i < gates.size(); i++) {
+	if (store.has (i)) {
+	    store.put (i, vals[i]);
+	}
+    }
+    for (unsigned i = 0; i < gates.size(); i++) {
+	if (store.has (i) && store.get (i) != vals[i]) {
+	    cerr << "Narrow store lost the value of gate " << i << endl;
+	    exit (EXIT_FAILURE);
+	}
+    }
+
+    cout << "All " << gates.size() << " gates OK, "
+	 << narrow << " narrow" << endl;
+
+    return 0;
+}
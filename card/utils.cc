@@ -15,9 +15,14 @@
 
 #include <vector>
 #include <algorithm>
+#include <string>
+
+#include <boost/shared_ptr.hpp>
 
 #include <faerieplay/common/exceptions.h>
 
+#include <pir/card/io_filter_encrypt.h>
+
 #include "utils.h"
 
 
@@ -89,6 +94,69 @@ void hostio_write_int (FlatIO & io, index_t idx,
 }
 
 
+void add_encrypt_filter (FlatIO & io, CryptoProviderFactory * crypto_fact)
+{
+    io.appendFilter (std::auto_ptr<HostIOFilter>
+		     (new IOFilterEncrypt (&io,
+					   boost::shared_ptr<SymWrapper> (
+					       new SymWrapper (crypto_fact)))));
+}
+
+
+// how many ints in each object of an int table container
+static const size_t INT_TABLE_BLOCK = 32;
+
+void write_int_table (const std::string & cont_name,
+		      const std::vector<int> & table,
+		      CryptoProviderFactory * crypto_fact)
+    throw (better_exception)
+{
+    const size_t num_blocks = (table.size() + INT_TABLE_BLOCK - 1) / INT_TABLE_BLOCK;
+    
+    FlatIO io (cont_name,
+	       std::make_pair (num_blocks, INT_TABLE_BLOCK * sizeof(int)));
+    add_encrypt_filter (io, crypto_fact);
+
+    std::vector<index_t> idxs (num_blocks);
+    obj_list_t blocks (num_blocks);
+    
+    for (index_t b = 0; b < num_blocks; b++) {
+	idxs[b] = b;
+	blocks[b] = ByteBuffer (INT_TABLE_BLOCK * sizeof(int));
+	blocks[b].set (0);
+	
+	size_t n = std::min (INT_TABLE_BLOCK, table.size() - b*INT_TABLE_BLOCK);
+	memcpy (blocks[b].data(), &table[b*INT_TABLE_BLOCK], n * sizeof(int));
+    }
+
+    io.write (idxs, blocks);
+}
+
+
+void read_int_table (const std::string & cont_name,
+		     CryptoProviderFactory * crypto_fact,
+		     std::vector<int> & o_table)
+    throw (better_exception)
+{
+    FlatIO io (cont_name, boost::none);
+    add_encrypt_filter (io, crypto_fact);
+
+    std::vector<index_t> idxs (io.getLen());
+    for (index_t b = 0; b < idxs.size(); b++) {
+	idxs[b] = b;
+    }
+    
+    obj_list_t blocks;
+    io.read (idxs, blocks);
+
+    o_table.resize (blocks.size() * INT_TABLE_BLOCK);
+    for (index_t b = 0; b < blocks.size(); b++) {
+	assert (blocks[b].len() == INT_TABLE_BLOCK * sizeof(int));
+	memcpy (&o_table[b*INT_TABLE_BLOCK], blocks[b].data(), blocks[b].len());
+    }
+}
+
+
 #include <signal.h>		// for raise()
 #include <iostream>
 void out_of_memory_coredump ()
@@ -13,10 +13,14 @@
  *
  */
 
+#include <string>
+#include <vector>
+
 #include <pir/card/io.h>
 #include <pir/card/io_flat.h>
 #include <pir/common/comm_types.h> // for index_t
 				   // FIXME: this is silly
+#include <pir/common/sym_crypto.h>
 
 
 #ifndef _SFDL_CARD_UTILS_H
@@ -40,6 +44,25 @@ int hostio_read_int (FlatIO & io, index_t idx);
 void hostio_write_int (FlatIO & io, index_t idx,
 		       int val);
 
+
+/// Add an encrypt/MAC filter to a container, with a new SymWrapper.
+void add_encrypt_filter (FlatIO & io, CryptoProviderFactory * crypto_fact);
+
+
+/// Write a table of ints (eg. indexed by gate number) into a new encrypted
+/// container, packed many to an object.
+void write_int_table (const std::string & cont_name,
+		      const std::vector<int> & table,
+		      CryptoProviderFactory * crypto_fact)
+    throw (better_exception);
+
+/// Read back a table written by write_int_table(). It may come back padded
+/// with up to a block's worth of zeros.
+void read_int_table (const std::string & cont_name,
+		     CryptoProviderFactory * crypto_fact,
+		     std::vector<int> & o_table)
+    throw (better_exception);
+
 ///
 /// Convenient handler for memory exhaustion, which causes a core dump or some
 /// such hook to enable analysis.
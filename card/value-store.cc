@@ -0,0 +1,366 @@
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+*/
+
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <string.h>		// memcmp
+
+#include <boost/optional/optional.hpp>
+#include <boost/none.hpp>
+
+#include <faerieplay/common/utils.h>
+#include <faerieplay/common/logging.h>
+
+#include <common/gate.h>
+#include <common/consts-sfdl.h>
+
+#include "array.h"
+#include "card-state.h"
+#include "utils.h"
+#include "value-store.h"
+
+
+using std::string;
+using std::vector;
+using std::max;
+using std::make_pair;
+
+using boost::shared_ptr;
+using boost::optional;
+
+
+namespace
+{
+    Log::logger_t logger = Log::makeLogger ("circuit-vm.card.value-store");
+
+    const char * CLASS_NAMES[] = { "scalar", "array", "wide" };
+
+    // the object size for values whose size is not known from the circuit
+    const size_t UNKNOWN_VALUE_SIZE = 128;
+
+    const size_t ARRAY_VALUE_SIZE = OPT_BB_SIZE(pir::ArrayHandle::des_t);
+
+    template <class T>
+    void grow_to (vector<T> & v, index_t i, const T & fill)
+    {
+	if (v.size() <= i) {
+	    v.resize (i+1, fill);
+	}
+    }
+}
+
+
+OPEN_NS
+
+
+//
+// class ValueLayout
+//
+
+ValueLayout::ValueLayout ()
+{
+    std::fill (_counts, _counts + NUM_VALUE_CLASSES, 0);
+    std::fill (_elem_sizes, _elem_sizes + NUM_VALUE_CLASSES, 0);
+}
+
+
+ValueLayout::ValueLayout (const vector<int> & table,
+			  const vector<size_t> & elem_sizes)
+    : _table (table)
+{
+    assert (elem_sizes.size() == NUM_VALUE_CLASSES);
+    
+    std::fill (_counts, _counts + NUM_VALUE_CLASSES, 0);
+    std::copy (elem_sizes.begin(), elem_sizes.end(), _elem_sizes);
+
+    // the slots of a class are numbered from 0
+    FOREACH (e, _table) {
+	if (*e != VALUE_NONE) {
+	    _counts[*e & 3] = max (_counts[*e & 3], size_t (*e >> 2) + 1);
+	}
+    }
+}
+
+
+size_t ValueLayout::array_elem_size (int gate) const
+{
+    return gate >= 0 && unsigned(gate) < _arr_elem_sizes.size() ?
+	_arr_elem_sizes[gate] : 0;
+}
+
+
+size_t ValueLayout::value_size (const gate_t & g) const
+{
+    switch (g.op.kind)
+    {
+    case gate_t::Lit:
+    case gate_t::BinOp:
+    case gate_t::UnOp:
+	return OPT_BB_SIZE(int);
+
+    case gate_t::Input:
+	return g.typ.kind == gate_t::Array ? ARRAY_VALUE_SIZE : OPT_BB_SIZE(int);
+	
+    case gate_t::InitDynArray:
+    case gate_t::WriteDynArray:
+	return ARRAY_VALUE_SIZE;
+
+    case gate_t::ReadDynArray:
+    {
+	// the new array descriptor and the element
+	size_t elem = array_elem_size (g.inputs[1]);
+	return elem > 0 ? ARRAY_VALUE_SIZE + elem : 0;
+    }
+
+    case gate_t::Slicer:
+	return g.op.params[1];
+
+    case gate_t::Select:
+    {
+	// the value of either input
+	size_t x = g.inputs[1] < int(_sizes.size()) ? _sizes[g.inputs[1]] : 0,
+	    y	 = g.inputs[2] < int(_sizes.size()) ? _sizes[g.inputs[2]] : 0;
+	return x > 0 && y > 0 ? max (x, y) : 0;
+    }
+
+    case gate_t::Mux:
+    {
+	// the value of any of the value inputs, which follow the selectors
+	size_t size = 0;
+	for (unsigned i = g.op.params[0]; i < g.inputs.size(); i++) {
+	    const size_t x = g.inputs[i] < int(_sizes.size()) ?
+		_sizes[g.inputs[i]] : 0;
+	    if (x == 0) {
+		return 0;
+	    }
+	    size = max (size, x);
+	}
+	return size;
+    }
+
+    default:
+	return 0;
+    }
+}
+
+
+void ValueLayout::add (const gate_t & g)
+{
+    grow_to (_table, g.num, int(VALUE_NONE));
+    grow_to (_sizes, g.num, size_t(0));
+    grow_to (_arr_elem_sizes, g.num, size_t(0));
+
+    // the Print gate is not supported by CircuitEval, and has no value
+    if (g.op.kind == gate_t::Print) {
+	return;
+    }
+
+    // keep track of array element sizes, for the ReadDynArray values
+    if (g.typ.kind == gate_t::Array) {
+	_arr_elem_sizes[g.num] = g.typ.params[1];
+    }
+    else if (g.op.kind == gate_t::ReadDynArray ||
+	     g.op.kind == gate_t::WriteDynArray)
+    {
+	_arr_elem_sizes[g.num] = array_elem_size (g.inputs[1]);
+    }
+
+    const size_t size = value_size (g);
+    _sizes[g.num] = size;
+
+    value_class_t c;
+    if (g.op.kind == gate_t::InitDynArray  ||
+	g.op.kind == gate_t::WriteDynArray ||
+	(g.op.kind == gate_t::Input && g.typ.kind == gate_t::Array))
+    {
+	c = VAL_ARRAY;
+    }
+    else if (size == OPT_BB_SIZE(int)) {
+	c = VAL_SCALAR;
+    }
+    else {
+	c = VAL_WIDE;
+    }
+
+    _table[g.num] = (_counts[c]++ << 2) | c;
+    _elem_sizes[c] = max (_elem_sizes[c], size > 0 ? size : UNKNOWN_VALUE_SIZE);
+}
+
+
+
+//
+// class ValueStore
+//
+
+string ValueStore::cont_name (const string & cct_name, value_class_t c)
+{
+    return cct_name + DIRSEP + VALUES_CONT + "-" + CLASS_NAMES[c];
+}
+
+
+ValueStore::ValueStore (const string & cct_name,
+			const ValueLayout & layout,
+			CryptoProviderFactory * fact)
+    throw (better_exception)
+    : _table (layout.table())
+{
+    for (unsigned c = 0; c < NUM_VALUE_CLASSES; c++)
+    {
+	const value_class_t cls = value_class_t (c);
+	
+	LOG (Log::INFO, logger,
+	     layout.count (cls) << " " << CLASS_NAMES[c] << " values of "
+	     << layout.elem_size (cls) << " bytes");
+	
+	// empty containers are not supported, so make at least one slot
+	_ios[c].reset (new FlatIO (cont_name (cct_name, cls),
+				   Just (make_pair (max (layout.count (cls),
+							 size_t(1)),
+						    max (layout.elem_size (cls),
+							 size_t(1))))));
+	add_encrypt_filter (*_ios[c], fact);
+    }
+
+    write_int_table (cct_name + DIRSEP + VALUE_SLOTS_CONT, _table, fact);
+}
+
+
+ValueStore::ValueStore (const string & cct_name,
+			CryptoProviderFactory * fact)
+    throw (better_exception)
+{
+    read_int_table (cct_name + DIRSEP + VALUE_SLOTS_CONT, fact, _table);
+    
+    for (unsigned c = 0; c < NUM_VALUE_CLASSES; c++)
+    {
+	// NOTE: the filter calls initExisting(), which reads in the container
+	// keys.
+	_ios[c].reset (new FlatIO (cont_name (cct_name, value_class_t (c)),
+				   boost::none));
+	add_encrypt_filter (*_ios[c], fact);
+    }
+}
+
+
+FlatIO & ValueStore::io_of (index_t gate, index_t & o_slot)
+{
+    assert (((void)"ValueStore: the gate has no value slot",
+	     gate < _table.size() && _table[gate] != VALUE_NONE));
+
+    o_slot = _table[gate] >> 2;
+    return *_ios[_table[gate] & 3];
+}
+
+
+void ValueStore::read (index_t gate, ByteBuffer & o_val)
+{
+    index_t slot;
+    FlatIO & io = io_of (gate, slot);
+    io.read (slot, o_val);
+}
+
+
+void ValueStore::read (const vector<index_t> & gates, obj_list_t & o_vals)
+{
+    o_vals.resize (gates.size());
+    
+    // one list read per container
+    for (unsigned c = 0; c < NUM_VALUE_CLASSES; c++)
+    {
+	vector<index_t> slots, where;
+	for (unsigned i = 0; i < gates.size(); i++) {
+	    index_t slot;
+	    if (&io_of (gates[i], slot) == _ios[c].get()) {
+		slots.push_back (slot);
+		where.push_back (i);
+	    }
+	}
+	if (slots.empty()) {
+	    continue;
+	}
+
+	obj_list_t objs;
+	_ios[c]->read (slots, objs);
+	for (unsigned j = 0; j < where.size(); j++) {
+	    o_vals[where[j]] = objs[j];
+	}
+    }
+}
+
+
+void ValueStore::write (index_t gate, const ByteBuffer & val)
+{
+    index_t slot;
+    FlatIO & io = io_of (gate, slot);
+    io.write (slot, val);
+}
+
+
+ByteBuffer ValueStore::digest (const ByteBuffer & cct_key,
+			      CryptoProviderFactory * fact)
+    throw (better_exception)
+{
+    ByteBuffer table (_table.size() * sizeof(int));
+    if (!_table.empty()) {
+	memcpy (table.data(), &_table[0], table.len());
+    }
+    ByteBuffer d = card_mac (cct_key, fact);
+    card_mac_chain (d, table, fact);
+
+    // chained over the values of each class
+    for (unsigned c = 0; c < NUM_VALUE_CLASSES; c++) {
+	card_mac_chain (d, basic2bb (c), fact);
+	card_mac_chain_container (d, *_ios[c], fact);
+    }
+
+    return d;
+}
+
+
+void ValueStore::save_digest (const string & cct_name,
+			      const ByteBuffer & cct_key,
+			      CryptoProviderFactory * fact)
+    throw (better_exception)
+{
+    write_card_state (card_state_name (VALUES_CONT, cct_name),
+		      digest (cct_key, fact));
+
+    LOG (Log::INFO, logger,
+	 "Saved the digest of the values of " << cct_name);
+}
+
+
+bool ValueStore::check_digest (const string & cct_name,
+			       const ByteBuffer & cct_key,
+			       CryptoProviderFactory * fact)
+    throw (better_exception)
+{
+    const optional<ByteBuffer> saved =
+	read_card_state (card_state_name (VALUES_CONT, cct_name));
+    if (!saved) {
+	LOG (Log::INFO, logger,
+	     "No digest of the values of " << cct_name << " on the card");
+	return false;
+    }
+
+    const ByteBuffer now = digest (cct_key, fact);
+    return now.len() == saved->len() &&
+	memcmp (now.data(), saved->data(), now.len()) == 0;
+}
+
+
+CLOSE_NS
@@ -0,0 +1,174 @@
+// -*- c++ -*-
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+ */
+
+// The gate values of a circuit on the host, kept in one encrypted container
+// per size class, each with objects just big enough for its values. Prep works
+// out the size of every gate's value from the gate types with a ValueLayout,
+// and gives each gate a slot in the container of its class.
+
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/array.hpp>
+#include <boost/utility.hpp>	// boost::noncopyable
+
+#include <pir/card/io_flat.h>
+#include <pir/common/sym_crypto.h>
+
+#include <common/gate.h>
+
+
+#ifndef _VALUE_STORE_H
+#define _VALUE_STORE_H
+
+
+OPEN_NS
+
+
+/// the size classes of gate values
+enum value_class_t {
+    VAL_SCALAR,			// an optional<int>
+    VAL_ARRAY,			// an array descriptor
+    VAL_WIDE,			// an array read result, a slice of a struct, or
+				// a value of unknown size
+    NUM_VALUE_CLASSES
+};
+
+
+/// the values of the value slots table
+enum {
+    VALUE_NONE = -1		// the gate has no value
+    // otherwise (slot << 2) | class
+};
+
+
+
+/// Works out the value size class and slot of each gate, as the gates are
+/// added in circuit order.
+class ValueLayout
+{
+public:
+
+    ValueLayout ();
+
+    /// Restore a finished layout from its table and the object size of each
+    /// class, eg. as saved by a CircuitCache.
+    ValueLayout (const std::vector<int> & table,
+		 const std::vector<size_t> & elem_sizes);
+    
+    void add (const gate_t & g);
+
+    /// the table entry for every gate number, see VALUE_NONE
+    const std::vector<int> & table () const { return _table; }
+
+    /// how many values of a class there are
+    size_t count (value_class_t c) const { return _counts[c]; }
+
+    /// the object size for a class: the size of its biggest value
+    size_t elem_size (value_class_t c) const { return _elem_sizes[c]; }
+
+    
+private:
+
+    /// the value size of a gate whose input gates were already added, or 0 if
+    /// not known.
+    size_t value_size (const gate_t & g) const;
+
+    /// the element size of the array value of a gate, or 0 if not known.
+    size_t array_elem_size (int gate) const;
+    
+    std::vector<int> _table;
+
+    /// the value size of each gate, 0 if unknown
+    std::vector<size_t> _sizes;
+
+    /// for array-valued gates, the array element size
+    std::vector<size_t> _arr_elem_sizes;
+
+    size_t _counts[NUM_VALUE_CLASSES], _elem_sizes[NUM_VALUE_CLASSES];
+};
+
+
+
+/// The gate values of a circuit.
+class ValueStore : boost::noncopyable
+{
+public:
+
+    /// Create empty value containers for a circuit, and save the layout's
+    /// table in VALUE_SLOTS_CONT.
+    ValueStore (const std::string & cct_name,
+		const ValueLayout & layout,
+		CryptoProviderFactory * fact)
+	throw (better_exception);
+
+    /// Open the value containers of a prepared circuit.
+    ValueStore (const std::string & cct_name,
+		CryptoProviderFactory * fact)
+	throw (better_exception);
+
+    /// the slot table, as from ValueLayout::table()
+    const std::vector<int> & table () const { return _table; }
+    
+    void read (index_t gate, ByteBuffer & o_val);
+
+    /// Read several values, with one list read per container.
+    void read (const std::vector<index_t> & gates, obj_list_t & o_vals);
+
+    void write (index_t gate, const ByteBuffer & val);
+
+    /// Remember a digest of all the values on the card (see card-state.h),
+    /// at the end of a run whose values the next incremental run reuses.
+    /// @param cct_key the circuit_mac() of the circuit which made the values
+    void save_digest (const std::string & cct_name,
+		      const ByteBuffer & cct_key,
+		      CryptoProviderFactory * fact)
+	throw (better_exception);
+
+    /// Are the values the same as when save_digest() was last called, and
+    /// from the same circuit? If not, the host has rolled them back or swapped
+    /// them, the run which wrote them did not finish, or the circuit has
+    /// changed.
+    bool check_digest (const std::string & cct_name,
+		       const ByteBuffer & cct_key,
+		       CryptoProviderFactory * fact)
+	throw (better_exception);
+
+    
+private:
+
+    /// the name of the container for a class
+    static std::string cont_name (const std::string & cct_name,
+				  value_class_t c);
+
+    FlatIO & io_of (index_t gate, index_t & o_slot);
+
+    /// a card MAC over the circuit key, the slot table and all the values.
+    /// Reads every value.
+    ByteBuffer digest (const ByteBuffer & cct_key,
+		       CryptoProviderFactory * fact)
+	throw (better_exception);
+
+    std::vector<int> _table;
+
+    boost::array<boost::shared_ptr<FlatIO>, NUM_VALUE_CLASSES> _ios;
+};
+
+
+CLOSE_NS
+
+
+#endif // _VALUE_STORE_H
@@ -0,0 +1,345 @@
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+*/
+
+
+#include <vector>
+#include <algorithm>
+
+#include <limits.h>
+
+#include <boost/optional/optional.hpp>
+
+#include <faerieplay/common/utils.h>
+#include <faerieplay/common/logging.h>
+
+#include <common/gate.h>
+
+#include "bitslice.h"
+#include "value-width.h"
+
+
+using std::vector;
+using std::min;
+using std::max;
+
+using boost::optional;
+
+
+namespace
+{
+    Log::logger_t logger = Log::makeLogger ("circuit-vm.card.value-width");
+
+    const value_range_t FULL = { INT_MIN, INT_MAX };
+    const value_range_t BOOL = { 0, 1 };
+
+    
+    /// a range from 64-bit bounds, which is full if it does not fit in an
+    /// int, as the int operation would have wrapped around.
+    value_range_t make_range (int64_t lo, int64_t hi)
+    {
+	if (lo < INT_MIN || hi > INT_MAX) {
+	    return FULL;
+	}
+	value_range_t r = { int(lo), int(hi) };
+	return r;
+    }
+
+    int64_t abs_max (const value_range_t & r)
+    {
+	return max (-int64_t(r.lo), int64_t(r.hi));
+    }
+
+    /// the smallest 2^k-1 which is >= x, for x >= 0
+    int64_t all_ones_above (int64_t x)
+    {
+	int64_t m = 0;
+	while (m < x) {
+	    m = (m << 1) | 1;
+	}
+	return m;
+    }
+
+    
+    value_range_t bin_op_range (gate_t::binop_t op,
+				const value_range_t & a,
+				const value_range_t & b)
+    {
+	switch (op)
+	{
+	case gate_t::Eq:   case gate_t::NEq:
+	case gate_t::LT:   case gate_t::GT:
+	case gate_t::LTEq: case gate_t::GTEq:
+	case gate_t::And:  case gate_t::Or:
+	    return BOOL;
+
+	case gate_t::Plus:
+	    return make_range (int64_t(a.lo) + b.lo, int64_t(a.hi) + b.hi);
+	case gate_t::Minus:
+	    return make_range (int64_t(a.lo) - b.hi, int64_t(a.hi) - b.lo);
+
+	case gate_t::Times:
+	{
+	    int64_t p[] = { int64_t(a.lo) * b.lo, int64_t(a.lo) * b.hi,
+			    int64_t(a.hi) * b.lo, int64_t(a.hi) * b.hi };
+	    return make_range (*std::min_element (p, p + ARRLEN(p)),
+			       *std::max_element (p, p + ARRLEN(p)));
+	}
+
+	case gate_t::Div:
+	    // truncates towards 0, so |x/y| <= |x|
+	    if (a.lo >= 0) {
+		return b.lo >= 0 ? make_range (0, a.hi) : make_range (-a.hi, a.hi);
+	    }
+	    return make_range (-abs_max (a), abs_max (a));
+
+	case gate_t::Mod:
+	{
+	    // |x % y| < |y|, and |x % y| <= |x| with the sign of x
+	    int64_t m = min (abs_max (b) - 1, abs_max (a));
+	    return a.lo >= 0 ? make_range (0, m) : make_range (-m, m);
+	}
+
+	case gate_t::SR:
+	    if (a.lo >= 0 && b.lo >= 0 && b.hi < 32) {
+		return make_range (0, a.hi >> b.lo);
+	    }
+	    break;
+
+	case gate_t::SL:
+	    if (a.lo >= 0 && b.lo >= 0 && b.hi < 31) {
+		return make_range (0, int64_t(a.hi) << b.hi);
+	    }
+	    break;
+
+	case gate_t::BAnd:
+	    // a non-negative mask bounds the result
+	    if (a.lo >= 0 && b.lo >= 0)	return make_range (0, min (a.hi, b.hi));
+	    if (a.lo >= 0)		return make_range (0, a.hi);
+	    if (b.lo >= 0)		return make_range (0, b.hi);
+	    break;
+
+	case gate_t::BOr: case gate_t::BXor:
+	    if (a.lo >= 0 && b.lo >= 0) {
+		return make_range (0, all_ones_above (max (a.hi, b.hi)));
+	    }
+	    break;
+
+	default:
+	    break;
+	}
+
+	return FULL;
+    }
+
+
+    value_range_t un_op_range (gate_t::unop_t op, const value_range_t & a)
+    {
+	switch (op)
+	{
+	case gate_t::LNot:   return BOOL;
+	case gate_t::Negate: return make_range (-int64_t(a.hi), -int64_t(a.lo));
+	case gate_t::BNot:   return make_range (~int64_t(a.hi), ~int64_t(a.lo));
+	}
+	return FULL;
+    }
+}
+
+
+
+bool value_range_t::is_full () const
+{
+    return lo == INT_MIN && hi == INT_MAX;
+}
+
+
+void infer_value_ranges (const vector<gate_t> & gates,
+			 unsigned max_gate,
+			 vector<value_range_t> & o_ranges)
+{
+    o_ranges.assign (max_gate+1, FULL);
+
+    FOREACH (g, gates)
+    {
+	if (g->typ.kind != gate_t::Scalar) {
+	    continue;
+	}
+
+	value_range_t & r = o_ranges[g->num];
+	
+	switch (g->op.kind)
+	{
+	case gate_t::Lit:
+	    r.lo = r.hi = g->op.params[0];
+	    break;
+	    
+	case gate_t::BinOp:
+	    r = bin_op_range (static_cast<gate_t::binop_t> (g->op.params[0]),
+			      o_ranges[g->inputs[0]], o_ranges[g->inputs[1]]);
+	    break;
+
+	case gate_t::UnOp:
+	    r = un_op_range (static_cast<gate_t::unop_t> (g->op.params[0]),
+			     o_ranges[g->inputs[0]]);
+	    break;
+
+	case gate_t::Select:
+	{
+	    // the value is one of the inputs' values, which are only ints if
+	    // neither range is full.
+	    const value_range_t & x = o_ranges[g->inputs[1]],
+		& y = o_ranges[g->inputs[2]];
+	    if (!x.is_full() && !y.is_full()) {
+		r = make_range (min (x.lo, y.lo), max (x.hi, y.hi));
+	    }
+	}
+	break;
+
+	case gate_t::Mux:
+	{
+	    // likewise for all the value inputs
+	    bool ints = true;
+	    value_range_t u = o_ranges[g->inputs.back()];
+	    for (unsigned i = g->op.params[0]; i < g->inputs.size(); i++) {
+		const value_range_t & x = o_ranges[g->inputs[i]];
+		ints = ints && !x.is_full();
+		u = make_range (min (u.lo, x.lo), max (u.hi, x.hi));
+	    }
+	    if (ints) {
+		r = u;
+	    }
+	}
+	break;
+
+	default:
+	    // Input, Slicer, ReadDynArray: the values are not known, and may
+	    // not even be ints.
+	    break;
+	}
+    }
+
+    size_t counts[33] = { 0 };
+    FOREACH (r, o_ranges) {
+	counts[value_width (*r)]++;
+    }
+    
+    LOG (Log::INFO, logger,
+	 "Gate value widths: " << counts[1] << " 1-bit, "
+	 << counts[8] << " 8-bit, " << counts[16] << " 16-bit, "
+	 << counts[32] << " 32-bit or unknown");
+}
+
+
+unsigned value_width (const value_range_t & r)
+{
+    if (r.lo >= 0		&& r.hi <= 1)		return 1;
+    if (r.lo >= SCHAR_MIN	&& r.hi <= SCHAR_MAX)	return 8;
+    if (r.lo >= SHRT_MIN	&& r.hi <= SHRT_MAX)	return 16;
+    return 32;
+}
+
+
+size_t find_narrow_gates (const vector<gate_t> & gates,
+			  unsigned max_gate,
+			  const vector<value_range_t> & ranges,
+			  const vector<int> & bool_table,
+			  vector<int> & o_table)
+{
+    o_table.assign (max_gate+1, NARROW_NONE);
+    
+    index_t next_slot[2] = { 0, 0 };
+
+    FOREACH (g, gates)
+    {
+	if (g->typ.kind != gate_t::Scalar ||
+	    (!bool_table.empty() && bool_table[g->num] != BOOL_NONE))
+	{
+	    continue;
+	}
+
+	unsigned width = value_width (ranges[g->num]);
+	if (width == 32) {
+	    continue;
+	}
+
+	// 1-bit values which are not bitsliced go in the 8-bit lane
+	int is16 = width == 16 ? 1 : 0;
+	o_table[g->num] = (next_slot[is16]++ << 1) | is16;
+    }
+
+    LOG (Log::INFO, logger,
+	 next_slot[0] << " gates in the 8-bit lane, "
+	 << next_slot[1] << " in the 16-bit lane");
+
+    return next_slot[0] + next_slot[1];
+}
+
+
+
+OPEN_NS
+
+
+NarrowStore::NarrowStore (const vector<int> & table)
+    : _table (table)
+{
+    size_t sizes[2] = { 0, 0 };
+    FOREACH (t, _table) {
+	if (*t != NARROW_NONE) {
+	    sizes[*t & 1]++;
+	}
+    }
+
+    _lane8 .resize (sizes[0]);
+    _just8 .resize (sizes[0]);
+    _lane16.resize (sizes[1]);
+    _just16.resize (sizes[1]);
+}
+
+
+optional<int> NarrowStore::get (index_t gate) const
+{
+    assert (has (gate));
+
+    const unsigned slot = _table[gate] >> 1;
+
+    if (_table[gate] & 1) {
+	return _just16[slot] ? optional<int> (_lane16[slot]) : optional<int> ();
+    }
+    else {
+	return _just8[slot]  ? optional<int> (_lane8[slot])  : optional<int> ();
+    }
+}
+
+
+void NarrowStore::put (index_t gate, optional<int> val)
+{
+    assert (has (gate));
+
+    const unsigned slot = _table[gate] >> 1;
+    
+    if (_table[gate] & 1) {
+	assert (((void)"NarrowStore::put() value does not fit in 16 bits",
+		 !val || (*val >= SHRT_MIN && *val <= SHRT_MAX)));
+	_just16[slot] = bool (val);
+	_lane16[slot] = val ? *val : 0;
+    }
+    else {
+	assert (((void)"NarrowStore::put() value does not fit in 8 bits",
+		 !val || (*val >= SCHAR_MIN && *val <= SCHAR_MAX)));
+	_just8[slot] = bool (val);
+	_lane8[slot] = val ? *val : 0;
+    }
+}
+
+
+CLOSE_NS
@@ -0,0 +1,119 @@
+// -*- c++ -*-
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+ */
+
+// Value range and width inference for the scalar gates of a circuit.
+//
+// Every scalar value is an optional int, and takes a whole object in the host
+// values container. Many gates can only produce small values though:
+// comparisons, masks, small literals and what is computed from them. Prep finds
+// the range of each gate's (non-nil) values, and the gates which fit in 8 or 16
+// bits are kept in narrow lanes in card memory by a NarrowStore, instead of in
+// the values container. The gates which fit in one bit can also be bitsliced,
+// see bitslice.h.
+
+#include <vector>
+
+#include <stdint.h>
+
+#include <boost/optional/optional.hpp>
+
+#include <common/gate.h>
+
+
+#ifndef _VALUE_WIDTH_H
+#define _VALUE_WIDTH_H
+
+
+/// the inclusive range of the non-nil values of a gate. The full int range
+/// also stands for gates whose values are not ints, or not known.
+struct value_range_t
+{
+    int lo, hi;
+
+    bool is_full () const;
+};
+
+
+/// Propagate value ranges from the Lit gates through the arithmetic, logical
+/// and Select gates.
+/// @param gates the gates in circuit order
+/// @param o_ranges the range of each gate number
+void infer_value_ranges (const std::vector<gate_t> & gates,
+			 unsigned max_gate,
+			 std::vector<value_range_t> & o_ranges);
+
+
+/// the number of bits needed for values in a range: 1 for [0,1], 8 or 16 for
+/// ranges within the signed char and short types, and 32 otherwise.
+unsigned value_width (const value_range_t & r);
+
+
+/// the values of the narrow slots table
+enum {
+    NARROW_NONE = -1		// not a narrow gate
+    // otherwise (slot << 1) | is_16_bit
+};
+
+
+/// Find the gates of width 8 or 16, and give each a slot in its lane.
+/// @param bool_table the bitsliced gates (see find_bool_gates()), which are
+///	not given a slot. May be empty.
+/// @param o_table the table entry for each gate number, see NARROW_NONE. Prep
+///	stores it in NARROW_SLOTS_CONT.
+/// @return the number of narrow gates
+size_t find_narrow_gates (const std::vector<gate_t> & gates,
+			  unsigned max_gate,
+			  const std::vector<value_range_t> & ranges,
+			  const std::vector<int> & bool_table,
+			  std::vector<int> & o_table);
+
+
+
+OPEN_NS
+
+
+/// Card memory store for the values of the narrow gates.
+class NarrowStore
+{
+public:
+
+    NarrowStore (const std::vector<int> & table);
+
+    bool has (index_t gate) const
+	{
+	    return gate < _table.size() && _table[gate] != NARROW_NONE;
+	}
+
+    boost::optional<int> get (index_t gate) const;
+
+    /// set the value of a narrow gate. It has to fit its lane.
+    void put (index_t gate, boost::optional<int> val);
+
+private:
+
+    std::vector<int> _table;
+
+    std::vector<int8_t>	 _lane8;
+    std::vector<int16_t> _lane16;
+
+    // the Just bits of each lane
+    std::vector<bool>	 _just8, _just16;
+};
+
+
+CLOSE_NS
+
+
+#endif // _VALUE_WIDTH_H
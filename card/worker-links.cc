@@ -0,0 +1,651 @@
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+*/
+
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <memory>		// auto_ptr
+#include <algorithm>		// min
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>		// htonl
+
+#include <boost/bind.hpp>
+
+#include <faerieplay/common/utils.h>
+#include <faerieplay/common/logging.h>
+
+#include "worker-links.h"
+
+
+OPEN_NS
+
+using std::string;
+using std::vector;
+using std::ostringstream;
+
+
+Log::logger_t WorkerLinks::logger;
+
+INSTANTIATE_STATIC_INIT(WorkerLinks);
+
+
+OPEN_ANON_NS
+
+/// how long to keep trying to connect to a worker which is not up yet
+const unsigned CONNECT_TRIES = 120;
+
+/// the message header, inside the wrapping: sender, receiver, sequence number,
+/// gate number, and the run nonce
+const size_t HEADER_WORDS = 4;
+const size_t HEADER_LEN = HEADER_WORDS * sizeof(uint32_t)
+    + WorkerLinks::RUN_NONCE_LEN;
+
+/// the hello, inside the wrapping: sender, receiver, the run nonce and the
+/// receiver's challenge
+const size_t HELLO_LEN = 2 * sizeof(uint32_t) + 2 * WorkerLinks::RUN_NONCE_LEN;
+
+/// labels for deriving the two keys of a link
+const char ENC_KEY_LABEL = 'E', MAC_KEY_LABEL = 'M';
+
+
+string errstr (const string & what)
+{
+    return what + ": " + strerror (errno);
+}
+
+
+void write_full (int fd, const void * buf, size_t len)
+    throw (comm_exception)
+{
+    const char * p = static_cast<const char*> (buf);
+    while (len > 0) {
+	ssize_t n = ::write (fd, p, len);
+	if (n < 0 && errno == EINTR) {
+	    continue;
+	}
+	if (n <= 0) {
+	    throw comm_exception (errstr ("Writing to worker link"));
+	}
+	p += n;
+	len -= n;
+    }
+}
+
+
+/// @return false on a clean EOF before any bytes were read.
+bool read_full (int fd, void * buf, size_t len)
+    throw (comm_exception)
+{
+    char * p = static_cast<char*> (buf);
+    size_t got = 0;
+    while (got < len) {
+	ssize_t n = ::read (fd, p + got, len - got);
+	if (n < 0 && errno == EINTR) {
+	    continue;
+	}
+	if (n < 0) {
+	    throw comm_exception (errstr ("Reading from worker link"));
+	}
+	if (n == 0) {
+	    if (got == 0) {
+		return false;
+	    }
+	    throw comm_exception ("Worker link closed in mid-message");
+	}
+	got += n;
+    }
+    return true;
+}
+
+
+/// write a length and a wrapped message
+void write_wrapped (int fd, const ByteBuffer & wrapped)
+    throw (comm_exception)
+{
+    uint32_t len = htonl (wrapped.len());
+    write_full (fd, &len, sizeof(len));
+    write_full (fd, wrapped.data(), wrapped.len());
+}
+
+
+/// read a message written by write_wrapped()
+/// @return false on a clean EOF
+bool read_wrapped (int fd, ByteBuffer & o_wrapped)
+    throw (comm_exception)
+{
+    uint32_t len;
+    if (!read_full (fd, &len, sizeof(len))) {
+	return false;
+    }
+
+    o_wrapped = ByteBuffer (ntohl (len));
+    read_full (fd, o_wrapped.data(), o_wrapped.len());
+    return true;
+}
+
+
+/// Derive a key of 'len' bytes from 'base' and 'context', by MAC'ing the
+/// label, a block counter and the context under the base key, as many times as
+/// needed.
+ByteBuffer derive_key (CryptoProviderFactory * fact,
+		       const ByteBuffer & base, char label,
+		       const ByteBuffer & context, size_t len)
+{
+    std::auto_ptr<MacProvider> mac (fact->getMacProvider());
+
+    ByteBuffer answer (len);
+    ByteBuffer in (2 + context.len());
+    in.data()[0] = label;
+    memcpy (in.data() + 2, context.data(), context.len());
+
+    size_t off = 0;
+    for (unsigned char block = 0; off < len; block++) {
+	in.data()[1] = block;
+	ByteBuffer out = mac->mac (in, base);
+	size_t n = std::min (out.len(), len - off);
+	memcpy (answer.data() + off, out.data(), n);
+	off += n;
+    }
+
+    return answer;
+}
+
+
+int connect_to (const WorkerLinks::endpoint_t & ep)
+    throw (comm_exception)
+{
+    struct addrinfo hints, *res;
+    memset (&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    int err = getaddrinfo (ep.host.c_str(), itoa(ep.port).c_str(),
+			   &hints, &res);
+    if (err != 0) {
+	throw comm_exception ("Looking up worker host " + ep.host + ": "
+			      + gai_strerror (err));
+    }
+
+    int fd = -1;
+    for (unsigned t = 0; t < CONNECT_TRIES; t++)
+    {
+	fd = socket (res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (fd < 0) {
+	    break;
+	}
+	if (connect (fd, res->ai_addr, res->ai_addrlen) == 0) {
+	    break;
+	}
+
+	// probably not listening yet
+	close (fd);
+	fd = -1;
+	sleep (1);
+    }
+
+    freeaddrinfo (res);
+    
+    if (fd < 0) {
+	throw comm_exception (errstr ("Connecting to worker at " + ep.host
+				      + ":" + itoa(ep.port)));
+    }
+
+    // values are small and latency matters more than throughput
+    int one = 1;
+    setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    
+    return fd;
+}
+
+
+int listen_on (unsigned short port, int backlog)
+    throw (comm_exception)
+{
+    int fd = socket (AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+	throw comm_exception (errstr ("Creating worker socket"));
+    }
+
+    int one = 1;
+    setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    
+    struct sockaddr_in addr;
+    memset (&addr, 0, sizeof(addr));
+    addr.sin_family	 = AF_INET;
+    addr.sin_addr.s_addr = htonl (INADDR_ANY);
+    addr.sin_port	 = htons (port);
+
+    if (bind (fd, reinterpret_cast<struct sockaddr*> (&addr), sizeof(addr)) != 0 ||
+	listen (fd, backlog) != 0)
+    {
+	close (fd);
+	throw comm_exception (errstr ("Listening on worker port " + itoa(port)));
+    }
+
+    return fd;
+}
+
+CLOSE_NS
+
+
+
+WorkerLinks::endpoint_t
+WorkerLinks::parse_endpoint (const std::string & hostport)
+    throw (bad_arg_exception)
+{
+    string::size_type colon = hostport.rfind (':');
+    if (colon == string::npos || colon == 0 || colon+1 == hostport.size()) {
+	throw bad_arg_exception ("Worker address should be host:port, not "
+				 + hostport);
+    }
+
+    endpoint_t answer;
+    answer.host = hostport.substr (0, colon);
+    answer.port = atoi (hostport.substr (colon+1).c_str());
+
+    return answer;
+}
+
+
+
+string WorkerLinks::make_run_nonce (CryptoProviderFactory * fact)
+{
+    std::auto_ptr<RandProvider> rand (fact->getRandProvider());
+
+    static const char digits[] = "0123456789abcdef";
+    string answer;
+    for (unsigned i = 0; i < RUN_NONCE_LEN; i++) {
+	int b = rand->randint (256);
+	answer += digits[b >> 4];
+	answer += digits[b & 0xf];
+    }
+
+    return answer;
+}
+
+
+ByteBuffer WorkerLinks::parse_run_nonce (const std::string & hex)
+    throw (bad_arg_exception)
+{
+    if (hex.size() != 2 * RUN_NONCE_LEN) {
+	throw bad_arg_exception ("Run nonce should be "
+				 + itoa (2 * RUN_NONCE_LEN)
+				 + " hex digits, not \"" + hex + "\"");
+    }
+
+    ByteBuffer answer (RUN_NONCE_LEN);
+    for (unsigned i = 0; i < RUN_NONCE_LEN; i++) {
+	const string byte = hex.substr (2*i, 2);
+	char * end;
+	answer.data()[i] = strtoul (byte.c_str(), &end, 16);
+	if (*end != '\0') {
+	    throw bad_arg_exception ("Bad hex digits in run nonce " + hex);
+	}
+    }
+
+    return answer;
+}
+
+
+
+WorkerLinks::WorkerLinks (unsigned me,
+			  const vector<endpoint_t> & workers,
+			  CryptoProviderFactory * fact,
+			  const ByteBuffer & enc_key,
+			  const ByteBuffer & mac_key,
+			  const ByteBuffer & run_nonce)
+    throw (comm_exception)
+    : _me		(me),
+      _workers		(workers),
+      _out_fds		(workers.size(), -1),
+      _in_fds		(workers.size(), -1),
+      _out_seq		(workers.size(), 0),
+      _fact		(fact),
+      _enc_key		(enc_key),
+      _mac_key		(mac_key),
+      _run_nonce	(run_nonce),
+      _out_keys		(workers.size()),
+      _in_keys		(workers.size()),
+      _send_wrappers	(workers.size()),
+      _live_receivers	(0)
+{
+    assert (run_nonce.len() == RUN_NONCE_LEN);
+    
+    const size_t n = workers.size();
+    
+    // listen first, so that the other workers' connects can complete (into
+    // the backlog) before we get around to accept()
+    int listen_fd = listen_on (workers[me].port, n);
+
+    for (unsigned w = 0; w < n; w++) {
+	if (w != me) {
+	    _out_fds[w] = connect_to (workers[w]);
+	}
+    }
+
+    LOG (Log::INFO, logger,
+	 "Worker " << me << " connected to " << n-1 << " other workers");
+    
+    // the incoming links. Which worker is on which link is only learned from
+    // its hello.
+    vector<int> accepted;
+    while (accepted.size() + 1 < n)
+    {
+	int fd = accept (listen_fd, NULL, NULL);
+	if (fd < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    close (listen_fd);
+	    throw comm_exception (errstr ("Accepting worker link"));
+	}
+	accepted.push_back (fd);
+    }
+
+    close (listen_fd);
+
+    // The handshake: challenge every incoming link first, then answer the
+    // challenges on our outgoing links, then check the hellos. Every worker
+    // sends its challenges before waiting for anything, so this cannot
+    // deadlock.
+    std::auto_ptr<RandProvider> rand (fact->getRandProvider());
+    vector<ByteBuffer> challenges;
+    FOREACH (fd, accepted) {
+	ByteBuffer challenge (RUN_NONCE_LEN);
+	for (unsigned i = 0; i < RUN_NONCE_LEN; i++) {
+	    challenge.data()[i] = rand->randint (256);
+	}
+	write_full (*fd, challenge.data(), challenge.len());
+	challenges.push_back (challenge);
+    }
+
+    for (unsigned w = 0; w < n; w++) {
+	if (w != me) {
+	    send_hello (w);
+	}
+    }
+
+    for (unsigned i = 0; i < accepted.size(); i++) {
+	accept_hello (accepted[i], challenges[i]);
+    }
+
+    LOG (Log::INFO, logger,
+	 "Worker " << me << " has authenticated links with all "
+	 << n-1 << " other workers");
+
+    boost::mutex::scoped_lock lk (_lock);
+    for (unsigned w = 0; w < n; w++) {
+	if (w != me) {
+	    _live_receivers++;
+	    _receivers.create_thread (boost::bind (&WorkerLinks::receiver,
+						   this, w));
+	}
+    }
+}
+
+
+WorkerLinks::link_keys_t
+WorkerLinks::link_keys (unsigned sender, unsigned receiver,
+			const ByteBuffer & challenge)
+{
+    const uint32_t ends[] = { sender, receiver };
+
+    ByteBuffer context (sizeof(ends) + _run_nonce.len() + challenge.len());
+    memcpy (context.data(), ends, sizeof(ends));
+    bbcopy (context, _run_nonce, sizeof(ends));
+    bbcopy (context, challenge, sizeof(ends) + _run_nonce.len());
+
+    link_keys_t answer;
+    answer.enc = derive_key (_fact, _mac_key, ENC_KEY_LABEL, context,
+			     _enc_key.len());
+    answer.mac = derive_key (_fact, _mac_key, MAC_KEY_LABEL, context,
+			     _mac_key.len());
+    return answer;
+}
+
+
+void WorkerLinks::send_hello (unsigned to)
+    throw (comm_exception)
+{
+    const int fd = _out_fds[to];
+    
+    ByteBuffer challenge (RUN_NONCE_LEN);
+    if (!read_full (fd, challenge.data(), challenge.len())) {
+	throw comm_exception ("Worker " + itoa(to)
+			      + " closed the link before its challenge");
+    }
+
+    _out_keys[to] = link_keys (_me, to, challenge);
+    _send_wrappers[to].reset (new SymWrapper (_fact,
+					      _out_keys[to].enc,
+					      _out_keys[to].mac));
+
+    const uint32_t ends[] = { _me, to };
+    ByteBuffer hello (HELLO_LEN);
+    memcpy (hello.data(), ends, sizeof(ends));
+    bbcopy (hello, _run_nonce, sizeof(ends));
+    bbcopy (hello, challenge, sizeof(ends) + _run_nonce.len());
+
+    // who we claim to be goes in the clear too, so the receiver knows which
+    // keys to check the hello with
+    const uint32_t me = htonl (_me);
+    write_full (fd, &me, sizeof(me));
+    write_wrapped (fd, _send_wrappers[to]->wrap (hello));
+}
+
+
+void WorkerLinks::accept_hello (int fd, const ByteBuffer & challenge)
+    throw (comm_exception)
+{
+    uint32_t claimed;
+    ByteBuffer wrapped;
+    if (!read_full (fd, &claimed, sizeof(claimed)) ||
+	!read_wrapped (fd, wrapped))
+    {
+	throw comm_exception ("Worker link closed before its hello");
+    }
+
+    const unsigned sender = ntohl (claimed);
+    if (sender >= _workers.size() || sender == _me || _in_fds[sender] >= 0) {
+	throw comm_exception ("Worker link hello from a bad or duplicate"
+			      " worker number " + itoa (sender));
+    }
+
+    link_keys_t keys = link_keys (sender, _me, challenge);
+    SymWrapper wrapper (_fact, keys.enc, keys.mac);
+
+    // a bad MAC means a sender without the link keys, or which is not the
+    // claimed worker, or answering another challenge or run
+    ByteBuffer hello;
+    try {
+	hello = wrapper.unwrap (wrapped);
+    }
+    catch (const std::exception & ex) {
+	throw comm_exception ("Hello on worker link from worker "
+			      + itoa (sender) + " failed to unwrap: "
+			      + ex.what());
+    }
+
+    const uint32_t ends[] = { sender, _me };
+    if (hello.len() != HELLO_LEN ||
+	memcmp (hello.data(), ends, sizeof(ends)) != 0 ||
+	memcmp (hello.data() + sizeof(ends), _run_nonce.data(),
+		_run_nonce.len()) != 0 ||
+	memcmp (hello.data() + sizeof(ends) + _run_nonce.len(),
+		challenge.data(), challenge.len()) != 0)
+    {
+	throw comm_exception ("Bad hello on worker link from worker "
+			      + itoa (sender));
+    }
+
+    _in_fds[sender]  = fd;
+    _in_keys[sender] = keys;
+
+    LOG (Log::DEBUG, logger, "Link from worker " << sender << " is up");
+}
+
+
+WorkerLinks::~WorkerLinks ()
+{
+    // our end of the conversation is done. The peers' receivers see EOF.
+    FOREACH (fd, _out_fds) {
+	if (*fd >= 0) {
+	    close (*fd);
+	}
+    }
+
+    // and wait for the peers to finish with us.
+    _receivers.join_all ();
+
+    FOREACH (fd, _in_fds) {
+	if (*fd >= 0) {
+	    close (*fd);
+	}
+    }
+}
+
+
+
+void WorkerLinks::send (unsigned to, index_t gate_num, const ByteBuffer & val)
+    throw (comm_exception)
+{
+    assert (to < _out_fds.size() && _out_fds[to] >= 0);
+
+    uint32_t header[] = { _me, to, _out_seq[to]++, gate_num };
+    
+    ByteBuffer msg (HEADER_LEN + val.len());
+    memcpy (msg.data(), header, sizeof(header));
+    bbcopy (msg, _run_nonce, sizeof(header));
+    memcpy (msg.data() + HEADER_LEN, val.data(), val.len());
+
+    write_wrapped (_out_fds[to], _send_wrappers[to]->wrap (msg));
+
+    LOG (Log::DEBUG, logger,
+	 "Sent value of gate " << gate_num << " to worker " << to);
+}
+
+
+
+ByteBuffer WorkerLinks::receive (index_t gate_num)
+    throw (comm_exception)
+{
+    boost::mutex::scoped_lock lk (_lock);
+
+    std::map<index_t, ByteBuffer>::iterator found;
+    while ((found = _arrived.find (gate_num)) == _arrived.end())
+    {
+	if (!_error.empty()) {
+	    throw comm_exception (_error);
+	}
+	if (_live_receivers == 0) {
+	    ostringstream os;
+	    os << "All worker links closed before the value of gate "
+	       << gate_num << " arrived";
+	    throw comm_exception (os.str());
+	}
+	
+	_arrived_cond.wait (lk);
+    }
+
+    return found->second;
+}
+
+
+
+void WorkerLinks::receiver (unsigned sender)
+{
+    const int fd = _in_fds[sender];
+    
+    // SymWrapper is not thread safe, so each receiver has its own.
+    SymWrapper wrapper (_fact, _in_keys[sender].enc, _in_keys[sender].mac);
+
+    uint32_t next_seq = 0;
+    
+    try
+    {
+	while (true)
+	{
+	    ByteBuffer wrapped;
+	    if (!read_wrapped (fd, wrapped)) {
+		break;		// peer is done
+	    }
+
+	    // throws on a bad MAC
+	    ByteBuffer msg = wrapper.unwrap (wrapped);
+	    if (msg.len() < HEADER_LEN) {
+		throw comm_exception ("Short message on worker link");
+	    }
+
+	    uint32_t header[HEADER_WORDS];
+	    memcpy (header, msg.data(), sizeof(header));
+
+	    if (header[0] != sender || header[1] != _me ||
+		memcmp (msg.data() + sizeof(header), _run_nonce.data(),
+			_run_nonce.len()) != 0)
+	    {
+		throw comm_exception ("Worker link message for another link"
+				      " or run");
+	    }
+	    if (header[2] != next_seq) {
+		throw comm_exception ("Worker link message out of sequence");
+	    }
+	    next_seq++;
+
+	    ByteBuffer val (msg.len() - HEADER_LEN);
+	    memcpy (val.data(), msg.data() + HEADER_LEN, val.len());
+
+	    boost::mutex::scoped_lock lk (_lock);
+	    _arrived[header[3]] = val;
+	    _arrived_cond.notify_all ();
+	}
+    }
+    catch (const std::exception & ex)
+    {
+	receiver_failed (ex.what());
+	return;
+    }
+
+    LOG (Log::DEBUG, logger,
+	 "Link from worker " << sender << " closed");
+    
+    boost::mutex::scoped_lock lk (_lock);
+    _live_receivers--;
+    _arrived_cond.notify_all ();
+}
+
+
+void WorkerLinks::receiver_failed (const std::string & msg)
+{
+    LOG (Log::ERROR, logger, "Worker link failed: " << msg);
+
+    boost::mutex::scoped_lock lk (_lock);
+    if (_error.empty()) {
+	_error = msg;
+    }
+    _live_receivers--;
+    _arrived_cond.notify_all ();
+}
+
+
+CLOSE_NS
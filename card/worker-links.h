@@ -0,0 +1,179 @@
+// -*- c++ -*-
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+ */
+
+// Socket links between the cvm worker processes of a partitioned circuit (see
+// partition-circuit.h), over which they send each other the values of gates on
+// the partition boundaries.
+//
+// The workers share a pair of link keys, but do not use them directly: each
+// link gets its own keys, derived from the link keys, the run nonce which
+// cvm-coord makes for each run, a fresh challenge from the receiving worker,
+// and the two worker numbers. The sender proves it has the keys, and which
+// worker it is, in a MAC'ed hello answering the challenge. Every message is
+// then encrypted and MAC'ed with a SymWrapper under the link's keys, and
+// carries the sender, receiver, run nonce and a per-link sequence number, so
+// the network cannot replay values from another run or link, or reorder them.
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include <boost/utility.hpp>	// boost::noncopyable
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
+
+#include <faerieplay/common/utils.h>
+#include <faerieplay/common/exceptions.h>
+#include <faerieplay/common/logging.h>
+#include <pir/common/sym_crypto.h>
+
+
+#ifndef _WORKER_LINKS_H
+#define _WORKER_LINKS_H
+
+
+OPEN_NS
+
+
+class WorkerLinks : boost::noncopyable
+{
+public:
+
+    struct endpoint_t
+    {
+	std::string host;
+	unsigned short port;
+    };
+
+    /// parse a "host:port" string
+    static endpoint_t parse_endpoint (const std::string & hostport)
+	throw (bad_arg_exception);
+
+    /// a fresh random run nonce, in hex, for cvm-coord to give all the
+    /// workers of one run
+    static std::string make_run_nonce (CryptoProviderFactory * fact);
+
+    /// parse a run nonce from make_run_nonce()
+    static ByteBuffer parse_run_nonce (const std::string & hex)
+	throw (bad_arg_exception);
+
+    /// the run nonce length in bytes, also used for the link challenges
+    static const size_t RUN_NONCE_LEN = 16;
+
+    /// Listen on our own endpoint, connect to all the other workers, and do
+    /// the handshake on every link. Returns once all the links are up.
+    /// @param me our index in 'workers'
+    /// @param enc_key, mac_key the link keys, the same for all workers.
+    /// @param run_nonce this run's nonce, the same for all workers.
+    WorkerLinks (unsigned me,
+		 const std::vector<endpoint_t> & workers,
+		 CryptoProviderFactory * fact,
+		 const ByteBuffer & enc_key,
+		 const ByteBuffer & mac_key,
+		 const ByteBuffer & run_nonce)
+	throw (comm_exception);
+
+    /// Closes our outgoing links, and waits for the other workers to close
+    /// theirs.
+    ~WorkerLinks ();
+
+    /// send a gate value to a worker
+    void send (unsigned to, index_t gate_num, const ByteBuffer & val)
+	throw (comm_exception);
+
+    /// Wait for the value of a gate from whichever worker owns it. Values are
+    /// kept, so a value can be received any number of times.
+    ByteBuffer receive (index_t gate_num)
+	throw (comm_exception);
+
+    
+private:
+
+    struct link_keys_t
+    {
+	ByteBuffer enc, mac;
+    };
+
+    /// derive the keys of the link from 'sender' to 'receiver', given the
+    /// receiver's challenge
+    link_keys_t link_keys (unsigned sender, unsigned receiver,
+			   const ByteBuffer & challenge);
+
+    /// our side of the handshake on the link to worker 'to': answer its
+    /// challenge with a hello
+    void send_hello (unsigned to)
+	throw (comm_exception);
+
+    /// check the hello on a new incoming link, and set it up as the link
+    /// from the worker which sent it
+    void accept_hello (int fd, const ByteBuffer & challenge)
+	throw (comm_exception);
+
+    /// thread body, reading messages from the incoming link from 'sender'
+    void receiver (unsigned sender);
+
+    /// record a failure in a receiver thread, to be thrown by receive()
+    void receiver_failed (const std::string & msg);
+    
+
+    unsigned _me;
+
+    std::vector<endpoint_t> _workers;
+    
+    // by worker number, -1 for ourselves
+    std::vector<int> _out_fds;
+    std::vector<int> _in_fds;
+    
+    // next sequence number on each outgoing link
+    std::vector<uint32_t> _out_seq;
+
+    CryptoProviderFactory * _fact;
+    ByteBuffer _enc_key, _mac_key, _run_nonce;
+
+    // the keys of each link, by worker number
+    std::vector<link_keys_t> _out_keys, _in_keys;
+
+    // only used by the sending (main) thread. each receiver has its own.
+    std::vector<boost::shared_ptr<SymWrapper> > _send_wrappers;
+
+    boost::thread_group _receivers;
+
+    // protects everything below
+    boost::mutex _lock;
+    boost::condition _arrived_cond;
+
+    std::map<index_t, ByteBuffer> _arrived;
+    unsigned _live_receivers;
+    std::string _error;
+
+    
+public:
+    static Log::logger_t logger;
+
+    DECL_STATIC_INIT (
+	logger = Log::makeLogger ("circuit-vm.card.worker-links");
+	);
+};
+
+
+DECL_STATIC_INIT_INSTANCE (WorkerLinks);
+
+
+CLOSE_NS
+
+
+#endif // _WORKER_LINKS_H
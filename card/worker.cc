@@ -0,0 +1,113 @@
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+*/
+
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+
+#include <faerieplay/common/logging.h>
+#include <faerieplay/common/exceptions.h>
+
+#include <common/consts-sfdl.h>
+
+#include "cvm-options.h"
+#include "partition-circuit.h"
+#include "run-circuit.h"
+
+#include "worker.h"
+
+
+using namespace std;
+
+using pir::WorkerLinks;
+
+
+namespace
+{
+    Log::logger_t logger = Log::makeLogger ("circuit-vm.card.worker");
+
+    
+    ByteBuffer read_key_file (const string & name)
+	throw (io_exception)
+    {
+	ifstream in (name.c_str(), ios::binary);
+	if (!in) {
+	    throw io_exception ("Could not open link key file " + name);
+	}
+
+	string key ((istreambuf_iterator<char> (in)),
+		    istreambuf_iterator<char> ());
+
+	return ByteBuffer (key.data(), key.size(), ByteBuffer::deepcopy());
+    }
+}
+
+
+
+vector<WorkerLinks::endpoint_t>
+parse_worker_list (int argc, char * argv[], int first)
+    throw (bad_arg_exception)
+{
+    vector<WorkerLinks::endpoint_t> answer;
+    for (int i = first; i < argc; i++) {
+	answer.push_back (WorkerLinks::parse_endpoint (argv[i]));
+    }
+
+    if (answer.size() < 2 || answer.size() > MAX_PARTITIONS) {
+	ostringstream os;
+	os << "Need between 2 and " << MAX_PARTITIONS << " workers, not "
+	   << answer.size();
+	throw bad_arg_exception (os.str());
+    }
+
+    return answer;
+}
+
+
+
+void run_worker (unsigned part,
+		 const vector<WorkerLinks::endpoint_t> & workers,
+		 const string & cct_name,
+		 CryptoProviderFactory * fact)
+    throw (std::exception)
+{
+    if (part >= workers.size()) {
+	throw bad_arg_exception ("Worker number out of range");
+    }
+    
+    if (g_cvm_options.run_nonce.empty()) {
+	throw bad_arg_exception ("No run nonce in CVM_RUN_NONCE; workers get"
+				 " it from cvm-coord");
+    }
+    
+    ByteBuffer
+	enc_key = read_key_file (g_cvm_options.link_key_dir + DIRSEP + ENC_KEY_FILE),
+	mac_key = read_key_file (g_cvm_options.link_key_dir + DIRSEP + MAC_KEY_FILE),
+	run_nonce = WorkerLinks::parse_run_nonce (g_cvm_options.run_nonce);
+
+    WorkerLinks links (part, workers, fact, enc_key, mac_key, run_nonce);
+
+    pir::CircuitEval evaluator (cct_name, fact);
+
+    LOG (Log::INFO, logger,
+	 "worker " << part << " starting circuit evaluation at " << epoch_time);
+    
+    evaluator.eval_partition (part, links);
+
+    LOG (Log::INFO, logger,
+	 "worker " << part << " done with circuit evaluation at " << epoch_time);
+}
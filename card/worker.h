@@ -0,0 +1,47 @@
+// -*- c++ -*-
+/*
+ * Circuit virtual machine for the Faerieplay hardware-assisted secure
+ * computation project at Dartmouth College.
+ *
+ * Copyright (C) 2003-2007, Alexander Iliev <alex.iliev@gmail.com> and
+ * Sean W. Smith <sws@cs.dartmouth.edu>
+ *
+ * All rights reserved.
+ *
+ * This code is released under a BSD license.
+ * Please see LICENSE.txt for the full license and disclaimers.
+ *
+ */
+
+// Running one partition of a circuit in a cvm worker process. Used by
+// cvm-worker, and by cvm-coord to parse the worker list.
+
+#include <string>
+#include <vector>
+#include <exception>
+
+#include <pir/common/sym_crypto.h>
+
+#include "worker-links.h"
+
+
+#ifndef _WORKER_H
+#define _WORKER_H
+
+
+/// Parse worker addresses "host:port" from argv[first..argc-1]
+std::vector<pir::WorkerLinks::endpoint_t>
+parse_worker_list (int argc, char * argv[], int first)
+    throw (bad_arg_exception);
+
+
+/// Run partition 'part' of the circuit 'cct_name', which was prepared with
+/// the same number of partitions as there are 'workers'.
+void run_worker (unsigned part,
+		 const std::vector<pir::WorkerLinks::endpoint_t> & workers,
+		 const std::string & cct_name,
+		 CryptoProviderFactory * fact)
+    throw (std::exception);
+
+
+#endif // _WORKER_H
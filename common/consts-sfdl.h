@@ -24,6 +24,22 @@ const std::string GATES_CONT = "gates";
 //and here are gate values
 const std::string VALUES_CONT = "values";
 
+// the size class and slot of each gate's value, see card/value-store.h. The
+// values themselves are in containers VALUES_CONT-<class>.
+const std::string VALUE_SLOTS_CONT = "value-slots";
+
+// the bit store slot of each boolean-valued gate, for bitsliced evaluation
+const std::string BOOL_SLOTS_CONT = "bool-slots";
+
+// the narrow lane slot of each 8- and 16-bit gate
+const std::string NARROW_SLOTS_CONT = "narrow-slots";
+
+// the original number of each gate of a renumbered circuit
+const std::string ORIG_NUMS_CONT = "orig-gate-nums";
+
+// the directory of the prepared circuit cache, see card/circuit-cache.h
+const std::string CCT_CACHE_DIR = "cct-cache";
+
 const std::string ENC_KEY_FILE = "enc.key";
 const std::string MAC_KEY_FILE = "mac.key";
 
@@ -298,6 +298,14 @@ gate_t unserialize_gate (const string& gate)
 	}
 	else if (word == "ReadDynArray") {
 	    answer.op.kind = gate_t::ReadDynArray;
+	    // the size of a cluster of reads starting here, and the number of
+	    // fused Slicers, added by prep
+	    if (!(line_str >> answer.op.params[0])) {
+		answer.op.params[0] = 0;
+	    }
+	    if (!(line_str >> answer.op.params[1])) {
+		answer.op.params[1] = 0;
+	    }
 	}
 	else if (word == "WriteDynArray") {
 	    answer.op.kind = gate_t::WriteDynArray;
@@ -315,6 +323,10 @@ gate_t unserialize_gate (const string& gate)
 	    line_str >> answer.op.params[0]; // element size
 	    line_str >> answer.op.params[1]; // array length
 	}
+	else if (word == "Mux") {
+	    answer.op.kind = gate_t::Mux;
+	    line_str >> answer.op.params[0]; // number of selectors
+	}
 	else if (word == "Print") {
 	    answer.op.kind = gate_t::Print;
 	    // TODO: have no way currently to store a string parameter to an op.
@@ -359,6 +371,97 @@ gate_t unserialize_gate (const string& gate)
 }
 
 
+namespace
+{
+    // the circuit file names of the operators, in enum order
+    const char * BINOP_NAMES[] = {
+	"+", "-", "*", "/", "%",
+	"==", "<", ">", "<=", ">=", "!=",
+	">>", "<<",
+	"&&", "||",
+	"&", "|", "^"
+    };
+
+    const char * UNOP_NAMES[] = { "-", "!", "~" };
+}
+
+
+string serialize_gate (const gate_t & g)
+{
+    ostringstream out;
+
+    out << g.num << endl;
+
+    if (elem (gate_t::Output, g.flags)) {
+	out << "Output";
+    }
+    out << endl;
+
+    switch (g.typ.kind) {
+    case gate_t::Array:
+	out << "array " << g.typ.params[0] << " " << g.typ.params[1] << endl;
+	break;
+    case gate_t::Scalar:
+	out << "scalar" << endl;
+	break;
+    }
+
+    switch (g.op.kind) {
+    case gate_t::BinOp:
+	out << "BinOp " << BINOP_NAMES[g.op.params[0]];
+	break;
+    case gate_t::UnOp:
+	out << "UnOp " << UNOP_NAMES[g.op.params[0]];
+	break;
+    case gate_t::Input:
+	out << "Input";
+	break;
+    case gate_t::Select:
+	out << "Select";
+	break;
+    case gate_t::Lit:
+	out << "Lit " << g.op.params[0];
+	break;
+    case gate_t::ReadDynArray:
+	out << "ReadDynArray";
+	if (g.op.params[0] > 1 || g.op.params[1] > 0) {
+	    out << " " << g.op.params[0];
+	}
+	if (g.op.params[1] > 0) {
+	    out << " " << g.op.params[1];
+	}
+	break;
+    case gate_t::WriteDynArray:
+	out << "WriteDynArray " << g.op.params[0] << " " << g.op.params[1];
+	break;
+    case gate_t::Slicer:
+	out << "Slicer " << g.op.params[0] << " " << g.op.params[1];
+	break;
+    case gate_t::InitDynArray:
+	out << "InitDynArray " << g.op.params[0] << " " << g.op.params[1];
+	break;
+    case gate_t::Mux:
+	out << "Mux " << g.op.params[0];
+	break;
+    case gate_t::Print:
+	out << "Print";
+	break;
+    }
+    out << endl;
+
+    for (unsigned i = 0; i < g.inputs.size(); i++) {
+	out << (i > 0 ? " " : "") << g.inputs[i];
+    }
+    out << endl;
+
+    out << g.depth << endl;
+
+    out << g.comment << endl;
+
+    return out.str();
+}
+
+
 ostream& operator<< (ostream & out, const gate_t & g) {
 
     out << "num: " << g.num << endl;
@@ -453,6 +556,9 @@ ostream& operator<< (ostream & out, const gate_t & g) {
     case gate_t::InitDynArray:
 	out << "InitDynArray" << endl;
 	break;
+    case gate_t::Mux:
+	out << "Mux " << g.op.params[0] << endl;
+	break;
 
     default:
 	out << "Unknown op " << g.op.kind << endl;
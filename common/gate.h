@@ -37,14 +37,20 @@ struct gate_t {
     enum gate_op_kind_t {
 	BinOp,
 	UnOp,
-	ReadDynArray,
+	ReadDynArray,		// params: [<size of a read cluster starting here,
+				// see cluster_array_reads()>
+				// [<number of fused Slicers, see
+				// fuse_read_slicers()>]]
 	WriteDynArray,
 	Input,
 	Select,
 	Slicer,
 	Lit,
 	Print,
-	InitDynArray
+	InitDynArray,
+	Mux			// params: <number of selectors n>. inputs: n
+				// selectors, n values, and the default value,
+				// see merge_select_chains()
     };
 
 
@@ -141,6 +147,9 @@ boost::optional<int> do_un_op (gate_t::unop_t op,
 gate_t unserialize_gate (const std::string& gate)
     throw (io_exception);
 
+/// The circuit file form of a gate, which unserialize_gate() reads back.
+std::string serialize_gate (const gate_t & g);
+
 
 std::ostream& operator<< (std::ostream & out, const gate_t & g);
 